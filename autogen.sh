@@ -15,19 +15,19 @@ PACKAGE_VERSION_MICRO="0"
 PACKAGE_VERSION="$PACKAGE_VERSION_MAJOR.$PACKAGE_VERSION_MINOR.$PACKAGE_VERSION_MICRO"
 
 # binaries/libraries to install
-PACKAGE_BINS="ftdi-bitbang ftdi-hd44780 ftdi-control ftdi-spi ftdi-simple-capture"
-PACKAGE_LIBS="libftdi-bitbang libftdi-hd44780 libftdi-spi"
+PACKAGE_BINS="ftdi-bitbang ftdi-hd44780 ftdi-control ftdi-spi ftdi-simple-capture ftdi-simple-scope ftdi-replay"
+PACKAGE_LIBS="libftdi-bitbang libftdi-hd44780 libftdi-spi libftdi-i2c libftdi-capture"
 
 # get build number
 PACKAGE_BUILD=`cat debian/build`
 
 # libraries/binaries to be checked
-PKGLIBSADD="libftdi1:libftdi1"
+PKGLIBSADD="libftdi1:libftdi1 sdl2:sdl2"
 LIBSADD=""
 BINSCHECK="pkg-config:--version"
 
 # include headers when making package
-PACKAGE_HEADERS="ftdi-bitbang.h ftdi-hd44780.h ftdi-spi.h"
+PACKAGE_HEADERS="ftdi-bitbang.h ftdi-trace.h ftdi-emu.h ftdi-hd44780.h ftdi-spi.h ftdi-i2c.h capture-file.h"
 
 
 # check binaries
@@ -8,5 +8,5 @@ Maintainer: $PACKAGE_AUTHORS
 Package: $PACKAGE_NAME
 Architecture: $PACKAGE_ARCH
 Description: $PACKAGE_DESC
-Depends: libftdi1-2
+Depends: libftdi1-2, libsdl2-2.0-0
 "
\ No newline at end of file
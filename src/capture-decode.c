@@ -0,0 +1,507 @@
+/*
+ * ftdi-bitbang
+ *
+ * Online protocol decoders for capture stream.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "capture-decode.h"
+#include "capture-scan.h"
+
+#define RING_COUNT      64
+
+/* uart bit slots */
+#define SLOT_PARITY     8
+#define SLOT_STOP       9
+#define SLOT_START      10
+
+/* spi and i2c events */
+enum {
+	EV_NONE = 0,
+	EV_SELECT,
+	EV_DESELECT,
+	EV_SAMPLE,
+	EV_START,
+	EV_STOP,
+};
+
+static void os_sleep_ms(long ms)
+{
+	struct timespec tp = { ms / 1000, (ms % 1000) * 1000000 };
+	while (nanosleep(&tp, &tp) && errno == EINTR);
+}
+
+static int _parse_pins(char *str, int *pins, int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		char *token = strsep(&str, ",");
+		if (!token || !*token) {
+			return -1;
+		}
+		pins[i] = atoi(token);
+		if (pins[i] < 0 || pins[i] > 7) {
+			return -1;
+		}
+	}
+	return str ? -1 : 0;
+}
+
+static int _uart_init(struct capture_decoder *d, char *args, int sampling_speed)
+{
+	char *token = strsep(&args, ":");
+	int baud = 115200, data_bits = 8, stop_bits = 1, i;
+	char parity = 'N';
+
+	if (_parse_pins(token, d->pins, 1)) {
+		return -1;
+	}
+	if ((token = strsep(&args, ":")) != NULL) {
+		baud = atoi(token);
+	}
+	if ((token = strsep(&args, ":")) != NULL) {
+		if (strlen(token) != 3) {
+			return -1;
+		}
+		data_bits = token[0] - '0';
+		parity = token[1];
+		stop_bits = token[2] - '0';
+	}
+	if (args || baud < 1 || baud > sampling_speed / 2 || data_bits < 5 || data_bits > 8 ||
+	        (parity != 'N' && parity != 'E' && parity != 'O') || stop_bits < 1 || stop_bits > 2) {
+		return -1;
+	}
+
+	/* start, data lsb first, parity and stop bits */
+	d->slots[d->slot_count++] = SLOT_START;
+	for (i = 0; i < data_bits; i++) {
+		d->slots[d->slot_count++] = i;
+	}
+	if (parity != 'N') {
+		d->slots[d->slot_count++] = SLOT_PARITY;
+	}
+	for (i = 0; i < stop_bits; i++) {
+		d->slots[d->slot_count++] = SLOT_STOP;
+	}
+	/* odd parity stored as 1, even as 0, none as -1 */
+	d->pins[1] = parity == 'N' ? -1 : (parity == 'O' ? 1 : 0);
+	d->bit_period = (uint64_t)(((double)sampling_speed / (double)baud) * 4294967296.0);
+	d->mask = 1 << d->pins[0];
+	return 0;
+}
+
+/* event table index from previous and current levels of two pins */
+static inline int _ev_index(struct capture_decoder *d, uint8_t p, uint8_t c)
+{
+	int a = d->pins[0], b = d->pins[3];
+	return (((p >> a) & 1) << 3) | (((p >> b) & 1) << 2) | (((c >> a) & 1) << 1) | ((c >> b) & 1);
+}
+
+static int _spi_init(struct capture_decoder *d, char *args)
+{
+	char *token = strsep(&args, ":");
+	int mode = 0, i, sample_rising;
+
+	if (_parse_pins(token, d->pins, 4)) {
+		return -1;
+	}
+	if (args) {
+		mode = atoi(args);
+		if (mode < 0 || mode > 3) {
+			return -1;
+		}
+	}
+	/* data is sampled on rising clock edge in modes 0 and 3 */
+	sample_rising = ((mode >> 1) ^ (mode & 1)) ? 0 : 1;
+	for (i = 0; i < 16; i++) {
+		int p_sck = (i >> 3) & 1, p_cs = (i >> 2) & 1, c_sck = (i >> 1) & 1, c_cs = i & 1;
+		if (p_cs && !c_cs) {
+			d->events[i] = EV_SELECT;
+		} else if (!p_cs && c_cs) {
+			d->events[i] = EV_DESELECT;
+		} else if (!c_cs && p_sck != c_sck && c_sck == sample_rising) {
+			d->events[i] = EV_SAMPLE;
+		} else {
+			d->events[i] = EV_NONE;
+		}
+	}
+	/* event index uses clock and chip select */
+	d->mask = (1 << d->pins[0]) | (1 << d->pins[3]);
+	return 0;
+}
+
+static int _i2c_init(struct capture_decoder *d, char *args)
+{
+	int pins[2], i;
+
+	if (_parse_pins(args, pins, 2)) {
+		return -1;
+	}
+	/* same event index layout as spi: clock in pins[0], sda in pins[3] */
+	d->pins[0] = pins[0];
+	d->pins[3] = pins[1];
+	for (i = 0; i < 16; i++) {
+		int p_scl = (i >> 3) & 1, p_sda = (i >> 2) & 1, c_scl = (i >> 1) & 1, c_sda = i & 1;
+		if (!p_scl && c_scl) {
+			d->events[i] = EV_SAMPLE;
+		} else if (p_scl && c_scl && p_sda && !c_sda) {
+			d->events[i] = EV_START;
+		} else if (p_scl && c_scl && !p_sda && c_sda) {
+			d->events[i] = EV_STOP;
+		} else {
+			d->events[i] = EV_NONE;
+		}
+	}
+	d->mask = (1 << pins[0]) | (1 << pins[1]);
+	return 0;
+}
+
+int capture_decode_add(struct capture_decode *dec, const char *spec, int sampling_speed)
+{
+	struct capture_decoder *d;
+	char *str, *args;
+	int err = -1, n = 0, i;
+
+	if (dec->count >= CAPTURE_DECODERS_MAX) {
+		fprintf(stderr, "too many decoders, maximum is %d\n", CAPTURE_DECODERS_MAX);
+		return -1;
+	}
+	d = &dec->decoders[dec->count];
+	memset(d, 0, sizeof(*d));
+	str = strdup(spec);
+	args = str;
+	strsep(&args, ":");
+
+	if (!args) {
+		err = -1;
+	} else if (strcmp(str, "uart") == 0) {
+		d->type = CAPTURE_DECODER_UART;
+		err = _uart_init(d, args, sampling_speed);
+	} else if (strcmp(str, "spi") == 0) {
+		d->type = CAPTURE_DECODER_SPI;
+		err = _spi_init(d, args);
+	} else if (strcmp(str, "i2c") == 0) {
+		d->type = CAPTURE_DECODER_I2C;
+		err = _i2c_init(d, args);
+	}
+	if (err) {
+		fprintf(stderr, "invalid decoder: %s\n", spec);
+		free(str);
+		return -1;
+	}
+
+	/* name is type and running number of same type */
+	for (i = 0; i < dec->count; i++) {
+		n += dec->decoders[i].type == d->type ? 1 : 0;
+	}
+	snprintf(d->name, sizeof(d->name), "%s%d", str, n);
+	free(str);
+	dec->sampling_speed = sampling_speed;
+	dec->count++;
+	return 0;
+}
+
+static void _frame_emit(struct capture_decode *dec, struct capture_decoder *d)
+{
+	struct capture_frame *f = &d->frame;
+	static const char *errors[] = { "framing", "parity", "nack", "incomplete" };
+	char line[CAPTURE_FRAME_MAX * 6 + 128], *p = line;
+	int i, first = 1;
+
+	p += sprintf(p, "%llu.%09llu,%s,",
+	             (unsigned long long)(f->n / dec->sampling_speed),
+	             (unsigned long long)((f->n % dec->sampling_speed) * 1000000000ULL / dec->sampling_speed),
+	             d->name);
+	for (i = 0; i < f->len; i++) {
+		p += sprintf(p, i ? " %02x" : "%02x", f->data[i]);
+	}
+	if (d->type == CAPTURE_DECODER_SPI) {
+		*p++ = '|';
+		for (i = 0; i < f->len; i++) {
+			p += sprintf(p, i ? " %02x" : "%02x", f->data2[i]);
+		}
+	}
+	*p++ = ',';
+	for (i = 0; i < 4; i++) {
+		if (f->errors & (1 << i)) {
+			p += sprintf(p, first ? "%s" : "+%s", errors[i]);
+			first = 0;
+		}
+	}
+	*p++ = '\n';
+
+	if (capture_output_write(dec->out, line, p - line)) {
+		dec->error = 1;
+	}
+	f->len = 0;
+	f->errors = 0;
+}
+
+static void _frame_byte(struct capture_decoder *d, uint8_t b, uint8_t b2)
+{
+	if (d->frame.len < CAPTURE_FRAME_MAX) {
+		d->frame.data[d->frame.len] = b;
+		d->frame.data2[d->frame.len] = b2;
+		d->frame.len++;
+	}
+}
+
+static void _uart(struct capture_decode *dec, struct capture_decoder *d, uint64_t n, const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+	int pin = d->pins[0];
+
+	while (i < size) {
+		if (d->state == 0) {
+			/* idle, find falling edge of start bit */
+			uint8_t prev = i > 0 ? data[i - 1] : (d->have_prev ? d->prev : data[0]);
+			i += capture_scan_edge(data + i, size - i, d->mask, prev, 0);
+			if (i >= size) {
+				break;
+			}
+			/* first sample point is center of start bit */
+			d->next_n = n + i + (d->bit_period >> 33);
+			d->next_frac = (d->bit_period >> 1) & 0xffffffffULL;
+			d->frame.n = n + i;
+			d->frame.len = 0;
+			d->frame.errors = 0;
+			d->bits = 0;
+			d->shift = 0;
+			d->state = 1;
+		}
+
+		/* sample bit centers inside this buffer */
+		while (d->state == 1 && d->next_n < n + size) {
+			int v = (data[d->next_n - n] >> pin) & 1;
+			int slot = d->slots[d->bits];
+			if (slot == SLOT_START) {
+				if (v) {
+					/* glitch, not a start bit */
+					d->state = 0;
+				}
+			} else if (slot == SLOT_PARITY) {
+				if ((__builtin_popcount(d->shift) + v + d->pins[1]) & 1) {
+					d->frame.errors |= CAPTURE_FRAME_ERR_PARITY;
+				}
+			} else if (slot == SLOT_STOP) {
+				if (!v) {
+					d->frame.errors |= CAPTURE_FRAME_ERR_FRAMING;
+				}
+			} else {
+				d->shift |= v << slot;
+			}
+			i = d->next_n - n;
+			d->bits++;
+			if (d->state == 1 && d->bits >= d->slot_count) {
+				_frame_byte(d, (uint8_t)d->shift, 0);
+				_frame_emit(dec, d);
+				d->state = 0;
+			}
+			/* next bit center */
+			d->next_frac += d->bit_period & 0xffffffffULL;
+			d->next_n += (d->bit_period >> 32) + (d->next_frac >> 32);
+			d->next_frac &= 0xffffffffULL;
+		}
+		if (d->state == 1) {
+			break;
+		}
+		/* continue looking for next start bit after last sample point */
+		i++;
+	}
+}
+
+/*
+ * In i2c the clock rises once before start or stop condition, that clock
+ * is seen as first bit of next byte and is ignored.
+ */
+static inline int _bits_ignored(struct capture_decoder *d)
+{
+	return d->type == CAPTURE_DECODER_I2C ? 1 : 0;
+}
+
+static void _clocked(struct capture_decode *dec, struct capture_decoder *d, uint64_t n, const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	if (!d->have_prev) {
+		d->prev = data[0];
+		/* chip select may already be active at start */
+		if (d->type == CAPTURE_DECODER_SPI && !((data[0] >> d->pins[3]) & 1)) {
+			d->state = 1;
+			d->frame.n = n;
+			d->frame.errors = CAPTURE_FRAME_ERR_INCOMPLETE;
+		}
+	}
+
+	while (i < size) {
+		size_t count = sizeof(dec->scan_idx) / sizeof(dec->scan_idx[0]), k;
+		uint8_t prev = i > 0 ? data[i - 1] : d->prev;
+		size_t done = capture_scan_transitions(data + i, size - i, d->mask, prev, dec->scan_idx, &count);
+
+		for (k = 0; k < count; k++) {
+			size_t j = i + dec->scan_idx[k];
+			uint8_t p = j > 0 ? data[j - 1] : d->prev, c = data[j];
+			int bit = (c >> d->pins[3]) & 1;
+
+			switch (d->events[_ev_index(d, p, c)]) {
+			case EV_SELECT:
+			case EV_START:
+				/* repeated start ends previous transaction */
+				if (d->state == 1 && (d->frame.len > 0 || d->bits > _bits_ignored(d))) {
+					_frame_emit(dec, d);
+				}
+				d->state = 1;
+				d->frame.n = n + j;
+				d->frame.len = 0;
+				d->frame.errors = 0;
+				d->bits = 0;
+				d->shift = 0;
+				d->shift2 = 0;
+				d->nack = 0;
+				break;
+			case EV_DESELECT:
+			case EV_STOP:
+				d->nack = 0;
+				if (d->state == 1) {
+					if (d->bits > _bits_ignored(d) || d->frame.len < 1) {
+						d->frame.errors |= CAPTURE_FRAME_ERR_INCOMPLETE;
+					}
+					_frame_emit(dec, d);
+				}
+				d->state = 0;
+				break;
+			case EV_SAMPLE:
+				if (d->state != 1) {
+					break;
+				}
+				if (d->type == CAPTURE_DECODER_SPI) {
+					d->shift = (d->shift << 1) | ((c >> d->pins[1]) & 1);
+					d->shift2 = (d->shift2 << 1) | ((c >> d->pins[2]) & 1);
+					if (++d->bits == 8) {
+						_frame_byte(d, (uint8_t)d->shift, (uint8_t)d->shift2);
+						d->bits = 0;
+					}
+				} else if (++d->bits <= 8) {
+					d->shift = (d->shift << 1) | bit;
+					if (d->bits == 8) {
+						_frame_byte(d, (uint8_t)d->shift, 0);
+						/* master read more after not acknowledging */
+						if (d->nack) {
+							d->frame.errors |= CAPTURE_FRAME_ERR_NACK;
+							d->nack = 0;
+						}
+					}
+				} else {
+					/*
+					 * ninth bit is acknowledge, high is nack. Master does not acknowledge
+					 * the last byte it reads, that is fine if stop or repeated start follows.
+					 */
+					if (bit && d->frame.len > 1 && (d->frame.data[0] & 1)) {
+						d->nack = 1;
+					} else if (bit) {
+						d->frame.errors |= CAPTURE_FRAME_ERR_NACK;
+					}
+					d->bits = 0;
+					d->shift = 0;
+				}
+				break;
+			}
+		}
+		i += done;
+	}
+}
+
+static void *_decoder(void *p)
+{
+	struct capture_decode *dec = p;
+	uint8_t *data;
+	size_t size;
+	int i;
+
+	while (1) {
+		data = ringbuffer_read_slot(&dec->ring, &size);
+		if (!data) {
+			/* exit only when stopped and everything has been decoded */
+			if (!dec->exec && ringbuffer_fill(&dec->ring) == 0) {
+				break;
+			}
+			os_sleep_ms(1);
+			continue;
+		}
+		for (i = 0; i < dec->count && size > 0; i++) {
+			struct capture_decoder *d = &dec->decoders[i];
+			if (d->type == CAPTURE_DECODER_UART) {
+				_uart(dec, d, dec->n, data, size);
+			} else {
+				_clocked(dec, d, dec->n, data, size);
+			}
+			d->prev = data[size - 1];
+			d->have_prev = 1;
+		}
+		dec->n += size;
+		ringbuffer_read_release(&dec->ring);
+	}
+
+	/* transactions still open at end of capture */
+	for (i = 0; i < dec->count; i++) {
+		struct capture_decoder *d = &dec->decoders[i];
+		if (d->type != CAPTURE_DECODER_UART && d->state == 1 && (d->frame.len > 0 || d->bits > 0)) {
+			d->frame.errors |= CAPTURE_FRAME_ERR_INCOMPLETE;
+			_frame_emit(dec, d);
+		}
+	}
+
+	return NULL;
+}
+
+int capture_decode_start(struct capture_decode *dec, struct capture_output *out, size_t slot_size)
+{
+	dec->out = out;
+	dec->n = 0;
+	if (ringbuffer_init(&dec->ring, RING_COUNT, slot_size)) {
+		return -1;
+	}
+	dec->exec = 1;
+	if (pthread_create(&dec->thread, NULL, _decoder, dec)) {
+		dec->exec = 0;
+		ringbuffer_free(&dec->ring);
+		return -1;
+	}
+	return 0;
+}
+
+int capture_decode_samples(struct capture_decode *dec, const uint8_t *data, size_t size)
+{
+	while (size > 0 && !dec->error) {
+		uint8_t *slot = ringbuffer_write_slot(&dec->ring, 0);
+		size_t c;
+		if (!slot) {
+			/* decoder has fallen behind */
+			os_sleep_ms(1);
+			continue;
+		}
+		c = size < dec->ring.slot_size ? size : dec->ring.slot_size;
+		memcpy(slot, data, c);
+		ringbuffer_write_commit(&dec->ring, c);
+		data += c;
+		size -= c;
+	}
+	return dec->error ? -1 : 0;
+}
+
+void capture_decode_stop(struct capture_decode *dec)
+{
+	if (!dec->exec) {
+		return;
+	}
+	dec->exec = 0;
+	pthread_join(dec->thread, NULL);
+	ringbuffer_free(&dec->ring);
+}
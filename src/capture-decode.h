@@ -0,0 +1,146 @@
+/*
+ * ftdi-bitbang
+ *
+ * Online protocol decoders for capture stream.
+ *
+ * Decoders are given as:
+ *  uart:RX[:BAUD[:CONFIG]]       default 115200 and 8N1, CONFIG is
+ *                                data bits (5-8), parity (N, E or O)
+ *                                and stop bits (1 or 2)
+ *  spi:SCK,MOSI,MISO,CS[:MODE]   mode 0-3, default 0, chip select is
+ *                                active low, MSB first
+ *  i2c:SCL,SDA
+ *
+ * Each decoder is a state machine driven by lookup tables: SPI and I2C
+ * classify every change of their pins with a 16-entry event table indexed
+ * by previous and current clock/data/select levels, UART steps through
+ * a table of bit slots. Only samples where decoder pins change (or UART
+ * bit centers) are looked at.
+ *
+ * Decoding runs in its own thread, samples are copied to it through
+ * a ring buffer and decoded frames are written to capture output as lines:
+ *  time,decoder,bytes,errors
+ * where bytes are hex, for SPI as MOSI|MISO and for I2C the first byte is
+ * address with R/W bit. Errors are joined with '+': framing, parity,
+ * nack, incomplete. Decoders process one buffer at a time, so frames of
+ * different decoders are ordered only within one decoder.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_DECODE_H__
+#define __CAPTURE_DECODE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "ringbuffer.h"
+#include "capture-output.h"
+
+#define CAPTURE_DECODERS_MAX    8
+#define CAPTURE_FRAME_MAX       256
+
+enum {
+	CAPTURE_DECODER_UART = 0,
+	CAPTURE_DECODER_SPI,
+	CAPTURE_DECODER_I2C,
+};
+
+#define CAPTURE_FRAME_ERR_FRAMING       0x01
+#define CAPTURE_FRAME_ERR_PARITY        0x02
+#define CAPTURE_FRAME_ERR_NACK          0x04
+#define CAPTURE_FRAME_ERR_INCOMPLETE    0x08
+
+struct capture_frame {
+	/* sample index of frame start */
+	uint64_t n;
+	int len;
+	uint8_t data[CAPTURE_FRAME_MAX];
+	/* MISO for SPI */
+	uint8_t data2[CAPTURE_FRAME_MAX];
+	int errors;
+};
+
+struct capture_decoder {
+	int type;
+	char name[16];
+	/* pins: uart rx; spi sck, mosi, miso, cs; i2c scl, sda */
+	int pins[4];
+	uint8_t mask;
+
+	/* uart: bit slot table, bit period as 32.32 fixed point samples */
+	int slot_count;
+	int8_t slots[16];
+	uint64_t bit_period;
+	/* spi and i2c: events by previous and current pin levels */
+	uint8_t events[16];
+
+	/* decoder state */
+	int state;
+	uint8_t prev;
+	int have_prev;
+	int bits;
+	uint32_t shift;
+	uint32_t shift2;
+	/* i2c: master did not acknowledge byte it read, error if more bytes follow */
+	int nack;
+	uint64_t next_n;
+	uint64_t next_frac;
+	struct capture_frame frame;
+};
+
+struct capture_decode {
+	struct capture_decoder decoders[CAPTURE_DECODERS_MAX];
+	int count;
+	int sampling_speed;
+	struct capture_output *out;
+
+	/* samples from capture to decoder thread */
+	struct ringbuffer ring;
+	uint64_t n;
+	pthread_t thread;
+	volatile int exec;
+	volatile int error;
+	uint32_t scan_idx[1024];
+};
+
+/**
+ * Parse decoder specification and add it.
+ *
+ * @param  dec            decode context, zero initialized before first call
+ * @param  spec           decoder specification, see above
+ * @param  sampling_speed samples per second
+ * @return                0 on success or -1 on errors
+ */
+int capture_decode_add(struct capture_decode *dec, const char *spec, int sampling_speed);
+
+/**
+ * Start decoder thread.
+ *
+ * @param  dec            decode context
+ * @param  out            output to write frames to
+ * @param  slot_size      size of sample buffers passed to decoder
+ * @return                0 on success or -1 on errors
+ */
+int capture_decode_start(struct capture_decode *dec, struct capture_output *out, size_t slot_size);
+
+/**
+ * Pass samples to decoder thread.
+ *
+ * @param  dec        decode context
+ * @param  data       samples
+ * @param  size       number of samples
+ * @return            0 on success or -1 on errors
+ */
+int capture_decode_samples(struct capture_decode *dec, const uint8_t *data, size_t size);
+
+/**
+ * Wait until all samples have been decoded and stop decoder thread.
+ *
+ * @param  dec        decode context
+ */
+void capture_decode_stop(struct capture_decode *dec);
+
+
+#endif /* __CAPTURE_DECODE_H__ */
@@ -0,0 +1,167 @@
+/*
+ * ftdi-bitbang
+ *
+ * Indexed capture file format and reader.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture-file.h"
+
+/* close and fail with errno set to given error */
+static int _fail(struct capture_file *cf, int err)
+{
+	capture_file_close(cf);
+	errno = err;
+	return -1;
+}
+
+int capture_file_open(struct capture_file *cf, const char *filename)
+{
+	struct stat st;
+	const uint8_t *footer;
+	uint64_t index_offset;
+
+	memset(cf, 0, sizeof(*cf));
+	cf->fd = open(filename, O_RDONLY);
+	if (cf->fd < 0) {
+		return -1;
+	}
+	if (fstat(cf->fd, &st)) {
+		return _fail(cf, errno);
+	}
+	if (st.st_size < CAPTURE_FILE_BLOCK_SIZE + CAPTURE_FILE_FOOTER_SIZE) {
+		return _fail(cf, EINVAL);
+	}
+	cf->map_size = (size_t)st.st_size;
+	cf->map = mmap(NULL, cf->map_size, PROT_READ, MAP_SHARED, cf->fd, 0);
+	if (cf->map == MAP_FAILED) {
+		cf->map = NULL;
+		return _fail(cf, errno);
+	}
+
+	/* header */
+	if (memcmp(cf->map, "FTCI", 4) || cf->map[4] != CAPTURE_FILE_VERSION) {
+		return _fail(cf, EINVAL);
+	}
+	cf->pins_mask = cf->map[5];
+	cf->sampling_speed = (int)capture_file_get(cf->map + 8, 4);
+	cf->block_size = (size_t)capture_file_get(cf->map + 12, 4);
+
+	/* footer and index, footer is missing if writing was interrupted */
+	footer = cf->map + cf->map_size - CAPTURE_FILE_FOOTER_SIZE;
+	index_offset = capture_file_get(footer, 8);
+	cf->block_count = capture_file_get(footer + 8, 8);
+	cf->samples = capture_file_get(footer + 16, 8);
+	if (memcmp(footer + 24, "FTCE", 4) || cf->block_size < CAPTURE_FILE_RUN_MAX ||
+	        index_offset != (cf->block_count + 1) * cf->block_size ||
+	        index_offset + cf->block_count * CAPTURE_FILE_INDEX_SIZE + CAPTURE_FILE_FOOTER_SIZE != cf->map_size) {
+		return _fail(cf, EINVAL);
+	}
+	cf->index = cf->map + index_offset;
+
+	return 0;
+}
+
+void capture_file_close(struct capture_file *cf)
+{
+	if (cf->map) {
+		munmap(cf->map, cf->map_size);
+	}
+	if (cf->fd >= 0) {
+		close(cf->fd);
+	}
+	memset(cf, 0, sizeof(*cf));
+	cf->fd = -1;
+}
+
+int capture_file_block(struct capture_file *cf, uint64_t b, struct capture_file_block *block)
+{
+	const uint8_t *p;
+	if (b >= cf->block_count) {
+		return -1;
+	}
+	p = cf->index + b * CAPTURE_FILE_INDEX_SIZE;
+	block->first = capture_file_get(p, 8);
+	block->used = (uint32_t)capture_file_get(p + 8, 4);
+	block->first_value = p[12];
+	block->pins_any = p[13];
+	block->pins_all = p[14];
+	block->pins_changed = p[15];
+	block->end = (b + 1) < cf->block_count ? capture_file_get(p + CAPTURE_FILE_INDEX_SIZE, 8) : cf->samples;
+	block->data = cf->map + (b + 1) * cf->block_size;
+	if (block->used > cf->block_size) {
+		block->used = (uint32_t)cf->block_size;
+	}
+	return 0;
+}
+
+int64_t capture_file_find(struct capture_file *cf, uint64_t n)
+{
+	uint64_t lo = 0, hi = cf->block_count;
+	if (n >= cf->samples || cf->block_count < 1) {
+		return -1;
+	}
+	while (hi - lo > 1) {
+		uint64_t mid = (lo + hi) / 2;
+		if (capture_file_get(cf->index + mid * CAPTURE_FILE_INDEX_SIZE, 8) <= n) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return (int64_t)lo;
+}
+
+int64_t capture_file_read(struct capture_file *cf, uint64_t n, uint8_t *buf, size_t count)
+{
+	size_t done = 0;
+	int64_t b = capture_file_find(cf, n);
+
+	for ( ; b >= 0 && done < count; b++) {
+		struct capture_file_block block;
+		const uint8_t *p, *end;
+		uint64_t start;
+
+		if (capture_file_block(cf, (uint64_t)b, &block)) {
+			break;
+		}
+		p = block.data;
+		end = block.data + block.used;
+		start = block.first;
+		while (p < end && done < count) {
+			uint8_t value = *p++;
+			uint64_t len = 0, skip, c;
+			int shift = 0, more = 1;
+			while (more && p < end && shift < 64) {
+				len |= (uint64_t)(*p & 0x7f) << shift;
+				more = *p++ & 0x80;
+				shift += 7;
+			}
+			if (more) {
+				errno = EINVAL;
+				return -1;
+			}
+			/* copy the part of this run that was requested */
+			if (start + len > n) {
+				skip = n > start ? n - start : 0;
+				c = len - skip;
+				c = c < (count - done) ? c : (count - done);
+				memset(buf + done, value, (size_t)c);
+				done += c;
+				n += c;
+			}
+			start += len;
+		}
+	}
+
+	return (int64_t)done;
+}
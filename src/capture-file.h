@@ -0,0 +1,133 @@
+/*
+ * ftdi-bitbang
+ *
+ * Indexed capture file format and reader, reader is in libftdi-capture.
+ *
+ * File is written sequentially and can be mapped into memory for
+ * seeking without decoding from start. All integers are little endian.
+ *
+ * Layout:
+ *  header:  one block, "FTCI", u8 version (1), u8 pins mask, u16 reserved,
+ *           u32 sampling speed, u32 block size, rest zero
+ *  blocks:  fixed size blocks of runs, run is u8 value (masked pins)
+ *           followed by LEB128 encoded run length in samples,
+ *           unused end of block is zero
+ *  index:   16 bytes per block: u64 first sample, u32 used bytes,
+ *           u8 first value, u8 pins high in any run, u8 pins high
+ *           in all runs, u8 pins that changed inside block
+ *  footer:  u64 index offset, u64 block count, u64 total samples,
+ *           "FTCE", u32 reserved
+ *
+ * Block n starts at offset (n + 1) * block size. Since header and
+ * blocks are block size aligned, blocks are page aligned when mapped.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_FILE_H__
+#define __CAPTURE_FILE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_FILE_VERSION        1
+#define CAPTURE_FILE_BLOCK_SIZE     4096
+#define CAPTURE_FILE_INDEX_SIZE     16
+#define CAPTURE_FILE_FOOTER_SIZE    32
+/* value byte and 64-bit LEB128 */
+#define CAPTURE_FILE_RUN_MAX        11
+
+struct capture_file_block {
+	uint64_t first;
+	/* index of the sample after this block */
+	uint64_t end;
+	uint32_t used;
+	uint8_t first_value;
+	uint8_t pins_any;
+	uint8_t pins_all;
+	uint8_t pins_changed;
+	const uint8_t *data;
+};
+
+struct capture_file {
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+
+	uint8_t pins_mask;
+	int sampling_speed;
+	size_t block_size;
+	uint64_t block_count;
+	uint64_t samples;
+	const uint8_t *index;
+};
+
+/**
+ * Open capture file for reading, file is mapped into memory.
+ *
+ * @param  cf         file context
+ * @param  filename   file to open
+ * @return            0 on success or -1 on errors, errno is set
+ *                    (EINVAL if file is not a complete capture file)
+ */
+int capture_file_open(struct capture_file *cf, const char *filename);
+
+/**
+ * Close capture file.
+ *
+ * @param  cf         file context
+ */
+void capture_file_close(struct capture_file *cf);
+
+/**
+ * Get block information from index.
+ *
+ * @param  cf         file context
+ * @param  b          block number
+ * @param  block      information is written here
+ * @return            0 on success or -1 if block does not exist
+ */
+int capture_file_block(struct capture_file *cf, uint64_t b, struct capture_file_block *block);
+
+/**
+ * Find block containing sample using index.
+ *
+ * @param  cf         file context
+ * @param  n          sample index
+ * @return            block number or -1 if n is out of range
+ */
+int64_t capture_file_find(struct capture_file *cf, uint64_t n);
+
+/**
+ * Read samples decoded into buffer, only blocks covering
+ * the requested range are decoded.
+ *
+ * @param  cf         file context
+ * @param  n          index of first sample to read
+ * @param  buf        buffer to read into
+ * @param  count      number of samples to read
+ * @return            number of samples read, less than count at end of file,
+ *                    -1 with errno EINVAL if a run is truncated
+ */
+int64_t capture_file_read(struct capture_file *cf, uint64_t n, uint8_t *buf, size_t count);
+
+/* little endian helpers, shared with writer */
+static inline void capture_file_put(uint8_t *p, uint64_t v, int bytes)
+{
+	for (int i = 0; i < bytes; i++) {
+		p[i] = (v >> (i * 8)) & 0xff;
+	}
+}
+
+static inline uint64_t capture_file_get(const uint8_t *p, int bytes)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < bytes; i++) {
+		v |= (uint64_t)p[i] << (i * 8);
+	}
+	return v;
+}
+
+
+#endif /* __CAPTURE_FILE_H__ */
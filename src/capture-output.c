@@ -0,0 +1,473 @@
+/*
+ * ftdi-bitbang
+ *
+ * Capture output formats.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "capture-output.h"
+#include "capture-scan.h"
+
+#define BLOCK_SIZE      (1024 * 1024)
+#define BLOCK_COUNT     16
+/* longest single record written at once */
+#define RECORD_MAX      256
+
+static void os_sleep_ms(long ms)
+{
+	struct timespec tp = { ms / 1000, (ms % 1000) * 1000000 };
+	while (nanosleep(&tp, &tp) && errno == EINTR);
+}
+
+static void *_writer(void *p)
+{
+	struct capture_output *out = p;
+	uint8_t *data;
+	size_t size;
+
+	while (1) {
+		data = ringbuffer_read_slot(&out->blocks, &size);
+		if (!data) {
+			/* exit only when stopped and everything has been written */
+			if (!out->exec && ringbuffer_fill(&out->blocks) == 0) {
+				break;
+			}
+			os_sleep_ms(1);
+			continue;
+		}
+		while (size > 0 && !out->error) {
+			ssize_t n = write(out->fd, data, size);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n < 0) {
+				fprintf(stderr, "output write failed: %s\n", strerror(errno));
+				out->error = 1;
+				break;
+			}
+			data += n;
+			size -= n;
+		}
+		ringbuffer_read_release(&out->blocks);
+	}
+
+	return NULL;
+}
+
+/* pass current block to writer */
+static int _block_commit(struct capture_output *out)
+{
+	if (out->block && out->block_len > 0) {
+		ringbuffer_write_commit(&out->blocks, out->block_len);
+		out->block = NULL;
+	}
+	return out->error ? -1 : 0;
+}
+
+/* get space for record of at most given size */
+static uint8_t *_reserve(struct capture_output *out, size_t size)
+{
+	if (out->block && (out->block_len + size) > out->blocks.slot_size) {
+		if (_block_commit(out)) {
+			return NULL;
+		}
+	}
+	while (!out->block) {
+		out->block = ringbuffer_write_slot(&out->blocks, 0);
+		out->block_len = 0;
+		if (out->error) {
+			return NULL;
+		} else if (!out->block) {
+			/* writer has fallen behind */
+			os_sleep_ms(1);
+		}
+	}
+	return out->block + out->block_len;
+}
+
+static char *_u64toa(char *p, uint64_t v)
+{
+	char tmp[24];
+	int n = 0;
+	do {
+		tmp[n++] = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	while (n > 0) {
+		*p++ = tmp[--n];
+	}
+	return p;
+}
+
+static uint64_t _vcd_time(struct capture_output *out, uint64_t n)
+{
+	if (!out->vcd_ps_num) {
+		return n;
+	}
+	return (uint64_t)(((unsigned __int128)n * out->vcd_ps_num) / (unsigned int)out->sampling_speed);
+}
+
+/* write filled indexed file block and add it to index */
+static int _ftc_flush(struct capture_output *out)
+{
+	uint8_t *p, *e;
+	if (out->ftc_used < 1) {
+		return 0;
+	}
+	p = _reserve(out, CAPTURE_FILE_BLOCK_SIZE);
+	if (!p) {
+		return -1;
+	}
+	memcpy(p, out->ftc_block, out->ftc_used);
+	memset(p + out->ftc_used, 0, CAPTURE_FILE_BLOCK_SIZE - out->ftc_used);
+	out->block_len += CAPTURE_FILE_BLOCK_SIZE;
+
+	if ((out->ftc_blocks + 1) * CAPTURE_FILE_INDEX_SIZE > out->ftc_index_alloc) {
+		size_t alloc = out->ftc_index_alloc ? out->ftc_index_alloc * 2 : 64 * CAPTURE_FILE_INDEX_SIZE;
+		void *x = realloc(out->ftc_index, alloc);
+		if (!x) {
+			fprintf(stderr, "out of memory for capture file index\n");
+			return -1;
+		}
+		out->ftc_index = x;
+		out->ftc_index_alloc = alloc;
+	}
+	e = out->ftc_index + out->ftc_blocks * CAPTURE_FILE_INDEX_SIZE;
+	capture_file_put(e, out->ftc_first, 8);
+	capture_file_put(e + 8, out->ftc_used, 4);
+	e[12] = out->ftc_first_value;
+	e[13] = out->ftc_any;
+	e[14] = out->ftc_all;
+	e[15] = out->ftc_changed;
+	out->ftc_blocks++;
+	out->ftc_used = 0;
+	return 0;
+}
+
+/* add run to indexed file block */
+static int _ftc_run(struct capture_output *out, uint64_t start, uint64_t len, uint8_t value)
+{
+	uint8_t *p;
+	if (out->ftc_used + CAPTURE_FILE_RUN_MAX > CAPTURE_FILE_BLOCK_SIZE && _ftc_flush(out)) {
+		return -1;
+	}
+	if (out->ftc_used == 0) {
+		out->ftc_first = start;
+		out->ftc_first_value = value;
+		out->ftc_any = 0;
+		out->ftc_all = 0xff;
+		out->ftc_changed = 0;
+		out->ftc_prev = value;
+	}
+	p = out->ftc_block + out->ftc_used;
+	*p++ = value;
+	do {
+		*p++ = (len & 0x7f) | (len > 0x7f ? 0x80 : 0);
+		len >>= 7;
+	} while (len);
+	out->ftc_used = p - out->ftc_block;
+	out->ftc_any |= value;
+	out->ftc_all &= value;
+	out->ftc_changed |= out->ftc_prev ^ value;
+	out->ftc_prev = value;
+	return 0;
+}
+
+/* write last run, last block, index and footer */
+static int _ftc_finish(struct capture_output *out, uint64_t n)
+{
+	uint64_t offset;
+	size_t i, c;
+	uint8_t *p;
+
+	if (out->last_value >= 0 && n > out->last_n && _ftc_run(out, out->last_n, n - out->last_n, (uint8_t)out->last_value)) {
+		return -1;
+	}
+	if (_ftc_flush(out)) {
+		return -1;
+	}
+	offset = (out->ftc_blocks + 1) * CAPTURE_FILE_BLOCK_SIZE;
+	for (i = 0; i < out->ftc_blocks * CAPTURE_FILE_INDEX_SIZE; i += c) {
+		c = out->ftc_blocks * CAPTURE_FILE_INDEX_SIZE - i;
+		c = c < CAPTURE_FILE_BLOCK_SIZE ? c : CAPTURE_FILE_BLOCK_SIZE;
+		p = _reserve(out, c);
+		if (!p) {
+			return -1;
+		}
+		memcpy(p, out->ftc_index + i, c);
+		out->block_len += c;
+	}
+	p = _reserve(out, CAPTURE_FILE_FOOTER_SIZE);
+	if (!p) {
+		return -1;
+	}
+	capture_file_put(p, offset, 8);
+	capture_file_put(p + 8, out->ftc_blocks, 8);
+	capture_file_put(p + 16, n, 8);
+	memcpy(p + 24, "FTCE", 4);
+	capture_file_put(p + 28, 0, 4);
+	out->block_len += CAPTURE_FILE_FOOTER_SIZE;
+	return 0;
+}
+
+static int _write_transition(struct capture_output *out, uint64_t n, uint8_t value)
+{
+	int i;
+	char *p, *s = (char *)_reserve(out, RECORD_MAX);
+	if (!s) {
+		return -1;
+	}
+	p = s;
+
+	if (out->format == CAPTURE_OUTPUT_CSV) {
+		p += sprintf(p, "%g,%s\n", (double)n / (double)out->sampling_speed, (value & out->pins_mask) ? "1" : "0");
+	} else if (out->format == CAPTURE_OUTPUT_VCD) {
+		uint8_t changed = out->last_value < 0 ? out->pins_mask : ((uint8_t)out->last_value ^ value) & out->pins_mask;
+		*p++ = '#';
+		p = _u64toa(p, _vcd_time(out, n));
+		*p++ = '\n';
+		for (i = 0; i < 8; i++) {
+			if (changed & (1 << i)) {
+				*p++ = (value & (1 << i)) ? '1' : '0';
+				*p++ = '!' + i;
+				*p++ = '\n';
+			}
+		}
+	} else if (out->format == CAPTURE_OUTPUT_FTC) {
+		/* previous run ends here */
+		if (out->last_value >= 0 && _ftc_run(out, out->last_n, n - out->last_n, (uint8_t)out->last_value)) {
+			return -1;
+		}
+	} else if (out->format == CAPTURE_OUTPUT_BIN) {
+		uint64_t delta = out->last_value < 0 ? 0 : n - out->last_n;
+		do {
+			*p++ = (delta & 0x7f) | (delta > 0x7f ? 0x80 : 0);
+			delta >>= 7;
+		} while (delta);
+		*p++ = value & out->pins_mask;
+	}
+
+	out->block_len += p - s;
+	out->last_value = value & out->pins_mask;
+	out->last_n = n;
+	return 0;
+}
+
+static int _write_header(struct capture_output *out)
+{
+	int i, n = 0;
+	char *p = (char *)_reserve(out, 1024);
+	if (!p) {
+		return -1;
+	}
+
+	if (out->format == CAPTURE_OUTPUT_VCD) {
+		const char *units[] = { "s", "ms", "us", "ns", "ps", "fs" };
+		uint64_t period_fs = 1000000000000000ULL / (uint64_t)out->sampling_speed;
+		int unit = 5, mul = 1;
+		/* use sample index as timestamp if sample period can be given as timescale */
+		if ((period_fs * (uint64_t)out->sampling_speed) == 1000000000000000ULL) {
+			while (period_fs >= 1000 && (period_fs % 1000) == 0 && unit > 0) {
+				period_fs /= 1000;
+				unit--;
+			}
+			if (period_fs == 1 || period_fs == 10 || period_fs == 100) {
+				mul = (int)period_fs;
+			} else {
+				unit = -1;
+			}
+		} else {
+			unit = -1;
+		}
+		if (unit < 0) {
+			out->vcd_ps_num = 1000000000000ULL;
+			unit = 4;
+			mul = 1;
+		}
+		n += sprintf(p + n, "$comment ftdi-simple-capture, %d samples per second $end\n", out->sampling_speed);
+		n += sprintf(p + n, "$timescale %d %s $end\n", mul, units[unit]);
+		n += sprintf(p + n, "$scope module ftdi $end\n");
+		for (i = 0; i < 8; i++) {
+			if (out->pins_mask & (1 << i)) {
+				n += sprintf(p + n, "$var wire 1 %c ADBUS%d $end\n", '!' + i, i);
+			}
+		}
+		n += sprintf(p + n, "$upscope $end\n$enddefinitions $end\n");
+	} else if (out->format == CAPTURE_OUTPUT_BIN) {
+		uint32_t speed = (uint32_t)out->sampling_speed;
+		memcpy(p, "FTBL", 4);
+		p[4] = 1;
+		p[5] = out->pins_mask;
+		p[6] = 0;
+		p[7] = 0;
+		for (i = 0; i < 4; i++) {
+			p[8 + i] = (speed >> (i * 8)) & 0xff;
+		}
+		n = 12;
+	} else if (out->format == CAPTURE_OUTPUT_FTC) {
+		/* header takes one full block so that data blocks stay aligned */
+		p = (char *)_reserve(out, CAPTURE_FILE_BLOCK_SIZE);
+		if (!p) {
+			return -1;
+		}
+		memset(p, 0, CAPTURE_FILE_BLOCK_SIZE);
+		memcpy(p, "FTCI", 4);
+		p[4] = CAPTURE_FILE_VERSION;
+		p[5] = out->pins_mask;
+		capture_file_put((uint8_t *)p + 8, (uint32_t)out->sampling_speed, 4);
+		capture_file_put((uint8_t *)p + 12, CAPTURE_FILE_BLOCK_SIZE, 4);
+		n = CAPTURE_FILE_BLOCK_SIZE;
+	}
+
+	out->block_len += n;
+	return 0;
+}
+
+int capture_output_format(const char *name)
+{
+	if (strcmp(name, "csv") == 0) {
+		return CAPTURE_OUTPUT_CSV;
+	} else if (strcmp(name, "vcd") == 0) {
+		return CAPTURE_OUTPUT_VCD;
+	} else if (strcmp(name, "bin") == 0) {
+		return CAPTURE_OUTPUT_BIN;
+	} else if (strcmp(name, "raw") == 0) {
+		return CAPTURE_OUTPUT_RAW;
+	} else if (strcmp(name, "ftc") == 0) {
+		return CAPTURE_OUTPUT_FTC;
+	}
+	return -1;
+}
+
+int capture_output_open(struct capture_output *out, const char *filename, int format, uint8_t pins_mask, int sampling_speed)
+{
+	memset(out, 0, sizeof(*out));
+	out->format = format;
+	out->pins_mask = pins_mask;
+	out->sampling_speed = sampling_speed;
+	out->last_value = -1;
+
+	if (!filename || strcmp(filename, "-") == 0) {
+		fflush(stdout);
+		out->fd = STDOUT_FILENO;
+	} else {
+		out->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out->fd < 0) {
+			fprintf(stderr, "unable to open output file %s: %s\n", filename, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (ringbuffer_init(&out->blocks, BLOCK_COUNT, BLOCK_SIZE)) {
+		if (out->fd != STDOUT_FILENO) {
+			close(out->fd);
+		}
+		return -1;
+	}
+	out->exec = 1;
+	if (pthread_create(&out->thread, NULL, _writer, out)) {
+		out->exec = 0;
+		ringbuffer_free(&out->blocks);
+		return -1;
+	}
+
+	return _write_header(out);
+}
+
+int capture_output_samples(struct capture_output *out, uint64_t n, const uint8_t *data, size_t size)
+{
+	size_t i;
+
+	if (out->format == CAPTURE_OUTPUT_RAW) {
+		while (size > 0) {
+			uint8_t *p = _reserve(out, 1);
+			size_t c = out->blocks.slot_size - out->block_len;
+			if (!p) {
+				return -1;
+			}
+			c = c < size ? c : size;
+			memcpy(p, data, c);
+			out->block_len += c;
+			data += c;
+			size -= c;
+		}
+		return 0;
+	}
+
+	/* very first sample is always written */
+	if (out->last_value < 0 && size > 0) {
+		if (_write_transition(out, n, data[0])) {
+			return -1;
+		}
+	}
+
+	while (size > 0) {
+		size_t count = SCAN_INDEX_COUNT;
+		size_t done = capture_scan_transitions(data, size, out->pins_mask, (uint8_t)out->last_value, out->scan_idx, &count);
+		for (i = 0; i < count; i++) {
+			if (_write_transition(out, n + out->scan_idx[i], data[out->scan_idx[i]])) {
+				return -1;
+			}
+		}
+		data += done;
+		size -= done;
+		n += done;
+	}
+	return 0;
+}
+
+int capture_output_write(struct capture_output *out, const void *data, size_t size)
+{
+	const uint8_t *src = data;
+	while (size > 0) {
+		size_t c = size < RECORD_MAX ? size : RECORD_MAX;
+		uint8_t *p = _reserve(out, c);
+		if (!p) {
+			return -1;
+		}
+		memcpy(p, src, c);
+		out->block_len += c;
+		src += c;
+		size -= c;
+	}
+	return 0;
+}
+
+void capture_output_close(struct capture_output *out, uint64_t n)
+{
+	if (!out->exec) {
+		return;
+	}
+	/* vcd end time */
+	if (out->format == CAPTURE_OUTPUT_VCD) {
+		char *p = (char *)_reserve(out, RECORD_MAX);
+		if (p) {
+			char *s = p;
+			*p++ = '#';
+			p = _u64toa(p, _vcd_time(out, n));
+			*p++ = '\n';
+			out->block_len += p - s;
+		}
+	} else if (out->format == CAPTURE_OUTPUT_FTC) {
+		_ftc_finish(out, n);
+	}
+	_block_commit(out);
+	out->exec = 0;
+	pthread_join(out->thread, NULL);
+	ringbuffer_free(&out->blocks);
+	if (out->fd != STDOUT_FILENO) {
+		close(out->fd);
+	}
+	if (out->ftc_index) {
+		free(out->ftc_index);
+		out->ftc_index = NULL;
+	}
+}
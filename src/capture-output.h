@@ -0,0 +1,133 @@
+/*
+ * ftdi-bitbang
+ *
+ * Capture output formats. Output is collected into large blocks
+ * that are written by a separate writer thread.
+ *
+ * Formats:
+ *  csv:    one line per transition, "time,value" where value is 1 if any
+ *          captured pin is high (original ftdi-simple-capture output)
+ *  vcd:    value change dump with one signal per captured pin,
+ *          timestamps are sample indexes when sample period is a valid
+ *          vcd timescale, otherwise picoseconds
+ *  bin:    binary transition log, see below
+ *  raw:    raw sample bytes as read from device, one byte per sample
+ *  ftc:    indexed capture file with run-length compressed fixed size
+ *          blocks and trailing block index, see capture-file.h
+ *
+ * Binary transition log:
+ *  header: "FTBL", u8 version (1), u8 pins mask, u16 reserved (0),
+ *          u32 sampling speed (little endian)
+ *  record: LEB128 encoded count of samples since previous record
+ *          followed by u8 new pin values (masked), first record
+ *          has count zero and holds initial values
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_OUTPUT_H__
+#define __CAPTURE_OUTPUT_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "ringbuffer.h"
+#include "capture-file.h"
+
+/* transitions collected per scan round */
+#define SCAN_INDEX_COUNT    1024
+
+enum {
+	CAPTURE_OUTPUT_CSV = 0,
+	CAPTURE_OUTPUT_VCD,
+	CAPTURE_OUTPUT_BIN,
+	CAPTURE_OUTPUT_RAW,
+	CAPTURE_OUTPUT_FTC,
+};
+
+struct capture_output {
+	int format;
+	int fd;
+	uint8_t pins_mask;
+	int sampling_speed;
+	/* vcd timestamp multiplier from sample index, 0 if sample index is used directly */
+	uint64_t vcd_ps_num;
+
+	/* last written value, -1 before first sample, and its sample index */
+	int last_value;
+	uint64_t last_n;
+	/* transition indexes from scanner */
+	uint32_t scan_idx[SCAN_INDEX_COUNT];
+
+	/* indexed capture file: block being filled and block index */
+	uint8_t ftc_block[CAPTURE_FILE_BLOCK_SIZE];
+	size_t ftc_used;
+	uint64_t ftc_first;
+	uint8_t ftc_first_value;
+	uint8_t ftc_any;
+	uint8_t ftc_all;
+	uint8_t ftc_changed;
+	uint8_t ftc_prev;
+	uint8_t *ftc_index;
+	uint64_t ftc_blocks;
+	size_t ftc_index_alloc;
+
+	/* blocks from producer to writer thread */
+	struct ringbuffer blocks;
+	uint8_t *block;
+	size_t block_len;
+	pthread_t thread;
+	volatile int exec;
+	volatile int error;
+};
+
+/**
+ * Parse output format name.
+ *
+ * @return            format or -1 if not valid
+ */
+int capture_output_format(const char *name);
+
+/**
+ * Open output and start writer thread.
+ *
+ * @param  out            output context
+ * @param  filename       file to write to, NULL or "-" for stdout
+ * @param  format         output format
+ * @param  pins_mask      captured pins
+ * @param  sampling_speed samples per second
+ * @return                0 on success or -1 on errors
+ */
+int capture_output_open(struct capture_output *out, const char *filename, int format, uint8_t pins_mask, int sampling_speed);
+
+/**
+ * Feed samples to output.
+ *
+ * @param  out        output context
+ * @param  n          index of first sample in data, counted from start of capture
+ * @param  data       samples
+ * @param  size       number of samples
+ * @return            0 on success or -1 on errors
+ */
+int capture_output_samples(struct capture_output *out, uint64_t n, const uint8_t *data, size_t size);
+
+/**
+ * Write data to output as is, used for writing decoded data instead of samples.
+ *
+ * @param  out        output context
+ * @param  data       data to write
+ * @param  size       size of data
+ * @return            0 on success or -1 on errors
+ */
+int capture_output_write(struct capture_output *out, const void *data, size_t size);
+
+/**
+ * Finish output, wait until everything is written and close it.
+ *
+ * @param  out        output context
+ * @param  n          index of sample after the last one, used as end time
+ */
+void capture_output_close(struct capture_output *out, uint64_t n);
+
+
+#endif /* __CAPTURE_OUTPUT_H__ */
@@ -0,0 +1,178 @@
+/*
+ * ftdi-bitbang
+ *
+ * Min/max decimation pyramid of captured samples for fast drawing.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "capture-pyramid.h"
+
+static const struct capture_pyramid_node capture_pyramid_empty = { 0xff, 0x00, 0x00, 0xff };
+
+static inline void _merge(struct capture_pyramid_node *a, const struct capture_pyramid_node *b)
+{
+	a->min = b->min < a->min ? b->min : a->min;
+	a->max = b->max > a->max ? b->max : a->max;
+	a->any |= b->any;
+	a->all &= b->all;
+}
+
+/* append complete node to level and build upper levels when pairs complete */
+static int _push(struct capture_pyramid *pyr, const struct capture_pyramid_node *node)
+{
+	struct capture_pyramid_node cur = *node;
+
+	for (int l = 0; l < CAPTURE_PYRAMID_LEVELS; l++) {
+		struct capture_pyramid_level *level = &pyr->levels[l];
+
+		if (level->count >= level->alloc) {
+			size_t alloc = level->alloc > 0 ? level->alloc * 2 : 1024;
+			struct capture_pyramid_node *nodes = realloc(level->nodes, alloc * sizeof(*nodes));
+			if (!nodes) {
+				return -1;
+			}
+			level->nodes = nodes;
+			level->alloc = alloc;
+		}
+		level->nodes[level->count++] = cur;
+		if (l >= pyr->level_count) {
+			pyr->level_count = l + 1;
+		}
+
+		/* odd node waits for its pair */
+		if (level->count & 1) {
+			break;
+		}
+		cur = level->nodes[level->count - 2];
+		_merge(&cur, &level->nodes[level->count - 1]);
+	}
+
+	return 0;
+}
+
+int capture_pyramid_init(struct capture_pyramid *pyr, uint8_t mask)
+{
+	memset(pyr, 0, sizeof(*pyr));
+	pyr->mask = mask;
+	pyr->partial = capture_pyramid_empty;
+	return 0;
+}
+
+void capture_pyramid_free(struct capture_pyramid *pyr)
+{
+	for (int l = 0; l < CAPTURE_PYRAMID_LEVELS; l++) {
+		free(pyr->levels[l].nodes);
+	}
+	memset(pyr, 0, sizeof(*pyr));
+}
+
+void capture_pyramid_clear(struct capture_pyramid *pyr)
+{
+	for (int l = 0; l < CAPTURE_PYRAMID_LEVELS; l++) {
+		pyr->levels[l].count = 0;
+	}
+	pyr->level_count = 0;
+	pyr->samples = 0;
+	pyr->partial = capture_pyramid_empty;
+	pyr->partial_n = 0;
+}
+
+int capture_pyramid_append(struct capture_pyramid *pyr, const uint8_t *data, size_t size)
+{
+	const uint8_t *end = data + size;
+	uint8_t mask = pyr->mask;
+
+	pyr->samples += size;
+	while (data < end) {
+		struct capture_pyramid_node node;
+		uint8_t min, max, any, all;
+
+		/* fill partial node one sample at a time */
+		if (pyr->partial_n > 0 || (size_t)(end - data) < CAPTURE_PYRAMID_BASE) {
+			for ( ; data < end && pyr->partial_n < CAPTURE_PYRAMID_BASE; data++, pyr->partial_n++) {
+				uint8_t v = *data & mask;
+				pyr->partial.min = v < pyr->partial.min ? v : pyr->partial.min;
+				pyr->partial.max = v > pyr->partial.max ? v : pyr->partial.max;
+				pyr->partial.any |= *data;
+				pyr->partial.all &= *data;
+			}
+			if (pyr->partial_n < CAPTURE_PYRAMID_BASE) {
+				break;
+			}
+			if (_push(pyr, &pyr->partial)) {
+				return -1;
+			}
+			pyr->partial = capture_pyramid_empty;
+			pyr->partial_n = 0;
+			continue;
+		}
+
+		/* whole node straight from data, simple loop that vectorizes */
+		min = 0xff;
+		max = 0x00;
+		any = 0x00;
+		all = 0xff;
+		for (int i = 0; i < CAPTURE_PYRAMID_BASE; i++) {
+			uint8_t v = data[i] & mask;
+			min = v < min ? v : min;
+			max = v > max ? v : max;
+			any |= data[i];
+			all &= data[i];
+		}
+		node.min = min;
+		node.max = max;
+		node.any = any;
+		node.all = all;
+		if (_push(pyr, &node)) {
+			return -1;
+		}
+		data += CAPTURE_PYRAMID_BASE;
+	}
+
+	return 0;
+}
+
+int capture_pyramid_get(struct capture_pyramid *pyr, uint64_t start, uint64_t end, struct capture_pyramid_node *node, uint64_t *first, uint64_t *last)
+{
+	uint64_t i, j;
+	int l, found = 0;
+
+	/* whole level 0 nodes inside range */
+	end = end < pyr->samples ? end : pyr->samples;
+	i = (start + CAPTURE_PYRAMID_BASE - 1) >> CAPTURE_PYRAMID_BASE_SHIFT;
+	j = end >> CAPTURE_PYRAMID_BASE_SHIFT;
+	j = j < pyr->levels[0].count ? j : pyr->levels[0].count;
+	if (i > j) {
+		return -1;
+	}
+	*first = i << CAPTURE_PYRAMID_BASE_SHIFT;
+	*last = j << CAPTURE_PYRAMID_BASE_SHIFT;
+
+	/* take unpaired nodes from both ends and continue with their parents */
+	*node = capture_pyramid_empty;
+	for (l = 0; i < j; l++) {
+		const struct capture_pyramid_node *nodes = pyr->levels[l].nodes;
+		if (i & 1) {
+			_merge(node, &nodes[i++]);
+		}
+		if (j & 1) {
+			_merge(node, &nodes[--j]);
+		}
+		i >>= 1;
+		j >>= 1;
+		found = 1;
+	}
+
+	/* end of data in partial node */
+	if (pyr->partial_n > 0 && end == pyr->samples && *last + pyr->partial_n == end) {
+		_merge(node, &pyr->partial);
+		*last = end;
+		found = 1;
+	}
+
+	return found ? 0 : -1;
+}
@@ -0,0 +1,106 @@
+/*
+ * ftdi-bitbang
+ *
+ * Min/max decimation pyramid of captured samples for fast drawing.
+ *
+ * Level 0 node summarizes CAPTURE_PYRAMID_BASE samples, each level above
+ * summarizes two nodes of the level below. Nodes are built as samples are
+ * appended, so exact summary of whole level 0 nodes in any range is
+ * available by combining at most two nodes per level, no matter how many
+ * transitions the range holds. Less than CAPTURE_PYRAMID_BASE samples at
+ * both ends of range are left for caller to summarize from raw samples.
+ *
+ * Appending and reading are not synchronized, use from one thread or
+ * lock externally.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_PYRAMID_H__
+#define __CAPTURE_PYRAMID_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* samples per level 0 node, power of two */
+#define CAPTURE_PYRAMID_BASE_SHIFT  6
+#define CAPTURE_PYRAMID_BASE        (1 << CAPTURE_PYRAMID_BASE_SHIFT)
+#define CAPTURE_PYRAMID_LEVELS      40
+
+struct capture_pyramid_node {
+	/* smallest and largest sample value with pins mask applied */
+	uint8_t min;
+	uint8_t max;
+	/* pins high in any sample and in all samples */
+	uint8_t any;
+	uint8_t all;
+};
+
+struct capture_pyramid_level {
+	struct capture_pyramid_node *nodes;
+	size_t count;
+	size_t alloc;
+};
+
+struct capture_pyramid {
+	uint8_t mask;
+	/* total samples appended */
+	uint64_t samples;
+	int level_count;
+	struct capture_pyramid_level levels[CAPTURE_PYRAMID_LEVELS];
+	/* level 0 node not yet complete */
+	struct capture_pyramid_node partial;
+	size_t partial_n;
+};
+
+/**
+ * Initialize empty pyramid.
+ *
+ * @param  pyr        pyramid context
+ * @param  mask       pins mask applied to sample values for min and max
+ * @return            0 on success or -1 on errors
+ */
+int capture_pyramid_init(struct capture_pyramid *pyr, uint8_t mask);
+
+/**
+ * Free all resources used by pyramid.
+ *
+ * @param  pyr        pyramid context
+ */
+void capture_pyramid_free(struct capture_pyramid *pyr);
+
+/**
+ * Remove all samples but keep allocated memory.
+ *
+ * @param  pyr        pyramid context
+ */
+void capture_pyramid_clear(struct capture_pyramid *pyr);
+
+/**
+ * Append samples and update all levels.
+ *
+ * @param  pyr        pyramid context
+ * @param  data       samples
+ * @param  size       number of samples
+ * @return            0 on success or -1 on errors
+ */
+int capture_pyramid_append(struct capture_pyramid *pyr, const uint8_t *data, size_t size);
+
+/**
+ * Get exact summary of level 0 nodes that are completely inside range.
+ * Range is shrunk to node boundaries, samples between start and first
+ * and between last and end are not included.
+ *
+ * @param  pyr        pyramid context
+ * @param  start      index of first sample
+ * @param  end        index of the sample after range
+ * @param  node       summary is written here
+ * @param  first      first summarized sample is set here
+ * @param  last       index of the sample after summarized part is set here
+ * @return            0 on success, -1 if range holds no whole node
+ */
+int capture_pyramid_get(struct capture_pyramid *pyr, uint64_t start, uint64_t end, struct capture_pyramid_node *node, uint64_t *first, uint64_t *last);
+
+
+#endif /* __CAPTURE_PYRAMID_H__ */
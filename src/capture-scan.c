@@ -0,0 +1,242 @@
+/*
+ * ftdi-bitbang
+ *
+ * Vectorized scanning of capture sample buffers.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include "capture-scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+typedef size_t (*scan_fn)(const uint8_t *, size_t, size_t, uint8_t, uint32_t *, size_t *, size_t);
+typedef size_t (*edge_fn)(const uint8_t *, size_t, size_t, uint8_t, int);
+
+/*
+ * Each implementation scans samples from i to size, comparing every
+ * sample to the one before it, so i must be at least one.
+ * Returns index of first transition that did not fit or size.
+ */
+
+/* emit indexes for set bits in a block bitmask starting at sample i */
+#define EMIT_BITS(bits, i) \
+	while (bits) { \
+		size_t _j = (i) + (size_t)__builtin_ctzll(bits); \
+		if (*n >= max) { \
+			return _j; \
+		} \
+		idx[(*n)++] = (uint32_t)_j; \
+		bits &= bits - 1; \
+	}
+
+static size_t _scan_tail(const uint8_t *data, size_t i, size_t size, uint8_t mask, uint32_t *idx, size_t *n, size_t max)
+{
+	for (; i < size; i++) {
+		if ((data[i] ^ data[i - 1]) & mask) {
+			if (*n >= max) {
+				return i;
+			}
+			idx[(*n)++] = (uint32_t)i;
+		}
+	}
+	return size;
+}
+
+static size_t _edge_tail(const uint8_t *data, size_t i, size_t size, uint8_t mask, int rising)
+{
+	for (; i < size; i++) {
+		int a = (data[i - 1] & mask) ? 1 : 0, b = (data[i] & mask) ? 1 : 0;
+		if (a != b && b == rising) {
+			return i;
+		}
+	}
+	return size;
+}
+
+static size_t _edge_scalar(const uint8_t *data, size_t i, size_t size, uint8_t mask, int rising)
+{
+	uint64_t m = 0x0101010101010101ULL * mask;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t a, b;
+		size_t j;
+		memcpy(&a, data + i, 8);
+		memcpy(&b, data + i - 1, 8);
+		if (!((a ^ b) & m)) {
+			continue;
+		}
+		j = _edge_tail(data, i, i + 8, mask, rising);
+		if (j < i + 8) {
+			return j;
+		}
+	}
+	return _edge_tail(data, i, size, mask, rising);
+}
+
+static size_t _scan_scalar(const uint8_t *data, size_t i, size_t size, uint8_t mask, uint32_t *idx, size_t *n, size_t max)
+{
+	uint64_t m = 0x0101010101010101ULL * mask;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t a, b, x;
+		memcpy(&a, data + i, 8);
+		memcpy(&b, data + i - 1, 8);
+		x = (a ^ b) & m;
+		if (!x) {
+			continue;
+		}
+		/* something changed within these eight, check them one by one */
+		x = _scan_tail(data, i, i + 8, mask, idx, n, max);
+		if (x < i + 8) {
+			return x;
+		}
+	}
+	return _scan_tail(data, i, size, mask, idx, n, max);
+}
+
+#ifdef __SSE2__
+static size_t _scan_sse2(const uint8_t *data, size_t i, size_t size, uint8_t mask, uint32_t *idx, size_t *n, size_t max)
+{
+	__m128i m = _mm_set1_epi8((char)mask), zero = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(data + i - 1));
+		__m128i x = _mm_and_si128(_mm_xor_si128(a, b), m);
+		uint64_t bits = (uint64_t)(~_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) & 0xffff);
+		EMIT_BITS(bits, i);
+	}
+	return _scan_tail(data, i, size, mask, idx, n, max);
+}
+
+static size_t _edge_sse2(const uint8_t *data, size_t i, size_t size, uint8_t mask, int rising)
+{
+	__m128i m = _mm_set1_epi8((char)mask), zero = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16) {
+		/* bit set for samples where all masked pins are low */
+		int low_a = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)(data + i)), m), zero));
+		int low_b = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)(data + i - 1)), m), zero));
+		int bits = (rising ? (low_b & ~low_a) : (low_a & ~low_b)) & 0xffff;
+		if (bits) {
+			return i + (size_t)__builtin_ctz(bits);
+		}
+	}
+	return _edge_tail(data, i, size, mask, rising);
+}
+#endif
+
+#ifdef SCAN_X86
+__attribute__((target("avx2")))
+static size_t _scan_avx2(const uint8_t *data, size_t i, size_t size, uint8_t mask, uint32_t *idx, size_t *n, size_t max)
+{
+	__m256i m = _mm256_set1_epi8((char)mask), zero = _mm256_setzero_si256();
+	for (; i + 64 <= size; i += 64) {
+		/* two vectors per round so quiet stretches cost one branch per 64 samples */
+		__m256i x0 = _mm256_and_si256(_mm256_xor_si256(
+		                                  _mm256_loadu_si256((const __m256i *)(data + i)),
+		                                  _mm256_loadu_si256((const __m256i *)(data + i - 1))), m);
+		__m256i x1 = _mm256_and_si256(_mm256_xor_si256(
+		                                  _mm256_loadu_si256((const __m256i *)(data + i + 32)),
+		                                  _mm256_loadu_si256((const __m256i *)(data + i + 31))), m);
+		uint64_t bits;
+		if (_mm256_testz_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x0, x1))) {
+			continue;
+		}
+		bits = (uint64_t)(uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, zero));
+		bits |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(x1, zero)) << 32;
+		EMIT_BITS(bits, i);
+	}
+	return _scan_tail(data, i, size, mask, idx, n, max);
+}
+
+__attribute__((target("avx2")))
+static size_t _edge_avx2(const uint8_t *data, size_t i, size_t size, uint8_t mask, int rising)
+{
+	__m256i m = _mm256_set1_epi8((char)mask), zero = _mm256_setzero_si256();
+	for (; i + 32 <= size; i += 32) {
+		/* bit set for samples where all masked pins are low */
+		uint32_t low_a = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)(data + i)), m), zero));
+		uint32_t low_b = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)(data + i - 1)), m), zero));
+		uint32_t bits = rising ? (low_b & ~low_a) : (low_a & ~low_b);
+		if (bits) {
+			return i + (size_t)__builtin_ctz(bits);
+		}
+	}
+	return _edge_tail(data, i, size, mask, rising);
+}
+#endif
+
+static scan_fn _scan = NULL;
+static edge_fn _edge = NULL;
+static const char *_scan_name = NULL;
+
+static void _scan_select(void)
+{
+	_scan = _scan_scalar;
+	_edge = _edge_scalar;
+	_scan_name = "scalar";
+#ifdef __SSE2__
+	_scan = _scan_sse2;
+	_edge = _edge_sse2;
+	_scan_name = "sse2";
+#endif
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		_scan = _scan_avx2;
+		_edge = _edge_avx2;
+		_scan_name = "avx2";
+	}
+#endif
+}
+
+size_t capture_scan_transitions(const uint8_t *data, size_t size, uint8_t mask, uint8_t prev, uint32_t *idx, size_t *count)
+{
+	size_t n = 0, max = *count, i;
+
+	if (!_scan) {
+		_scan_select();
+	}
+	*count = 0;
+	if (size < 1 || max < 1) {
+		return 0;
+	}
+
+	/* first sample is compared to previous buffer */
+	if ((data[0] ^ prev) & mask) {
+		idx[n++] = 0;
+	}
+	i = _scan(data, 1, size, mask, idx, &n, max);
+	*count = n;
+	return i;
+}
+
+size_t capture_scan_edge(const uint8_t *data, size_t size, uint8_t mask, uint8_t prev, int rising)
+{
+	int a = (prev & mask) ? 1 : 0, b;
+
+	if (!_edge) {
+		_scan_select();
+	}
+	if (size < 1) {
+		return 0;
+	}
+
+	/* first sample is compared to previous buffer */
+	b = (data[0] & mask) ? 1 : 0;
+	if (a != b && b == rising) {
+		return 0;
+	}
+	return _edge(data, 1, size, mask, rising);
+}
+
+const char *capture_scan_impl(void)
+{
+	if (!_scan) {
+		_scan_select();
+	}
+	return _scan_name;
+}
@@ -0,0 +1,60 @@
+/*
+ * ftdi-bitbang
+ *
+ * Vectorized scanning of capture sample buffers.
+ *
+ * Every sample is compared against the previous sample under pin mask
+ * to find transitions or trigger edges. Uses AVX2 or SSE2
+ * when available and a scalar fallback that compares eight samples
+ * at a time otherwise.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_SCAN_H__
+#define __CAPTURE_SCAN_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Find transitions from buffer.
+ *
+ * Scanning stops at end of buffer or when count indexes have been found
+ * and next transition would not fit. Scanning can be continued by calling
+ * again with data advanced by the returned amount and prev set to
+ * the last sample scanned.
+ *
+ * @param  data       samples
+ * @param  size       number of samples, must be less than 4G
+ * @param  mask       pins to compare
+ * @param  prev       sample before the first one in data
+ * @param  idx        transition indexes relative to data are written here
+ * @param  count      maximum number of indexes in, number of indexes found out
+ * @return            number of samples scanned
+ */
+size_t capture_scan_transitions(const uint8_t *data, size_t size, uint8_t mask, uint8_t prev, uint32_t *idx, size_t *count);
+
+/**
+ * Find first edge from buffer.
+ *
+ * Edge is detected when state of masked pins changes from all low
+ * to any high (rising) or from any high to all low (falling).
+ *
+ * @param  data       samples
+ * @param  size       number of samples
+ * @param  mask       pins to check
+ * @param  prev       sample before the first one in data
+ * @param  rising     1 for rising edge, 0 for falling edge
+ * @return            index of first sample after the edge or size if not found
+ */
+size_t capture_scan_edge(const uint8_t *data, size_t size, uint8_t mask, uint8_t prev, int rising);
+
+/**
+ * Name of the scan implementation selected for this cpu.
+ */
+const char *capture_scan_impl(void);
+
+
+#endif /* __CAPTURE_SCAN_H__ */
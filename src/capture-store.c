@@ -0,0 +1,261 @@
+/*
+ * ftdi-bitbang
+ *
+ * Run-length compressed in-memory storage for captured samples.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "capture-store.h"
+#include "capture-scan.h"
+
+#define BLOCK_BYTES_DEFAULT     4096
+/* value byte and 64-bit LEB128 */
+#define RUN_BYTES_MAX           11
+#define CACHE_NONE              ((size_t)-1)
+
+static struct capture_store_block *_block_new(struct capture_store *st, uint64_t first)
+{
+	struct capture_store_block *block;
+	if (st->block_count >= st->block_alloc) {
+		size_t alloc = st->block_alloc ? st->block_alloc * 2 : 64;
+		void *p = realloc(st->blocks, alloc * sizeof(*st->blocks));
+		if (!p) {
+			return NULL;
+		}
+		st->blocks = p;
+		st->block_alloc = alloc;
+	}
+	block = &st->blocks[st->block_count];
+	block->data = malloc(st->block_bytes + RUN_BYTES_MAX);
+	if (!block->data) {
+		return NULL;
+	}
+	block->first = first;
+	block->size = 0;
+	st->block_count++;
+	return block;
+}
+
+/* encode pending run that ends at sample end */
+static int _run_encode(struct capture_store *st, uint64_t end)
+{
+	struct capture_store_block *block = &st->blocks[st->block_count - 1];
+	uint64_t len = end - st->run_start;
+	uint8_t *p;
+
+	/* start new block if current one is full */
+	if (block->size >= st->block_bytes) {
+		block = _block_new(st, st->run_start);
+		if (!block) {
+			return -1;
+		}
+	}
+
+	p = block->data + block->size;
+	*p++ = (uint8_t)st->run_value;
+	do {
+		*p++ = (len & 0x7f) | (len > 0x7f ? 0x80 : 0);
+		len >>= 7;
+	} while (len);
+	st->bytes += (p - block->data) - block->size;
+	block->size = p - block->data;
+	return 0;
+}
+
+int capture_store_init(struct capture_store *st, size_t block_bytes)
+{
+	memset(st, 0, sizeof(*st));
+	st->block_bytes = block_bytes > 0 ? block_bytes : BLOCK_BYTES_DEFAULT;
+	st->cache_block = CACHE_NONE;
+	st->run_value = -1;
+	if (!_block_new(st, 0)) {
+		capture_store_free(st);
+		return -1;
+	}
+	return 0;
+}
+
+void capture_store_free(struct capture_store *st)
+{
+	for (size_t i = 0; i < st->block_count; i++) {
+		free(st->blocks[i].data);
+	}
+	free(st->blocks);
+	free(st->cache_start);
+	free(st->cache_value);
+	memset(st, 0, sizeof(*st));
+	st->cache_block = CACHE_NONE;
+}
+
+void capture_store_clear(struct capture_store *st)
+{
+	for (size_t i = 1; i < st->block_count; i++) {
+		free(st->blocks[i].data);
+	}
+	st->block_count = st->block_count > 0 ? 1 : 0;
+	if (st->block_count) {
+		st->blocks[0].size = 0;
+	}
+	st->samples = 0;
+	st->bytes = 0;
+	st->run_value = -1;
+	st->run_start = 0;
+	st->cache_block = CACHE_NONE;
+}
+
+int capture_store_append(struct capture_store *st, const uint8_t *data, size_t size)
+{
+	if (size < 1 || st->block_count < 1) {
+		return size < 1 ? 0 : -1;
+	}
+	if (st->run_value < 0) {
+		st->run_value = data[0];
+		st->run_start = st->samples;
+	}
+
+	while (size > 0) {
+		size_t count = sizeof(st->scan_idx) / sizeof(st->scan_idx[0]);
+		size_t done = capture_scan_transitions(data, size, 0xff, (uint8_t)st->run_value, st->scan_idx, &count);
+		for (size_t k = 0; k < count; k++) {
+			uint64_t n = st->samples + st->scan_idx[k];
+			if (_run_encode(st, n)) {
+				return -1;
+			}
+			st->run_value = data[st->scan_idx[k]];
+			st->run_start = n;
+		}
+		data += done;
+		size -= done;
+		st->samples += done;
+	}
+
+	return 0;
+}
+
+/* find block containing sample n */
+static size_t _block_find(struct capture_store *st, uint64_t n)
+{
+	size_t lo = 0, hi = st->block_count;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (st->blocks[mid].first <= n) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static int _block_decode(struct capture_store *st, size_t b)
+{
+	struct capture_store_block *block = &st->blocks[b];
+	uint8_t *p = block->data, *end = block->data + block->size;
+	uint64_t start = 0;
+
+	/* open block keeps growing, decode again if it has changed */
+	if (st->cache_block == b && st->cache_size == block->size) {
+		return 0;
+	}
+
+	st->cache_runs = 0;
+	while (p < end) {
+		uint64_t len = 0;
+		int shift = 0;
+		if (st->cache_runs >= st->cache_alloc) {
+			size_t alloc = st->cache_alloc ? st->cache_alloc * 2 : 1024;
+			void *s, *v;
+			st->cache_block = CACHE_NONE;
+			s = realloc(st->cache_start, alloc * sizeof(*st->cache_start));
+			if (!s) {
+				return -1;
+			}
+			st->cache_start = s;
+			v = realloc(st->cache_value, alloc * sizeof(*st->cache_value));
+			if (!v) {
+				return -1;
+			}
+			st->cache_value = v;
+			st->cache_alloc = alloc;
+		}
+		st->cache_value[st->cache_runs] = *p++;
+		do {
+			len |= (uint64_t)(*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+		st->cache_start[st->cache_runs] = start;
+		st->cache_runs++;
+		start += len;
+	}
+
+	st->cache_block = b;
+	st->cache_size = block->size;
+	return 0;
+}
+
+int capture_store_run(struct capture_store *st, uint64_t n, uint64_t *end)
+{
+	size_t b, lo, hi;
+	uint64_t offset, block_end;
+
+	if (n >= st->samples) {
+		return -1;
+	}
+	/* pending run is not encoded yet */
+	if (n >= st->run_start) {
+		if (end) {
+			*end = st->samples;
+		}
+		return st->run_value;
+	}
+
+	b = _block_find(st, n);
+	if (_block_decode(st, b) || st->cache_runs < 1) {
+		return -1;
+	}
+	offset = n - st->blocks[b].first;
+	for (lo = 0, hi = st->cache_runs; hi - lo > 1; ) {
+		size_t mid = (lo + hi) / 2;
+		if (st->cache_start[mid] <= offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	if (end) {
+		if (lo + 1 < st->cache_runs) {
+			*end = st->blocks[b].first + st->cache_start[lo + 1];
+		} else {
+			block_end = b + 1 < st->block_count ? st->blocks[b + 1].first : st->run_start;
+			*end = block_end;
+		}
+	}
+	return st->cache_value[lo];
+}
+
+int capture_store_get(struct capture_store *st, uint64_t n)
+{
+	return capture_store_run(st, n, NULL);
+}
+
+size_t capture_store_read(struct capture_store *st, uint64_t n, uint8_t *buf, size_t count)
+{
+	size_t done = 0;
+	while (done < count) {
+		uint64_t end;
+		size_t c;
+		int v = capture_store_run(st, n, &end);
+		if (v < 0) {
+			break;
+		}
+		c = (end - n) < (count - done) ? (size_t)(end - n) : count - done;
+		memset(buf + done, v, c);
+		done += c;
+		n += c;
+	}
+	return done;
+}
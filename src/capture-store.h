@@ -0,0 +1,124 @@
+/*
+ * ftdi-bitbang
+ *
+ * Run-length compressed in-memory storage for captured samples.
+ *
+ * Samples are stored as runs of same value, each run is encoded as
+ * value byte followed by LEB128 encoded run length, so idle lines take
+ * almost no memory. Runs are grouped into blocks of about block_bytes
+ * encoded bytes, block index holds the first sample index of each block
+ * for random access. Blocks are decoded only when read, latest decoded
+ * block is cached.
+ *
+ * Appending and reading are not synchronized, use from one thread or
+ * lock externally.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_STORE_H__
+#define __CAPTURE_STORE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct capture_store_block {
+	/* index of first sample in block */
+	uint64_t first;
+	uint8_t *data;
+	size_t size;
+};
+
+struct capture_store {
+	/* total samples stored */
+	uint64_t samples;
+	/* encoded bytes in all blocks */
+	size_t bytes;
+	size_t block_bytes;
+
+	/* block index, last block is open for appending */
+	struct capture_store_block *blocks;
+	size_t block_count;
+	size_t block_alloc;
+
+	/* run not yet encoded */
+	int run_value;
+	uint64_t run_start;
+
+	/* decoded block cache: run start offsets relative to block and values */
+	size_t cache_block;
+	size_t cache_size;
+	uint64_t *cache_start;
+	uint8_t *cache_value;
+	size_t cache_runs;
+	size_t cache_alloc;
+
+	uint32_t scan_idx[1024];
+};
+
+/**
+ * Initialize empty store.
+ *
+ * @param  st          store context
+ * @param  block_bytes target size of one encoded block, 0 for default
+ * @return             0 on success or -1 on errors
+ */
+int capture_store_init(struct capture_store *st, size_t block_bytes);
+
+/**
+ * Free all resources used by store.
+ *
+ * @param  st         store context
+ */
+void capture_store_free(struct capture_store *st);
+
+/**
+ * Remove all samples but keep allocated memory.
+ *
+ * @param  st         store context
+ */
+void capture_store_clear(struct capture_store *st);
+
+/**
+ * Append samples to the end of store.
+ *
+ * @param  st         store context
+ * @param  data       samples
+ * @param  size       number of samples
+ * @return            0 on success or -1 on errors
+ */
+int capture_store_append(struct capture_store *st, const uint8_t *data, size_t size);
+
+/**
+ * Get run of samples containing given sample.
+ *
+ * @param  st         store context
+ * @param  n          sample index
+ * @param  end        index of the sample after the run is set here if not NULL
+ * @return            sample value or -1 if n is out of range
+ */
+int capture_store_run(struct capture_store *st, uint64_t n, uint64_t *end);
+
+/**
+ * Get single sample.
+ *
+ * @param  st         store context
+ * @param  n          sample index
+ * @return            sample value or -1 if n is out of range
+ */
+int capture_store_get(struct capture_store *st, uint64_t n);
+
+/**
+ * Read samples decoded into buffer.
+ *
+ * @param  st         store context
+ * @param  n          index of first sample to read
+ * @param  buf        buffer to read into
+ * @param  count      number of samples to read
+ * @return            number of samples read, less than count at end of store
+ */
+size_t capture_store_read(struct capture_store *st, uint64_t n, uint8_t *buf, size_t count);
+
+
+#endif /* __CAPTURE_STORE_H__ */
@@ -0,0 +1,260 @@
+/*
+ * ftdi-bitbang
+ *
+ * Multi-pin trigger engine for capture.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "capture-trigger.h"
+#include "capture-scan.h"
+
+#define EDGE_UNKNOWN    UINT64_MAX
+
+static int _parse_time(const char *str, char **end, int sampling_speed, uint64_t *samples)
+{
+	double t = strtod(str, end);
+	if (*end == str || t < 0) {
+		return -1;
+	}
+	if (strncmp(*end, "ms", 2) == 0) {
+		t /= 1e3;
+		*end += 2;
+	} else if (strncmp(*end, "us", 2) == 0) {
+		t /= 1e6;
+		*end += 2;
+	} else if (strncmp(*end, "ns", 2) == 0) {
+		t /= 1e9;
+		*end += 2;
+	} else if (**end == 's') {
+		*end += 1;
+	}
+	*samples = (uint64_t)llround(t * (double)sampling_speed);
+	return 0;
+}
+
+static int _compile_term(struct capture_trigger *trig, int s, char *term, int sampling_speed)
+{
+	struct capture_trigger_stage *stage = &trig->stages[s];
+	uint32_t bit = 1UL << s;
+	char *p = strchr(term, ':');
+	int pin, v, level = -1, rising = 0, falling = 0, either = 0;
+
+	if (!p || p == term) {
+		fprintf(stderr, "invalid trigger condition: %s\n", term);
+		return -1;
+	}
+	*p++ = '\0';
+	pin = atoi(term);
+	if (pin < 0 || pin > 7) {
+		fprintf(stderr, "invalid trigger pin: %d\n", pin);
+		return -1;
+	}
+
+	/* long edge names are accepted as older versions did */
+	if (strcmp(p, "r") == 0 || strcmp(p, "rising") == 0) {
+		rising = 1;
+	} else if (strcmp(p, "f") == 0 || strcmp(p, "falling") == 0) {
+		falling = 1;
+	} else if (strcmp(p, "e") == 0) {
+		either = 1;
+	} else if (strcmp(p, "1") == 0 || strcmp(p, "h") == 0) {
+		level = 1;
+	} else if (strcmp(p, "0") == 0 || strcmp(p, "l") == 0) {
+		level = 0;
+	} else if ((*p == 'h' || *p == 'l') && (p[1] == '<' || p[1] == '>')) {
+		if (stage->pulse_pin >= 0) {
+			fprintf(stderr, "only one pulse condition allowed per trigger stage\n");
+			return -1;
+		}
+		/* pulse ends at the opposite edge */
+		if (*p == 'h') {
+			falling = 1;
+		} else {
+			rising = 1;
+		}
+		stage->pulse_pin = pin;
+		stage->pulse_min = 0;
+		stage->pulse_max = UINT64_MAX;
+		for (p++; *p; ) {
+			char op = *p++;
+			uint64_t samples;
+			if ((op != '<' && op != '>') || _parse_time(p, &p, sampling_speed, &samples)) {
+				fprintf(stderr, "invalid trigger pulse width: %s\n", p);
+				return -1;
+			}
+			if (op == '>') {
+				stage->pulse_min = samples + 1;
+			} else {
+				stage->pulse_max = samples > 0 ? samples - 1 : 0;
+			}
+		}
+	} else {
+		fprintf(stderr, "invalid trigger condition for pin %d: %s\n", pin, p);
+		return -1;
+	}
+
+	/* clear stage bit from table entries where this condition is false */
+	for (v = 0; v < 256; v++) {
+		int high = (v >> pin) & 1;
+		if ((rising && high) || (falling && !high)) {
+			trig->t_prev[v] &= ~bit;
+		}
+		if ((rising && !high) || (falling && high) || (level >= 0 && high != level)) {
+			trig->t_cur[v] &= ~bit;
+		}
+		if (either && !high) {
+			trig->t_diff[v] &= ~bit;
+		}
+	}
+
+	stage->care |= 1 << pin;
+	if (rising || falling) {
+		stage->edge_mask |= 1 << pin;
+		stage->edge_rising = rising;
+	}
+	stage->edge_only = stage->edge_only < 0 && (rising || falling) && stage->pulse_pin < 0 ? 1 : 0;
+	return 0;
+}
+
+int capture_trigger_compile(struct capture_trigger *trig, const char *spec, int sampling_speed)
+{
+	char *str = strdup(spec), *stages = str, *stage_str;
+	int err = 0;
+
+	memset(trig, 0, sizeof(*trig));
+	for (int v = 0; v < 256; v++) {
+		trig->t_prev[v] = trig->t_cur[v] = trig->t_diff[v] = UINT32_MAX;
+	}
+
+	while (!err && (stage_str = strsep(&stages, ",")) != NULL) {
+		char *term;
+		struct capture_trigger_stage *stage = &trig->stages[trig->stage_count];
+		if (trig->stage_count >= CAPTURE_TRIGGER_STAGES_MAX) {
+			fprintf(stderr, "too many trigger stages, maximum is %d\n", CAPTURE_TRIGGER_STAGES_MAX);
+			err = -1;
+			break;
+		}
+		stage->pulse_pin = -1;
+		/* -1 until first term, then 1 only while stage is a single edge */
+		stage->edge_only = -1;
+		while ((term = strsep(&stage_str, "+")) != NULL) {
+			if (_compile_term(trig, trig->stage_count, term, sampling_speed)) {
+				err = -1;
+				break;
+			}
+		}
+		if (!err && stage->edge_only < 0) {
+			fprintf(stderr, "empty trigger stage\n");
+			err = -1;
+		}
+		trig->stage_count++;
+	}
+
+	free(str);
+	capture_trigger_reset(trig);
+	return err;
+}
+
+void capture_trigger_reset(struct capture_trigger *trig)
+{
+	trig->stage = 0;
+	trig->prev = -1;
+	trig->fresh = 1;
+	for (int i = 0; i < 8; i++) {
+		trig->edge_n[i] = EDGE_UNKNOWN;
+	}
+}
+
+/* check sample against current stage, returns 1 when trigger fires */
+static int _check(struct capture_trigger *trig, uint8_t p, uint8_t c, uint64_t n)
+{
+	struct capture_trigger_stage *stage = &trig->stages[trig->stage];
+	int match = (trig->t_prev[p] & trig->t_cur[c] & trig->t_diff[p ^ c]) & (1UL << trig->stage) ? 1 : 0;
+
+	trig->fresh = 0;
+	if (stage->pulse_pin >= 0) {
+		uint64_t start = trig->edge_n[stage->pulse_pin];
+		if (match) {
+			match = start != EDGE_UNKNOWN && (n - start) >= stage->pulse_min && (n - start) <= stage->pulse_max;
+		}
+		if ((p ^ c) & (1 << stage->pulse_pin)) {
+			trig->edge_n[stage->pulse_pin] = n;
+		}
+	}
+	if (!match) {
+		return 0;
+	}
+
+	/* next stage, pulse timing starts over */
+	trig->stage++;
+	if (trig->stage >= trig->stage_count) {
+		return 1;
+	}
+	trig->fresh = 1;
+	for (int i = 0; i < 8; i++) {
+		trig->edge_n[i] = EDGE_UNKNOWN;
+	}
+	return 0;
+}
+
+size_t capture_trigger_scan(struct capture_trigger *trig, const uint8_t *data, size_t size, uint64_t n)
+{
+	size_t i = 0;
+
+	if (size < 1 || trig->stage >= trig->stage_count) {
+		return size;
+	}
+	/* very first sample is compared to itself */
+	if (trig->prev < 0) {
+		trig->prev = data[0];
+	}
+
+	while (i < size) {
+		struct capture_trigger_stage *stage = &trig->stages[trig->stage];
+		uint8_t prev = i > 0 ? data[i - 1] : (uint8_t)trig->prev;
+		size_t count = sizeof(trig->scan_idx) / sizeof(trig->scan_idx[0]), done, k;
+
+		/* check first sample of a new stage even if nothing changed */
+		if (trig->fresh) {
+			if (_check(trig, prev, data[i], n + i)) {
+				return i;
+			}
+			i++;
+			continue;
+		}
+
+		/* single edge can be searched directly */
+		if (stage->edge_only) {
+			i += capture_scan_edge(data + i, size - i, stage->edge_mask, prev, stage->edge_rising);
+			if (i < size && _check(trig, i > 0 ? data[i - 1] : (uint8_t)trig->prev, data[i], n + i)) {
+				return i;
+			}
+			i++;
+			continue;
+		}
+
+		/* otherwise check only samples where pins used by this stage change */
+		done = capture_scan_transitions(data + i, size - i, stage->care, prev, trig->scan_idx, &count);
+		for (k = 0; k < count; k++) {
+			size_t j = i + trig->scan_idx[k];
+			if (_check(trig, j > 0 ? data[j - 1] : (uint8_t)trig->prev, data[j], n + j)) {
+				return j;
+			}
+			if (trig->fresh) {
+				/* stage changed, continue from next sample */
+				done = trig->scan_idx[k] + 1;
+				break;
+			}
+		}
+		i += done;
+	}
+
+	trig->prev = data[size - 1];
+	return size;
+}
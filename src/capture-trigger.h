@@ -0,0 +1,105 @@
+/*
+ * ftdi-bitbang
+ *
+ * Multi-pin trigger engine for capture.
+ *
+ * Trigger is given as one or more stages separated by commas,
+ * stages must match in order and trigger fires when the last one matches.
+ * Stage is one or more pin conditions joined with '+', all of which must
+ * be true on the same sample:
+ *  PIN:r       rising edge
+ *  PIN:f       falling edge
+ *  PIN:e       either edge
+ *  PIN:1       pin is high (or PIN:h)
+ *  PIN:0       pin is low (or PIN:l)
+ *  PIN:h>TIME  high pulse longer than TIME ended (falling edge)
+ *  PIN:h<TIME  high pulse shorter than TIME ended, both limits can be
+ *              given at the same time, for example 0:h>10us<20us
+ *  PIN:l>TIME, PIN:l<TIME
+ *              same for low pulse (ends at rising edge)
+ * TIME is seconds with optional suffix ms, us or ns.
+ * Only one pulse condition is allowed per stage.
+ *
+ * Examples:
+ *  0:r             rising edge on pin 0 (same as before)
+ *  0:f+1:0+2:1     falling edge on pin 0 while pin 1 is low and pin 2 high
+ *  3:l>50us,0:r    low pulse longer than 50 us on pin 3, then rising edge on pin 0
+ *
+ * Each stage is compiled into bits in three 256-entry tables, indexed by
+ * previous sample, current sample and their difference, so checking
+ * all stages for a sample is three lookups. Samples are only checked
+ * when pins used by current stage change.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_TRIGGER_H__
+#define __CAPTURE_TRIGGER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_TRIGGER_STAGES_MAX  32
+
+struct capture_trigger_stage {
+	/* pins this stage depends on */
+	uint8_t care;
+	/* single edge only stage is searched with capture_scan_edge() */
+	int edge_only;
+	uint8_t edge_mask;
+	int edge_rising;
+	/* pulse width condition, pin -1 if none */
+	int pulse_pin;
+	uint64_t pulse_min;
+	uint64_t pulse_max;
+};
+
+struct capture_trigger {
+	int stage_count;
+	struct capture_trigger_stage stages[CAPTURE_TRIGGER_STAGES_MAX];
+	/* bit per stage, stage matches if bit is set in all three */
+	uint32_t t_prev[256];
+	uint32_t t_cur[256];
+	uint32_t t_diff[256];
+
+	/* state */
+	int stage;
+	int prev;
+	/* next sample must be checked, set when entering new stage */
+	int fresh;
+	/* sample index of last edge per pin, used by pulse conditions */
+	uint64_t edge_n[8];
+	uint32_t scan_idx[256];
+};
+
+/**
+ * Compile trigger from string.
+ *
+ * @param  trig           trigger context
+ * @param  spec           trigger specification, see above
+ * @param  sampling_speed samples per second, used for converting times
+ * @return                0 on success or -1 on errors
+ */
+int capture_trigger_compile(struct capture_trigger *trig, const char *spec, int sampling_speed);
+
+/**
+ * Reset trigger state to first stage.
+ *
+ * @param  trig       trigger context
+ */
+void capture_trigger_reset(struct capture_trigger *trig);
+
+/**
+ * Feed samples to trigger.
+ *
+ * @param  trig       trigger context
+ * @param  data       samples
+ * @param  size       number of samples
+ * @param  n          index of first sample in data, counted from start of capture
+ * @return            index of the sample trigger fired at or size if not triggered
+ */
+size_t capture_trigger_scan(struct capture_trigger *trig, const uint8_t *data, size_t size, uint64_t n);
+
+
+#endif /* __CAPTURE_TRIGGER_H__ */
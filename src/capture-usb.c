@@ -0,0 +1,348 @@
+/*
+ * ftdi-bitbang
+ *
+ * Sample reader for capture commands.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <libusb.h>
+#include "capture-usb.h"
+
+/* modem status bytes in start of each usb packet */
+#define STATUS_SIZE     2
+/* overrun error bit in line status, second status byte */
+#define STATUS_OE       0x02
+
+struct capture_usb_transfer {
+	struct capture_usb *cu;
+	struct libusb_transfer *transfer;
+	unsigned int seq;
+	/* 0 idle, 1 submitted, 2 completed but not yet passed to consumer */
+	int state;
+	size_t size;
+	double t_submit;
+};
+
+static void _transfer_cb(struct libusb_transfer *transfer);
+
+static double os_time(void)
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (double)tp.tv_sec + (double)tp.tv_nsec / 1e9;
+}
+
+/* pass buffer to consumer and update counters, empty buffers are not counted */
+static void _commit(struct capture_usb *cu, size_t size)
+{
+	double t = os_time();
+	ringbuffer_write_commit(cu->ring, size);
+	if (size < 1) {
+		return;
+	}
+	if (cu->buffers == 0) {
+		cu->t_first = t;
+		cu->samples_first = size;
+	}
+	cu->t_last = t;
+	cu->samples += size;
+	cu->buffers++;
+}
+
+static void os_sleep_ms(long ms)
+{
+	struct timespec tp = { ms / 1000, (ms % 1000) * 1000000 };
+	while (nanosleep(&tp, &tp) && errno == EINTR);
+}
+
+/* blocking reads, one ring slot at a time */
+static void *_read_sync(void *p)
+{
+	struct capture_usb *cu = p;
+	uint8_t *data = NULL;
+	size_t n = 0;
+	int c;
+	unsigned short status;
+
+	while (cu->exec) {
+		/* get next free buffer from queue, wait if consumer has fallen behind */
+		if (!data) {
+			data = ringbuffer_write_slot(cu->ring, 0);
+			if (!data) {
+				os_sleep_ms(1);
+				continue;
+			}
+			n = 0;
+		}
+		/* read data into buffer */
+		double t = os_time();
+		c = ftdi_read_data(cu->ftdi, data + n, cu->ring->slot_size - n);
+		ftdi_bitbang_stats_add(&cu->usb, FTDI_BITBANG_OP_READ, c > 0 ? c : 0, os_time() - t, c < 0);
+		if (c < 0) {
+			fprintf(stderr, "sample read failure: %s\n", ftdi_get_error_string(cu->ftdi));
+			cu->error = 1;
+			break;
+		}
+		n += c;
+		/* continue read if buffer not full */
+		if (n < cu->ring->slot_size) {
+			continue;
+		}
+		/* pass buffer to consumer */
+		_commit(cu, n);
+		data = NULL;
+		/* libftdi strips status bytes, poll line status separately */
+		t = os_time();
+		c = ftdi_poll_modem_status(cu->ftdi, &status);
+		ftdi_bitbang_stats_add(&cu->usb, FTDI_BITBANG_OP_MODEM_STATUS, 0, os_time() - t, c);
+		if (c == 0 && ((status >> 8) & STATUS_OE)) {
+			cu->overruns++;
+		}
+	}
+
+	return NULL;
+}
+
+/* submit idle transfers into free ring slots, in sequence order */
+static void _submit(struct capture_usb *cu)
+{
+	int i;
+	for (i = 0; i < cu->transfer_count; i++) {
+		struct capture_usb_transfer *t = &cu->transfers[i];
+		if (t->state != 0) {
+			continue;
+		}
+		uint8_t *data = ringbuffer_write_slot(cu->ring, cu->submit_seq - cu->commit_seq);
+		if (!data) {
+			/* consumer has fallen behind, try again later */
+			return;
+		}
+		libusb_fill_bulk_transfer(t->transfer, cu->ftdi->usb_dev, cu->ftdi->out_ep, data, cu->transfer_size, _transfer_cb, t, 0);
+		t->seq = cu->submit_seq;
+		t->t_submit = os_time();
+		if (libusb_submit_transfer(t->transfer)) {
+			fprintf(stderr, "failed to submit usb transfer\n");
+			cu->error = 1;
+			return;
+		}
+		t->state = 1;
+		cu->submit_seq++;
+	}
+}
+
+static void _transfer_cb(struct libusb_transfer *transfer)
+{
+	struct capture_usb_transfer *t = transfer->user_data;
+	struct capture_usb *cu = t->cu;
+	int i, found;
+
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+		t->state = 0;
+		return;
+	}
+	ftdi_bitbang_stats_add(&cu->usb, FTDI_BITBANG_OP_READ, transfer->actual_length, os_time() - t->t_submit,
+	                       transfer->status != LIBUSB_TRANSFER_COMPLETED);
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		fprintf(stderr, "usb transfer failed, status: %d\n", transfer->status);
+		t->state = 0;
+		cu->error = 1;
+		return;
+	}
+
+	/* strip status bytes from start of each packet, in place */
+	uint8_t *data = transfer->buffer;
+	size_t size = 0;
+	for (i = 0; i < transfer->actual_length; i += cu->ftdi->max_packet_size) {
+		int n = transfer->actual_length - i;
+		n = n > (int)cu->ftdi->max_packet_size ? (int)cu->ftdi->max_packet_size : n;
+		if (n >= STATUS_SIZE && (data[i + 1] & STATUS_OE)) {
+			cu->overruns++;
+		}
+		if (n > STATUS_SIZE) {
+			memmove(data + size, data + i + STATUS_SIZE, n - STATUS_SIZE);
+			size += n - STATUS_SIZE;
+		}
+	}
+	t->size = size;
+	t->state = 2;
+
+	/*
+	 * pass completed transfers to consumer in the order they were submitted,
+	 * status-only transfers too: later transfers already fill the ring slots after
+	 * theirs, so their slots can only be passed on as empty
+	 */
+	do {
+		found = 0;
+		for (i = 0; i < cu->transfer_count; i++) {
+			t = &cu->transfers[i];
+			if (t->state == 2 && t->seq == cu->commit_seq) {
+				_commit(cu, t->size);
+				cu->commit_seq++;
+				t->state = 0;
+				found = 1;
+			}
+		}
+	} while (found);
+
+	if (cu->exec) {
+		_submit(cu);
+	}
+}
+
+/* asynchronous reads, callbacks are run from this thread */
+static void *_read_async(void *p)
+{
+	struct capture_usb *cu = p;
+	int i, pending;
+
+	_submit(cu);
+	while (cu->exec && !cu->error) {
+		struct timeval tv = { 0, 10000 };
+		libusb_handle_events_timeout_completed(cu->ftdi->usb_ctx, &tv, NULL);
+		/* retry submitting if queue was full */
+		_submit(cu);
+	}
+
+	/* cancel and wait for all transfers to finish */
+	for (i = 0; i < cu->transfer_count; i++) {
+		if (cu->transfers[i].state == 1) {
+			libusb_cancel_transfer(cu->transfers[i].transfer);
+		}
+	}
+	do {
+		struct timeval tv = { 0, 100000 };
+		libusb_handle_events_timeout_completed(cu->ftdi->usb_ctx, &tv, NULL);
+		for (i = 0, pending = 0; i < cu->transfer_count; i++) {
+			pending += cu->transfers[i].state == 1 ? 1 : 0;
+		}
+	} while (pending > 0);
+
+	return NULL;
+}
+
+int capture_usb_start(struct capture_usb *cu, struct ftdi_context *ftdi, struct ringbuffer *ring, int transfer_count, int transfer_size)
+{
+	int i;
+
+	memset(cu, 0, sizeof(*cu));
+	if (transfer_count < 0 || transfer_size < 1) {
+		fprintf(stderr, "invalid usb transfer count or size\n");
+		return -1;
+	}
+	cu->ftdi = ftdi;
+	cu->ring = ring;
+	cu->transfer_count = transfer_count;
+	/* whole packets only */
+	cu->transfer_size = transfer_size - (transfer_size % (int)ftdi->max_packet_size);
+	cu->transfer_size = cu->transfer_size > 0 ? cu->transfer_size : (int)ftdi->max_packet_size;
+	/* both are positive here */
+	if (transfer_count > 0 && ((size_t)cu->transfer_size > ring->slot_size || (unsigned int)transfer_count >= ring->count)) {
+		fprintf(stderr, "capture queue too small for usb transfers\n");
+		return -1;
+	}
+
+	if (transfer_count > 0) {
+		cu->transfers = calloc(transfer_count, sizeof(*cu->transfers));
+		if (!cu->transfers) {
+			return -1;
+		}
+		for (i = 0; i < transfer_count; i++) {
+			cu->transfers[i].cu = cu;
+			cu->transfers[i].transfer = libusb_alloc_transfer(0);
+			if (!cu->transfers[i].transfer) {
+				capture_usb_stop(cu);
+				return -1;
+			}
+		}
+	}
+
+	cu->exec = 1;
+	if (pthread_create(&cu->thread, NULL, transfer_count > 0 ? _read_async : _read_sync, cu)) {
+		cu->exec = 0;
+		capture_usb_stop(cu);
+		return -1;
+	}
+
+	return 0;
+}
+
+void capture_usb_stop(struct capture_usb *cu)
+{
+	int i;
+	if (cu->exec) {
+		cu->exec = 0;
+		pthread_join(cu->thread, NULL);
+	}
+	if (cu->transfers) {
+		for (i = 0; i < cu->transfer_count; i++) {
+			if (cu->transfers[i].transfer) {
+				libusb_free_transfer(cu->transfers[i].transfer);
+			}
+		}
+		free(cu->transfers);
+		cu->transfers = NULL;
+	}
+}
+
+int capture_usb_baudrate(struct ftdi_context *ftdi, int baudrate)
+{
+	int clk = 48000000, clk_div = 16, divisor, baud;
+
+	/* libftdi multiplies baudrate by four in bitbang mode */
+	baudrate *= ftdi->bitbang_enabled ? 4 : 1;
+	if (baudrate < 1) {
+		return 0;
+	}
+	/* H series use 120 MHz clock divided by ten when possible */
+	if ((ftdi->type == TYPE_2232H || ftdi->type == TYPE_4232H || ftdi->type == TYPE_232H) && baudrate * 10 > 120000000 / 0x3fff) {
+		clk = 120000000;
+		clk_div = 10;
+	}
+	/* same divisor selection as in libftdi, divisors between 0 and 2 are not available */
+	if (baudrate >= clk / clk_div) {
+		baud = clk / clk_div;
+	} else if (baudrate >= clk / (clk_div + clk_div / 2)) {
+		baud = clk / (clk_div + clk_div / 2);
+	} else if (baudrate >= clk / (2 * clk_div)) {
+		baud = clk / (2 * clk_div);
+	} else {
+		/* three fractional bits and one bit for rounding */
+		divisor = (int)((int64_t)clk * 16 / clk_div / baudrate);
+		divisor = (divisor + 1) / 2;
+		divisor = divisor > 0x20000 ? 0x1ffff : divisor;
+		baud = (int)(((int64_t)clk * 16 / clk_div / divisor + 1) / 2);
+	}
+
+	return ftdi->bitbang_enabled ? baud / 4 : baud;
+}
+
+void capture_usb_stats(struct capture_usb *cu, double expected_rate, struct capture_usb_stats *stats)
+{
+	uint64_t received = cu->samples - cu->samples_first;
+	double expected;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->samples = cu->samples;
+	stats->buffers = cu->buffers;
+	stats->overruns = cu->overruns;
+	if (cu->buffers < 2) {
+		return;
+	}
+	/* first buffer only marks the start, it was filled before its timestamp */
+	stats->elapsed = cu->t_last - cu->t_first;
+	if (stats->elapsed > 0) {
+		stats->rate = (double)received / stats->elapsed;
+	}
+	/* buffer timestamps jitter up to one buffer, ignore differences smaller than that */
+	expected = expected_rate * stats->elapsed;
+	if (expected > (double)(received + cu->ring->slot_size)) {
+		stats->lost = (uint64_t)(expected - (double)received);
+	}
+}
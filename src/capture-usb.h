@@ -0,0 +1,107 @@
+/*
+ * ftdi-bitbang
+ *
+ * Sample reader for capture commands. Reads device continuously into
+ * ring buffer slots, either using blocking reads or several outstanding
+ * asynchronous bulk transfers.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __CAPTURE_USB_H__
+#define __CAPTURE_USB_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <libftdi1/ftdi.h>
+#include "ringbuffer.h"
+#include "ftdi-bitbang.h"
+
+struct capture_usb_transfer;
+
+struct capture_usb {
+	struct ftdi_context *ftdi;
+	struct ringbuffer *ring;
+	pthread_t thread;
+	volatile int exec;
+	/* set if reading failed */
+	volatile int error;
+
+	/* asynchronous transfers, zero count means blocking reads */
+	int transfer_count;
+	int transfer_size;
+	struct capture_usb_transfer *transfers;
+	/* sequence numbers of next transfer to submit and next to pass to consumer */
+	unsigned int submit_seq;
+	unsigned int commit_seq;
+
+	/* counters, updated by reader thread */
+	uint64_t samples;
+	uint64_t buffers;
+	/* usb packets that had overrun flag set in line status */
+	uint64_t overruns;
+	/* CLOCK_MONOTONIC time of first and latest buffer and samples in first buffer */
+	double t_first;
+	double t_last;
+	uint64_t samples_first;
+	/* usb operation counters, read latency of asynchronous transfers is from submit to completion */
+	struct ftdi_bitbang_stats usb;
+};
+
+struct capture_usb_stats {
+	uint64_t samples;
+	uint64_t buffers;
+	uint64_t overruns;
+	/* seconds between first and latest buffer */
+	double elapsed;
+	/* sample rate measured from buffer timestamps, zero if not enough data */
+	double rate;
+	/* estimate of samples lost compared to expected rate */
+	uint64_t lost;
+};
+
+/**
+ * Start reading samples into ring from another thread.
+ *
+ * With asynchronous transfers a slot may be committed with size zero when
+ * device had no samples to send, consumer must release such slots as any
+ * other. Empty slots are not included in buffer counts of statistics.
+ *
+ * @param  cu              reader context
+ * @param  ftdi            opened device already set to wanted mode
+ * @param  ring            initialized ring, slot size must be at least transfer size
+ *                         (or read chunk size when using blocking reads)
+ * @param  transfer_count  number of outstanding transfers, zero for blocking reads
+ * @param  transfer_size   size of one transfer, rounded to usb packet size
+ * @return                 0 on success or -1 on errors
+ */
+int capture_usb_start(struct capture_usb *cu, struct ftdi_context *ftdi, struct ringbuffer *ring, int transfer_count, int transfer_size);
+
+/**
+ * Stop reading and wait for reader to finish.
+ */
+void capture_usb_stop(struct capture_usb *cu);
+
+/**
+ * Get baud rate device really runs at when given rate is set with
+ * ftdi_set_baudrate(). Divisors are coarse at high rates, so this can
+ * differ a lot from requested rate. Bitbang mode must be set before.
+ *
+ * @param  ftdi           device context
+ * @param  baudrate       baud rate given to ftdi_set_baudrate()
+ * @return                actual baud rate or 0 if rate is invalid
+ */
+int capture_usb_baudrate(struct ftdi_context *ftdi, int baudrate);
+
+/**
+ * Get capture statistics. Call after stopping reader for exact values.
+ *
+ * @param  cu             reader context
+ * @param  expected_rate  sample rate device was programmed to, used for estimating lost samples
+ * @param  stats          statistics are written here
+ */
+void capture_usb_stats(struct capture_usb *cu, double expected_rate, struct capture_usb_stats *stats);
+
+
+#endif /* __CAPTURE_USB_H__ */
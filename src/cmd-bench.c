@@ -0,0 +1,382 @@
+/*
+ * ftdi-bitbang
+ *
+ * Benchmark core operations of bitbang context.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libftdi1/ftdi.h>
+#include "ftdi-bitbang.h"
+#include "ftdi-emu.h"
+#include "cmd-common.h"
+
+#define LATENCIES_MAX       32
+
+const char opts[] = COMMON_SHORT_OPTS "m:l:n:t:b:p:E";
+struct option longopts[] = {
+	COMMON_LONG_OPTS
+	{ "mode", required_argument, NULL, 'm' },
+	{ "latency", required_argument, NULL, 'l' },
+	{ "count", required_argument, NULL, 'n' },
+	{ "time", required_argument, NULL, 't' },
+	{ "batch", required_argument, NULL, 'b' },
+	{ "pin", required_argument, NULL, 'p' },
+	{ "emulate", no_argument, NULL, 'E' },
+	{ 0, 0, 0, 0 },
+};
+
+/* ftdi device context or emulated device */
+struct ftdi_context *ftdi = NULL;
+struct ftdi_emu *emu = NULL;
+struct ftdi_bitbang_context *device = NULL;
+int bitmode = BITMODE_MPSSE;
+int emulate = 0;
+
+/* latency timer settings to run benchmarks with */
+int latencies[LATENCIES_MAX] = { 1, 2, 4, 8, 16 };
+int latency_count = 5;
+/* each benchmark runs until count or time is reached */
+int count = 10000;
+double time_max = 1.0;
+/* pin changes in one sequence */
+int batch = 64;
+/* pin that is toggled */
+int pin = 0;
+
+/* latency of each operation of running benchmark */
+double *samples = NULL;
+
+struct benchmark {
+	const char *name;
+	int (*run)(void);
+	/* state is saved only for real devices */
+	int device_only;
+};
+
+static double os_time(void)
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (double)tp.tv_sec + (double)tp.tv_nsec / 1e9;
+}
+
+/**
+ * Free resources allocated by process, quit using libraries, terminate
+ * connections and so on. This function will use exit() to quit the process.
+ *
+ * @param return_code Value to be returned to parent process.
+ */
+void p_exit(int return_code)
+{
+	if (device) {
+		if (common_stats) {
+			struct ftdi_bitbang_stats stats;
+			ftdi_bitbang_stats_get(device, &stats);
+			common_stats_print(stderr, &stats);
+		}
+		if (!emu) {
+			ftdi_bitbang_save_state(device);
+		}
+		ftdi_bitbang_free(device);
+	}
+	if (emu) {
+		ftdi_emu_free(emu);
+	}
+	if (ftdi) {
+		ftdi_free(ftdi);
+	}
+	if (samples) {
+		free(samples);
+	}
+	common_free();
+	/* terminate program instantly */
+	exit(return_code);
+}
+
+void p_help()
+{
+	printf(
+	    "  -m, --mode=STRING          device bitmode, 'bitbang' or 'mpsse', default is 'mpsse'\n"
+	    "  -l, --latency=LIST         comma separated latency timer settings in ms, default 1,2,4,8,16\n"
+	    "  -n, --count=INT            maximum operations per benchmark, default 10000\n"
+	    "  -t, --time=FLOAT           maximum seconds per benchmark, default 1.0\n"
+	    "  -b, --batch=INT            pin changes in one sequence, default 64\n"
+	    "  -p, --pin=PIN              pin to toggle, default 0\n"
+	    "  -E, --emulate              use emulated device even if a real one is found\n"
+	    "\n"
+	    "Benchmark core operations of libftdi-bitbang: write-only pin toggles,\n"
+	    "toggle and read back round trips, 16-bit reads (8-bit in bitbang mode),\n"
+	    "sequences of pin changes written one by one and as one buffered write,\n"
+	    "and state save and load (real device only).\n"
+	    "Each benchmark is run with every latency timer setting.\n"
+	    "\n"
+	    "Uses real device if one is found, otherwise an emulated FT232H in realtime\n"
+	    "mode. Selected pin is toggled, make sure nothing connected to it minds.\n"
+	    "\n"
+	    "Results are printed to stdout as CSV, one line per benchmark and latency:\n"
+	    " benchmark,transport,mode,latency_ms,ops,seconds,ops_per_s,p50_us,p90_us,p99_us,max_us\n"
+	    "One operation of sequence benchmarks is one whole sequence.\n"
+	    "\n");
+}
+
+static int parse_latencies(char *list)
+{
+	char *p;
+	latency_count = 0;
+	for (p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+		int ms = atoi(p);
+		if (ms < 1 || ms > 255 || latency_count >= LATENCIES_MAX) {
+			return -1;
+		}
+		latencies[latency_count++] = ms;
+	}
+	return latency_count > 0 ? 0 : -1;
+}
+
+int p_options(int c, char *optarg)
+{
+	switch (c) {
+	case 'm':
+		if (strcmp("bitbang", optarg) == 0) {
+			bitmode = BITMODE_BITBANG;
+		} else if (strcmp("mpsse", optarg) == 0) {
+			bitmode = BITMODE_MPSSE;
+		} else {
+			fprintf(stderr, "invalid bitmode\n");
+			return -1;
+		}
+		return 1;
+	case 'l':
+		if (parse_latencies(optarg)) {
+			fprintf(stderr, "invalid latency timer list, values must be between 1 and 255 ms\n");
+			return -1;
+		}
+		return 1;
+	case 'n':
+		count = atoi(optarg);
+		if (count < 1) {
+			fprintf(stderr, "invalid count: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 't':
+		time_max = atof(optarg);
+		if (time_max <= 0) {
+			fprintf(stderr, "invalid time: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 'b':
+		batch = atoi(optarg);
+		if (batch < 1) {
+			fprintf(stderr, "invalid batch size: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 'p':
+		pin = atoi(optarg);
+		if (pin < 0 || pin > 15) {
+			fprintf(stderr, "invalid pin number: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 'E':
+		emulate = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int toggle(void)
+{
+	uint8_t value = pin < 8 ? device->state.l_value : device->state.h_value;
+	ftdi_bitbang_set_pin(device, pin, !(value & (1 << (pin & 7))));
+	return ftdi_bitbang_write(device);
+}
+
+static int bench_toggle(void)
+{
+	return toggle();
+}
+
+static int bench_roundtrip(void)
+{
+	if (toggle()) {
+		return -1;
+	}
+	return pin < 8 ? ftdi_bitbang_read_low(device) : ftdi_bitbang_read_high(device);
+}
+
+static int bench_read16(void)
+{
+	return ftdi_bitbang_read(device);
+}
+
+static int bench_sequence(void)
+{
+	for (int i = 0; i < batch; i++) {
+		if (toggle()) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_sequence_batched(void)
+{
+	if (ftdi_bitbang_buffer_start(device)) {
+		return -1;
+	}
+	for (int i = 0; i < batch; i++) {
+		if (toggle()) {
+			ftdi_bitbang_buffer_flush(device);
+			return -1;
+		}
+	}
+	return ftdi_bitbang_buffer_flush(device);
+}
+
+static int bench_state_save(void)
+{
+	return ftdi_bitbang_save_state(device);
+}
+
+static int bench_state_load(void)
+{
+	return ftdi_bitbang_load_state(device);
+}
+
+static const struct benchmark benchmarks[] = {
+	{ "toggle", bench_toggle, 0 },
+	{ "roundtrip", bench_roundtrip, 0 },
+	{ "read16", bench_read16, 0 },
+	{ "sequence", bench_sequence, 0 },
+	{ "sequence_batched", bench_sequence_batched, 0 },
+	{ "state_save", bench_state_save, 1 },
+	{ "state_load", bench_state_load, 1 },
+	{ NULL, NULL, 0 },
+};
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* nearest rank percentile from sorted samples */
+static double percentile(int n, double p)
+{
+	int i = (int)(p / 100.0 * (double)n + 0.999999) - 1;
+	i = i < 0 ? 0 : (i >= n ? n - 1 : i);
+	return samples[i];
+}
+
+static int run(const struct benchmark *b, int latency)
+{
+	double t_start, t_end;
+	int n;
+
+	/* first operation is not measured, it may include mode and direction changes */
+	if (b->run() < 0) {
+		return -1;
+	}
+
+	t_start = os_time();
+	t_end = t_start;
+	for (n = 0; n < count && (t_end - t_start) < time_max; n++) {
+		double t = t_end;
+		if (b->run() < 0) {
+			return -1;
+		}
+		t_end = os_time();
+		samples[n] = t_end - t;
+	}
+
+	qsort(samples, n, sizeof(*samples), compare_double);
+	printf("%s,%s,%s,%d,%d,%.6f,%.1f,%.2f,%.2f,%.2f,%.2f\n",
+	       b->name, emu ? "emulator" : "libftdi", bitmode == BITMODE_MPSSE ? "mpsse" : "bitbang",
+	       latency, n, t_end - t_start, (double)n / (t_end - t_start),
+	       percentile(n, 50.0) * 1e6, percentile(n, 90.0) * 1e6, percentile(n, 99.0) * 1e6,
+	       samples[n - 1] * 1e6);
+	fflush(stdout);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	/* parse command line options */
+	if (common_options(argc, argv, opts, longopts, 0, 1)) {
+		fprintf(stderr, "invalid command line option(s)\n");
+		p_exit(EXIT_FAILURE);
+	}
+	if (pin > 7 && bitmode != BITMODE_MPSSE) {
+		fprintf(stderr, "pins above 7 can only be used in mpsse mode\n");
+		p_exit(EXIT_FAILURE);
+	}
+	samples = malloc(sizeof(*samples) * count);
+	if (!samples) {
+		fprintf(stderr, "out of memory\n");
+		p_exit(EXIT_FAILURE);
+	}
+
+	/* use real device if there is one */
+	if (!emulate) {
+		ftdi = common_ftdi_init();
+	}
+	if (ftdi) {
+		device = ftdi_bitbang_init(ftdi, bitmode, 0);
+	} else {
+		struct ftdi_bitbang_transport transport;
+		if (!emulate) {
+			fprintf(stderr, "no usable device found, using emulated device\n");
+		}
+		emu = ftdi_emu_new(TYPE_232H);
+		if (!emu) {
+			fprintf(stderr, "unable to create emulated device\n");
+			p_exit(EXIT_FAILURE);
+		}
+		ftdi_emu_set_realtime(emu, 1);
+		ftdi_emu_transport(emu, &transport);
+		device = ftdi_bitbang_init_transport(&transport, bitmode, 0);
+	}
+	if (!device) {
+		fprintf(stderr, "ftdi_bitbang_init() failed\n");
+		p_exit(EXIT_FAILURE);
+	}
+	if (ftdi_bitbang_set_io(device, pin, 1) || ftdi_bitbang_write(device) < 0) {
+		fprintf(stderr, "unable to set pin %d as output\n", pin);
+		p_exit(EXIT_FAILURE);
+	}
+
+	printf("benchmark,transport,mode,latency_ms,ops,seconds,ops_per_s,p50_us,p90_us,p99_us,max_us\n");
+	for (i = 0; i < latency_count; i++) {
+		if (ftdi_bitbang_set_latency_timer(device, latencies[i])) {
+			fprintf(stderr, "unable to set latency timer to %d ms\n", latencies[i]);
+			p_exit(EXIT_FAILURE);
+		}
+		for (const struct benchmark *b = benchmarks; b->name; b++) {
+			if (b->device_only && emu) {
+				continue;
+			}
+			if (run(b, latencies[i])) {
+				fprintf(stderr, "benchmark %s failed with latency timer %d ms\n", b->name, latencies[i]);
+				p_exit(EXIT_FAILURE);
+			}
+		}
+	}
+	/* libftdi default */
+	ftdi_bitbang_set_latency_timer(device, 16);
+
+	p_exit(EXIT_SUCCESS);
+	return EXIT_SUCCESS;
+}
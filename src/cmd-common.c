@@ -36,6 +36,10 @@ const char *usb_id = NULL;
 int interface = INTERFACE_ANY;
 /* reset flag, reset usb device if this is set */
 int reset = 0;
+/* print usb statistics at exit */
+int common_stats = 0;
+/* usb trace file */
+char *common_trace_file = NULL;
 
 
 void common_help(int argc, char *argv[])
@@ -61,6 +65,7 @@ void common_help(int argc, char *argv[])
 	    "  -U, --usbid=ID             usbid to use for opening right device (sysfs format, e.g. 1-2.3), default none\n"
 	    "  -R, --reset                do usb reset on the device at start\n"
 	    "  -L, --list                 list devices that can be found with given parameters\n"
+	    "      --stats                print usb operation counts and latencies at exit\n"
 	    "\n"
 	    , basename(argv[0]));
 	p_help();
@@ -122,6 +127,13 @@ int common_options(int argc, char *argv[], const char opts[], struct option long
 		case 'L':
 			only_list = 2;
 			break;
+		case COMMON_OPT_STATS:
+			common_stats = 1;
+			break;
+		case COMMON_OPT_TRACE:
+			free(common_trace_file);
+			common_trace_file = strdup(optarg);
+			break;
 		default:
 		case '?':
 		case 'h':
@@ -319,6 +331,31 @@ struct ftdi_context *common_ftdi_init()
 	return ftdi;
 }
 
+void common_free(void)
+{
+	free(common_trace_file);
+	common_trace_file = NULL;
+}
+
+void common_stats_print(FILE *f, const struct ftdi_bitbang_stats *stats)
+{
+	fprintf(f, "%-14s %10s %8s %12s %10s %10s %10s %10s\n",
+	        "operation", "count", "errors", "bytes", "avg us", "p50 us", "p99 us", "max us");
+	for (int i = 0; i < FTDI_BITBANG_OP_COUNT; i++) {
+		const struct ftdi_bitbang_op_stats *op = &stats->ops[i];
+		if (op->count < 1) {
+			continue;
+		}
+		fprintf(f, "%-14s %10llu %8llu %12llu %10.1f %10.1f %10.1f %10.1f\n",
+		        ftdi_bitbang_stats_op_name(i),
+		        (unsigned long long)op->count, (unsigned long long)op->errors, (unsigned long long)op->bytes,
+		        op->time / (double)op->count * 1e6,
+		        ftdi_bitbang_stats_percentile(op, 50.0) * 1e6,
+		        ftdi_bitbang_stats_percentile(op, 99.0) * 1e6,
+		        op->time_max * 1e6);
+	}
+}
+
 unsigned char *common_stdin_read(void)
 {
 	static unsigned char data[65536];
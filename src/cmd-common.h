@@ -10,7 +10,13 @@
 #ifndef __CMD_COMMON_H__
 #define __CMD_COMMON_H__
 
+#include <stdio.h>
 #include <getopt.h>
+#include "ftdi-bitbang.h"
+
+/* long only options, outside of character range */
+#define COMMON_OPT_STATS    0x100
+#define COMMON_OPT_TRACE    0x101
 
 #define COMMON_SHORT_OPTS "hV:P:D:S:I:U:RL"
 #define COMMON_LONG_OPTS \
@@ -22,7 +28,19 @@
     { "interface", required_argument, NULL, 'I' }, \
     { "usbid", required_argument, NULL, 'U' }, \
     { "reset", no_argument, NULL, 'R' }, \
-    { "list", no_argument, NULL, 'L' },
+    { "list", no_argument, NULL, 'L' }, \
+    { "stats", no_argument, NULL, COMMON_OPT_STATS },
+
+/* options for commands that use bitbang context */
+#define COMMON_BITBANG_LONG_OPTS \
+    { "trace", required_argument, NULL, COMMON_OPT_TRACE },
+#define COMMON_BITBANG_HELP \
+    "      --trace=FILE           record all usb operations into binary trace file, see ftdi-replay\n"
+
+/* print usb statistics at exit if set */
+extern int common_stats;
+/* usb trace file if set */
+extern char *common_trace_file;
 
 
 /**
@@ -68,6 +86,19 @@ void common_ftdi_list_print(void);
  */
 struct ftdi_context *common_ftdi_init(void);
 
+/**
+ * Free resources allocated while parsing common options.
+ */
+void common_free(void);
+
+/**
+ * Print usb operation statistics as a table.
+ *
+ * @param f File to print to.
+ * @param stats Statistics to print.
+ */
+void common_stats_print(FILE *f, const struct ftdi_bitbang_stats *stats);
+
 /**
  * Read data from stdin until whitespace if it is a pipe or file ( | or < is used ).
  */
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <libusb-1.0/libusb.h>
 #include <libftdi1/ftdi.h>
 #include "ftdi-bitbang.h"
@@ -50,6 +51,24 @@ int set_serial_mode = 0;
 char *set_manufacturer = NULL;
 int set_bus_power = 0;
 
+/* eeprom operations are counted here for --stats */
+struct ftdi_bitbang_stats stats;
+
+static double _os_time()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (double)tp.tv_sec + (double)tp.tv_nsec / 1e9;
+}
+
+/* run eeprom operation and count it into statistics */
+#define EEPROM_OP(call) ({ \
+		double __t = _os_time(); \
+		int __err = call; \
+		ftdi_bitbang_stats_add(&stats, FTDI_BITBANG_OP_EEPROM, 0, _os_time() - __t, __err); \
+		__err; \
+	})
+
 /**
  * Free resources allocated by process, quit using libraries, terminate
  * connections and so on. This function will use exit() to quit the process.
@@ -67,9 +86,13 @@ void p_exit(int return_code)
 	if (set_manufacturer) {
 		free(set_manufacturer);
 	}
+	if (common_stats) {
+		common_stats_print(stderr, &stats);
+	}
 	if (ftdi) {
 		ftdi_free(ftdi);
 	}
+	common_free();
 	/* terminate program instantly */
 	exit(return_code);
 }
@@ -177,7 +200,7 @@ int main(int argc, char *argv[])
 		}
 	} else if (ee_rd) {
 		/* read eeprom */
-		if (ftdi_read_eeprom(ftdi)) {
+		if (EEPROM_OP(ftdi_read_eeprom(ftdi))) {
 			fprintf(stderr, "failed to read eeprom: %s\n", ftdi_get_error_string(ftdi));
 			p_exit(EXIT_FAILURE);
 		}
@@ -189,7 +212,7 @@ int main(int argc, char *argv[])
 
 	/* erase eeprom */
 	if (ee_erase) {
-		if (ftdi_erase_eeprom(ftdi)) {
+		if (EEPROM_OP(ftdi_erase_eeprom(ftdi))) {
 			fprintf(stderr, "failed to erase eeprom: %s\n", ftdi_get_error_string(ftdi));
 			p_exit(EXIT_FAILURE);
 		}
@@ -239,7 +262,7 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "failed to build eeprom: %s\n", ftdi_get_error_string(ftdi));
 			p_exit(EXIT_FAILURE);
 		}
-		if (ftdi_write_eeprom(ftdi)) {
+		if (EEPROM_OP(ftdi_write_eeprom(ftdi))) {
 			fprintf(stderr, "failed to write eeprom: %s\n", ftdi_get_error_string(ftdi));
 			p_exit(EXIT_FAILURE);
 		}
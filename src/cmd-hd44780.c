@@ -8,16 +8,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
 #include <libftdi1/ftdi.h>
 #include "ftdi-bitbang.h"
 #include "ftdi-hd44780.h"
 #include "cmd-common.h"
 
-const char opts[] = COMMON_SHORT_OPTS "m:i4:5:6:7:e:r:s:b:CMc:t:l:";
+const char opts[] = COMMON_SHORT_OPTS "m:i80:1:2:3:4:5:6:7:e:r:s:b:CMc:t:l:fF:w:n:";
 struct option longopts[] = {
 	COMMON_LONG_OPTS
+	COMMON_BITBANG_LONG_OPTS
 	{ "mode", required_argument, NULL, 'm' },
 	{ "init", no_argument, NULL, 'i' },
+	{ "8bit", no_argument, NULL, '8' },
+	{ "d0", required_argument, NULL, '0' },
+	{ "d1", required_argument, NULL, '1' },
+	{ "d2", required_argument, NULL, '2' },
+	{ "d3", required_argument, NULL, '3' },
 	{ "d4", required_argument, NULL, '4' },
 	{ "d5", required_argument, NULL, '5' },
 	{ "d6", required_argument, NULL, '6' },
@@ -31,22 +42,35 @@ struct option longopts[] = {
 	{ "cursor", required_argument, NULL, 'c' },
 	{ "text", required_argument, NULL, 't' },
 	{ "line", required_argument, NULL, 'l' },
+	{ "follow", no_argument, NULL, 'f' },
+	{ "rate", required_argument, NULL, 'F' },
+	{ "width", required_argument, NULL, 'w' },
+	{ "lines", required_argument, NULL, 'n' },
 	{ 0, 0, 0, 0 },
 };
 
 int init = 0;
+int bits = 4;
+int d0 = 8;
+int d1 = 9;
+int d2 = 10;
+int d3 = 11;
 int d4 = 0;
 int d5 = 1;
 int d6 = 2;
 int d7 = 3;
-int en = 4;
+/* one display per enable pin, others pins are shared */
+#define DISPLAYS_MAX            16
+int en[DISPLAYS_MAX] = { 4 };
+int en_count = 1;
 int rw = 5;
 int rs = 6;
 
 /* ftdi device context */
 struct ftdi_context *ftdi = NULL;
 struct ftdi_bitbang_context *device = NULL;
-struct ftdi_hd44780_context *hd44780 = NULL;
+struct ftdi_hd44780_context *hd44780[DISPLAYS_MAX];
+int hd44780_count = 0;
 int bitmode = 0;
 
 uint8_t *commands = NULL;
@@ -57,6 +81,17 @@ int cursor = -1;
 char *text = NULL;
 int line = -1;
 
+/* follow mode: keep device open and read line updates from stdin */
+#define FOLLOW_LINES_MAX        4
+#define FOLLOW_LINE_LEN_MAX     40
+int follow = 0;
+double follow_rate = 10.0;
+int display_width = 16;
+int display_lines = 2;
+/* what should be on the display and what is known to be on it, zero means unknown */
+char follow_wanted[DISPLAYS_MAX][FOLLOW_LINES_MAX][FOLLOW_LINE_LEN_MAX];
+char follow_shown[DISPLAYS_MAX][FOLLOW_LINES_MAX][FOLLOW_LINE_LEN_MAX];
+
 /**
  * Free resources allocated by process, quit using libraries, terminate
  * connections and so on. This function will use exit() to quit the process.
@@ -68,10 +103,18 @@ void p_exit(int return_code)
 	if (commands) {
 		free(commands);
 	}
-	if (hd44780) {
-		ftdi_hd44780_free(hd44780);
+	while (hd44780_count > 0) {
+		ftdi_hd44780_free(hd44780[--hd44780_count]);
 	}
 	if (device) {
+		if (common_stats) {
+			struct ftdi_bitbang_stats stats;
+			ftdi_bitbang_stats_get(device, &stats);
+			common_stats_print(stderr, &stats);
+		}
+		if (common_trace_file && ftdi_bitbang_trace_stop(device)) {
+			fprintf(stderr, "failed to write trace file: %s\n", common_trace_file);
+		}
 		ftdi_bitbang_save_state(device);
 		ftdi_bitbang_free(device);
 	}
@@ -81,6 +124,7 @@ void p_exit(int return_code)
 	if (text) {
 		free(text);
 	}
+	common_free();
 	/* terminate program instantly */
 	exit(return_code);
 }
@@ -88,14 +132,22 @@ void p_exit(int return_code)
 void p_help()
 {
 	printf(
+	    COMMON_BITBANG_HELP
 	    "  -m, --mode=STRING          set device bitmode, use 'bitbang' or 'mpsse', default is 'bitbang'\n"
 	    "                             for bitbang mode the baud rate is fixed to 1 MHz for now\n"
 	    "  -i, --init                 initialize hd44780 lcd, usually needed only once at first\n"
+	    "  -8, --8bit                 use 8-bit bus, d0-d3 default to high byte pins and need mpsse mode\n"
+	    "  -0, --d0=PIN               data pin 0, default pin is 8\n"
+	    "  -1, --d1=PIN               data pin 1, default pin is 9\n"
+	    "  -2, --d2=PIN               data pin 2, default pin is 10\n"
+	    "  -3, --d3=PIN               data pin 3, default pin is 11\n"
 	    "  -4, --d4=PIN               data pin 4, default pin is 0\n"
 	    "  -5, --d5=PIN               data pin 5, default pin is 1\n"
 	    "  -6, --d6=PIN               data pin 6, default pin is 2\n"
 	    "  -7, --d7=PIN               data pin 7, default pin is 3\n"
-	    "  -e, --en=PIN               enable pin, default pin is 4\n"
+	    "  -e, --en=PIN[,PIN...]      enable pin, default pin is 4\n"
+	    "                             give multiple pins to drive several displays sharing other pins,\n"
+	    "                             commands and text are then applied to all displays\n"
 	    "  -r, --rw=PIN               read/write pin, default pin is 5\n"
 	    "  -s, --rs=PIN               register select pin, default pin is 6\n"
 	    "  -b, --command=BYTE         send raw hd44780 command, decimal or hexadecimal (0x) byte\n"
@@ -105,14 +157,21 @@ void p_help()
 	    "  -c, --cursor=VALUE         cursor on/off and blink, accepts value between 0-3\n"
 	    "  -t, --text=STRING          write given text to display\n"
 	    "  -l, --line=VALUE           move cursor to given line, value between 0-3\n"
+	    "  -f, --follow               keep running and read display updates from stdin,\n"
+	    "                             each input line is LINE:TEXT, e.g. '1:temp 21.5',\n"
+	    "                             or DISPLAY:LINE:TEXT when multiple enable pins are given\n"
+	    "  -F, --rate=FLOAT           maximum display refresh rate in follow mode, default 10 Hz\n"
+	    "  -w, --width=VALUE          display line width used in follow mode, default 16, max 40\n"
+	    "  -n, --lines=VALUE          display line count used in follow mode, default 2, max 4\n"
 	    "\n"
-	    "Use HD44780 based LCD displays in 4-bit mode through FTDI FTx232 chips with this command.\n"
+	    "Use HD44780 based LCD displays in 4-bit or 8-bit mode through FTDI FTx232 chips with this command.\n"
 	    "\n");
 }
 
 
 int p_options(int c, char *optarg)
 {
+	char *token;
 	switch (c) {
 	case 'm':
 		if (strcmp("bitbang", optarg) == 0) {
@@ -127,6 +186,21 @@ int p_options(int c, char *optarg)
 	case 'i':
 		init = 1;
 		return 1;
+	case '8':
+		bits = 8;
+		return 1;
+	case '0':
+		d0 = atoi(optarg);
+		return 1;
+	case '1':
+		d1 = atoi(optarg);
+		return 1;
+	case '2':
+		d2 = atoi(optarg);
+		return 1;
+	case '3':
+		d3 = atoi(optarg);
+		return 1;
 	case '4':
 		d4 = atoi(optarg);
 		return 1;
@@ -140,7 +214,13 @@ int p_options(int c, char *optarg)
 		d7 = atoi(optarg);
 		return 1;
 	case 'e':
-		en = atoi(optarg);
+		for (en_count = 0, token = strsep(&optarg, ","); token; token = strsep(&optarg, ",")) {
+			if (en_count >= DISPLAYS_MAX) {
+				fprintf(stderr, "too many enable pins, maximum is %d\n", DISPLAYS_MAX);
+				return -1;
+			}
+			en[en_count++] = atoi(token);
+		}
 		return 1;
 	case 'r':
 		rw = atoi(optarg);
@@ -176,14 +256,188 @@ int p_options(int c, char *optarg)
 			p_exit(1);
 		}
 		return 1;
+	case 'f':
+		follow = 1;
+		return 1;
+	case 'F':
+		follow_rate = atof(optarg);
+		if (follow_rate <= 0) {
+			fprintf(stderr, "invalid refresh rate: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 'w':
+		display_width = atoi(optarg);
+		if (display_width < 1 || display_width > FOLLOW_LINE_LEN_MAX) {
+			fprintf(stderr, "invalid display width: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 'n':
+		display_lines = atoi(optarg);
+		if (display_lines < 1 || display_lines > FOLLOW_LINES_MAX) {
+			fprintf(stderr, "invalid display line count: %s\n", optarg);
+			return -1;
+		}
+		return 1;
 	}
 
 	return 0;
 }
 
+static long double os_time()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (long double)((long double)tp.tv_sec + (long double)tp.tv_nsec / 1e9);
+}
+
+static void os_sleep(long double t)
+{
+	struct timespec tp;
+	long double integral;
+	t += os_time();
+	tp.tv_nsec = (long)(modfl(t, &integral) * 1e9);
+	tp.tv_sec = (time_t)integral;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
+}
+
+/* parse one [DISPLAY:]LINE:TEXT input line into wanted display content */
+static int follow_parse(char *str)
+{
+	char *text;
+	int x;
+	long d = 0, y = strtol(str, &text, 10);
+	if (hd44780_count > 1 && text != str && *text == ':') {
+		d = y;
+		str = text + 1;
+		y = strtol(str, &text, 10);
+	}
+	if (text == str || *text != ':' || y < 0 || y >= display_lines || d < 0 || d >= hd44780_count) {
+		fprintf(stderr, "invalid follow input, expected %sLINE:TEXT: %s\n", hd44780_count > 1 ? "DISPLAY:" : "", str);
+		return -1;
+	}
+	text++;
+	/* pad with spaces so that old content gets cleared */
+	for (x = 0; x < display_width; x++) {
+		follow_wanted[d][y][x] = (*text && *text != '\r' && *text != '\n') ? *text++ : ' ';
+	}
+	return 0;
+}
+
+/* write next changed character on display, returns 1 if something was written */
+static int follow_apply_next(int d, int *pos, int *cur)
+{
+	for ( ; *pos < display_lines * display_width; (*pos)++) {
+		int x = *pos % display_width, y = *pos / display_width;
+		if (follow_wanted[d][y][x] == follow_shown[d][y][x]) {
+			continue;
+		}
+		/* cursor moves right after each write, so only jump when there is a gap */
+		if (*cur != *pos) {
+			ftdi_hd44780_goto_xy(hd44780[d], x, y);
+			*cur = *pos;
+			return 1;
+		}
+		ftdi_hd44780_write_char(hd44780[d], follow_wanted[d][y][x]);
+		follow_shown[d][y][x] = follow_wanted[d][y][x];
+		(*cur)++;
+		(*pos)++;
+		/* end of line, cursor does not wrap to next line */
+		*cur = (*cur % display_width) ? *cur : -1;
+		return 1;
+	}
+	return 0;
+}
+
+/* write only characters that differ from what is currently shown */
+static void follow_apply(void)
+{
+	int d, left, pos[DISPLAYS_MAX], cur[DISPLAYS_MAX];
+	for (d = 0; d < hd44780_count; d++) {
+		pos[d] = 0;
+		cur[d] = -1;
+	}
+	/* interleave displays in one write so that each one executes while others are written */
+	ftdi_bitbang_buffer_start(device);
+	for (left = 1; left; ) {
+		for (d = 0, left = 0; d < hd44780_count; d++) {
+			left += follow_apply_next(d, &pos[d], &cur[d]);
+		}
+	}
+	ftdi_bitbang_buffer_flush(device);
+}
+
+static void follow_run(void)
+{
+	char buf[4096];
+	size_t n = 0;
+	int dirty = 0, eof = 0, discard = 0;
+	long double next = 0;
+
+	memcpy(follow_wanted, follow_shown, sizeof(follow_wanted));
+	while (!eof || dirty) {
+		int timeout = -1;
+		long double now = os_time();
+		/* refresh is pending, wait only until it is allowed */
+		if (dirty) {
+			timeout = now >= next ? 0 : (int)ceill((next - now) * 1e3);
+		}
+		if (eof) {
+			os_sleep(next - now);
+		} else {
+			struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+			int err = poll(&pfd, 1, timeout);
+			if (err < 0 && errno != EINTR) {
+				fprintf(stderr, "stdin poll failed: %s\n", strerror(errno));
+				return;
+			} else if (err > 0) {
+				char *line, *end;
+				ssize_t c = read(STDIN_FILENO, buf + n, sizeof(buf) - n - 1);
+				if (c < 0 && errno == EINTR) {
+					continue;
+				} else if (c <= 0) {
+					/* handle last line even without newline */
+					eof = 1;
+					buf[n++] = '\n';
+				} else {
+					n += c;
+				}
+				/* feed full lines, rest of a cut line is dropped */
+				buf[n] = '\0';
+				for (line = buf; (end = strchr(line, '\n')); line = end + 1) {
+					*end = '\0';
+					if (discard) {
+						discard = 0;
+					} else if (*line && !follow_parse(line)) {
+						dirty = 1;
+					}
+				}
+				n -= line - buf;
+				memmove(buf, line, n);
+				buf[n] = '\0';
+				/* overlong line is cut, show what fits and discard input until next newline */
+				if (n >= sizeof(buf) - 1) {
+					if (!discard && !follow_parse(buf)) {
+						dirty = 1;
+					}
+					discard = 1;
+					n = 0;
+				}
+			}
+		}
+		/* coalesce all input received before next allowed refresh */
+		if (dirty && os_time() >= next) {
+			follow_apply();
+			dirty = 0;
+			next = os_time() + 1.0 / follow_rate;
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
-	int err = 0, i;
+	int err = 0, i, j;
 
 	/* parse command line options */
 	if (common_options(argc, argv, opts, longopts, 0, 0)) {
@@ -203,32 +457,67 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "ftdi_bitbang_init() failed\n");
 		p_exit(EXIT_FAILURE);
 	}
+	if (common_trace_file && ftdi_bitbang_trace_start(device, common_trace_file)) {
+		fprintf(stderr, "unable to create trace file: %s\n", common_trace_file);
+		p_exit(EXIT_FAILURE);
+	}
 
-	/* initialize hd44780 */
-	hd44780 = ftdi_hd44780_init(device, init, d4, d5, d6, d7, en, rw, rs);
-	if (!hd44780) {
-		fprintf(stderr, "ftdi_hd44780_init() failed\n");
-		return -1;
+	/* initialize hd44780 displays */
+	for (i = 0; i < en_count; i++) {
+		if (bits == 8) {
+			hd44780[i] = ftdi_hd44780_init_8bit(device, init, d0, d1, d2, d3, d4, d5, d6, d7, en[i], rw, rs);
+		} else {
+			hd44780[i] = ftdi_hd44780_init(device, init, d4, d5, d6, d7, en[i], rw, rs);
+		}
+		if (!hd44780[i]) {
+			fprintf(stderr, "ftdi_hd44780_init() failed\n");
+			p_exit(EXIT_FAILURE);
+		}
+		hd44780_count++;
 	}
 
-	/* run commands */
+	/* run commands, interleaved for all displays in one write */
+	ftdi_bitbang_buffer_start(device);
 	for (i = 0; i < commands_count; i++) {
-		ftdi_hd44780_cmd(hd44780, commands[i]);
+		for (j = 0; j < hd44780_count; j++) {
+			ftdi_hd44780_cmd(hd44780[j], commands[i]);
+		}
 	}
-	if (clear) {
-		ftdi_hd44780_cmd(hd44780, 0x01);
+	for (j = 0; j < hd44780_count; j++) {
+		if (clear) {
+			ftdi_hd44780_cmd(hd44780[j], 0x01);
+		}
 	}
-	if (home) {
-		ftdi_hd44780_cmd(hd44780, 0x02);
+	for (j = 0; j < hd44780_count; j++) {
+		if (home) {
+			ftdi_hd44780_cmd(hd44780[j], 0x02);
+		}
 	}
-	if (cursor >= 0) {
-		ftdi_hd44780_cmd(hd44780, 0x0c | cursor);
+	for (j = 0; j < hd44780_count; j++) {
+		if (cursor >= 0) {
+			ftdi_hd44780_cmd(hd44780[j], 0x0c | cursor);
+		}
 	}
-	if (line >= 0 && line <= 3) {
-		ftdi_hd44780_goto_xy(hd44780, 0, line);
+	for (j = 0; j < hd44780_count; j++) {
+		if (line >= 0 && line <= 3) {
+			ftdi_hd44780_goto_xy(hd44780[j], 0, line);
+		}
 	}
 	if (text) {
-		ftdi_hd44780_write_str(hd44780, text);
+		char *strs[DISPLAYS_MAX];
+		for (i = 0; i < hd44780_count; i++) {
+			strs[i] = text;
+		}
+		ftdi_hd44780_write_str_multi(hd44780, strs, hd44780_count);
+	}
+	ftdi_bitbang_buffer_flush(device);
+
+	/* stream updates from stdin until it is closed */
+	if (follow) {
+		if (clear || init) {
+			memset(follow_shown, ' ', sizeof(follow_shown));
+		}
+		follow_run();
 	}
 
 	p_exit(EXIT_SUCCESS);
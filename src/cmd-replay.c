@@ -0,0 +1,266 @@
+/*
+ * ftdi-bitbang
+ *
+ * Replay usb trace recorded with --trace against emulated device.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <libftdi1/ftdi.h>
+#include "ftdi-bitbang.h"
+#include "ftdi-trace.h"
+#include "ftdi-emu.h"
+#include "cmd-common.h"
+
+const char opts[] = "hn:v";
+struct option longopts[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "repeat", required_argument, NULL, 'n' },
+	{ "verbose", no_argument, NULL, 'v' },
+	{ 0, 0, 0, 0 },
+};
+
+/* trace, emulated device and library context it is replayed through */
+char *trace_file = NULL;
+struct ftdi_trace *trace = NULL;
+struct ftdi_emu *emu = NULL;
+struct ftdi_bitbang_context *device = NULL;
+/* data of reads */
+uint8_t *buf = NULL;
+size_t buf_size = 0;
+/* how many times trace is replayed */
+int repeat = 1;
+int verbose = 0;
+
+/* latencies recorded from device and host time spent replaying */
+struct ftdi_bitbang_stats recorded;
+struct ftdi_bitbang_stats replayed;
+/* reads that returned less data than recorded and output pins that read differently */
+uint64_t short_reads = 0;
+uint64_t pin_mismatches = 0;
+
+static double os_time(void)
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (double)tp.tv_sec + (double)tp.tv_nsec / 1e9;
+}
+
+/**
+ * Free resources allocated by process, quit using libraries, terminate
+ * connections and so on. This function will use exit() to quit the process.
+ *
+ * @param return_code Value to be returned to parent process.
+ */
+void p_exit(int return_code)
+{
+	if (trace) {
+		ftdi_trace_close(trace);
+	}
+	if (device) {
+		ftdi_bitbang_free(device);
+	}
+	if (emu) {
+		ftdi_emu_free(emu);
+	}
+	if (trace_file) {
+		free(trace_file);
+	}
+	if (buf) {
+		free(buf);
+	}
+	/* terminate program instantly */
+	exit(return_code);
+}
+
+void p_help()
+{
+	printf(
+	    "  -n, --repeat=INT           replay trace this many times, default 1\n"
+	    "  -v, --verbose              print each read that differs from recording\n"
+	    "\n"
+	    "Replay usb trace recorded with --trace option of other commands against\n"
+	    "an emulated device as fast as possible. Latencies recorded from the device\n"
+	    "and time spent by the host replaying each operation are reported separately.\n"
+	    "\n");
+}
+
+int p_options(int c, char *optarg)
+{
+	switch (c) {
+	case 'n':
+		repeat = atoi(optarg);
+		if (repeat < 1) {
+			fprintf(stderr, "invalid repeat count: %s\n", optarg);
+			p_exit(1);
+		}
+		return 1;
+	case 'v':
+		verbose = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void usage(char *argv[])
+{
+	printf(
+	    "\n"
+	    "Usage:\n"
+	    " %s [options] TRACE\n"
+	    "\n"
+	    "Options:\n"
+	    "  -h, --help                 display this help and exit\n"
+	    , basename(argv[0]));
+	p_help();
+}
+
+/* run one recorded operation through library on emulated device and compare results */
+static int replay(struct ftdi_trace_record *record)
+{
+	uint8_t *data = record->data;
+	int n;
+
+	if (record->size > buf_size) {
+		uint8_t *p = realloc(buf, record->size);
+		if (!p) {
+			return -1;
+		}
+		buf = p;
+		buf_size = record->size;
+	}
+	n = ftdi_bitbang_trace_replay(device, record, buf);
+	if (n < 0 || record->error) {
+		return n < 0 ? -1 : 0;
+	}
+
+	if (record->op == FTDI_BITBANG_OP_READ && n < (int)record->size) {
+		short_reads++;
+		if (verbose) {
+			fprintf(stderr, "%.6f: read %d bytes, recorded %zu\n", record->t, n, record->size);
+		}
+	} else if (record->op == FTDI_BITBANG_OP_READ_PINS) {
+		/* only outputs are known, inputs were driven by whatever was connected */
+		if ((buf[0] ^ data[0]) & emu->l_io) {
+			pin_mismatches++;
+			if (verbose) {
+				fprintf(stderr, "%.6f: output pins read 0x%02x, recorded 0x%02x\n", record->t, buf[0] & emu->l_io, data[0] & emu->l_io);
+			}
+		}
+		/* follow recorded inputs */
+		ftdi_emu_set_input(emu, 0x00ff, data[0]);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ftdi_trace_header header;
+	struct ftdi_trace_record record;
+	double t_total = 0, t_recorded = 0, t_emulated = 0, t_emu_start;
+	uint64_t records = 0;
+	int longindex = 0, c, err, pass;
+
+	while ((c = getopt_long(argc, argv, opts, longopts, &longindex)) > -1) {
+		if (p_options(c, optarg) < 1) {
+			usage(argv);
+			p_exit(c == 'h' ? 0 : 1);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv);
+		p_exit(1);
+	}
+	trace_file = strdup(argv[optind]);
+
+	trace = ftdi_trace_open(trace_file, &header);
+	if (!trace) {
+		fprintf(stderr, "unable to open trace file: %s\n", trace_file);
+		p_exit(EXIT_FAILURE);
+	}
+
+	for (pass = 0; pass < repeat; pass++) {
+		struct ftdi_bitbang_transport transport;
+
+		/* device starts from state recorded into trace header */
+		if (device) {
+			ftdi_bitbang_free(device);
+			device = NULL;
+		}
+		if (emu) {
+			ftdi_emu_free(emu);
+		}
+		emu = ftdi_emu_new(header.type);
+		if (emu) {
+			ftdi_emu_transport(emu, &transport);
+			device = ftdi_bitbang_init_transport(&transport, header.mode, 0);
+		}
+		if (!device) {
+			fprintf(stderr, "unable to emulate device type %d in mode 0x%02x\n", header.type, header.mode);
+			p_exit(EXIT_FAILURE);
+		}
+		/* write all pins, also the ones that are zero */
+		device->state.l_value = header.l_value;
+		device->state.l_io = header.l_io;
+		device->state.h_value = header.h_value;
+		device->state.h_io = header.h_io;
+		device->state.l_changed = 0xff;
+		device->state.h_changed = header.mode == BITMODE_MPSSE ? 0xff : 0x00;
+		if (ftdi_bitbang_write(device) < 0) {
+			fprintf(stderr, "unable to set initial state of emulated device\n");
+			p_exit(EXIT_FAILURE);
+		}
+		t_emu_start = ftdi_emu_time(emu);
+		if (ftdi_trace_rewind(trace)) {
+			fprintf(stderr, "unable to rewind trace\n");
+			p_exit(EXIT_FAILURE);
+		}
+
+		double t_start = os_time();
+		while ((err = ftdi_trace_next(trace, &record)) > 0) {
+			double t = os_time();
+			if (replay(&record)) {
+				fprintf(stderr, "%.6f: replaying %s failed\n", record.t, ftdi_bitbang_stats_op_name(record.op));
+				p_exit(EXIT_FAILURE);
+			}
+			ftdi_bitbang_stats_add(&replayed, record.op, record.error ? 0 : record.size, os_time() - t, record.error);
+			if (pass == 0) {
+				ftdi_bitbang_stats_add(&recorded, record.op, record.error ? 0 : record.size, record.duration, record.error);
+				t_recorded = record.t + record.duration;
+			}
+			records++;
+		}
+		t_total += os_time() - t_start;
+		t_emulated += ftdi_emu_time(emu) - t_emu_start;
+		if (err < 0) {
+			fprintf(stderr, "trace file is corrupted after %llu records\n", (unsigned long long)trace->records);
+			p_exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("trace %s: %s mode, %llu records over %.6f seconds\n", trace_file,
+	       header.mode == BITMODE_MPSSE ? "mpsse" : "bitbang", (unsigned long long)(records / repeat), t_recorded);
+	printf("\nrecorded device latency:\n");
+	common_stats_print(stdout, &recorded);
+	printf("\nreplay host overhead:\n");
+	common_stats_print(stdout, &replayed);
+	printf("\nreplayed %llu records in %.6f seconds, %.0f records/s", (unsigned long long)records, t_total,
+	       t_total > 0 ? (double)records / t_total : 0.0);
+	if (t_total > 0 && t_recorded > 0) {
+		printf(", %.1f times recorded speed", t_recorded * repeat / t_total);
+	}
+	printf("\nemulated device timing %.6f seconds per pass\n", t_emulated / repeat);
+	printf("short reads %llu, output pin mismatches %llu, bad mpsse commands %llu\n",
+	       (unsigned long long)short_reads, (unsigned long long)pin_mismatches, (unsigned long long)emu->bad_commands);
+
+	p_exit(short_reads > 0 || pin_mismatches > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	return EXIT_SUCCESS;
+}
@@ -11,52 +11,98 @@
 #include <math.h>
 #include <time.h>
 #include <errno.h>
-#include <pthread.h>
 #include <libftdi1/ftdi.h>
 #include <signal.h>
 #include "cmd-common.h"
-#include "linkedlist.h"
+#include "ringbuffer.h"
+#include "capture-usb.h"
+#include "capture-output.h"
+#include "capture-trigger.h"
+#include "capture-decode.h"
 
-const char opts[] = COMMON_SHORT_OPTS "p:t:s:l:";
+/* highest sync fifo strobe rate usb 2.0 can carry continuously */
+#define SYNCFF_SPEED_MAX    40000000
+
+const char opts[] = COMMON_SHORT_OPTS "p:t:s:l:b:q:T:B:o:f:d:m:";
 struct option longopts[] = {
 	COMMON_LONG_OPTS
 	{ "pins", required_argument, NULL, 'p' },
 	{ "trigger", required_argument, NULL, 't' },
 	{ "speed", required_argument, NULL, 's' },
 	{ "time", required_argument, NULL, 'l' },
+	{ "pretrigger", required_argument, NULL, 'b' },
+	{ "queue", required_argument, NULL, 'q' },
+	{ "transfers", required_argument, NULL, 'T' },
+	{ "transfer-size", required_argument, NULL, 'B' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "format", required_argument, NULL, 'f' },
+	{ "decode", required_argument, NULL, 'd' },
+	{ "mode", required_argument, NULL, 'm' },
 	{ 0, 0, 0, 0 },
 };
 
 /* which pins state to read */
 uint8_t pins_mask = 0xff;
 
-/* trigger type: -1 is no trigger, 0 is falling edge, 1 is rising edge */
-int trigger_type = -1;
+/* trigger specification, NULL if no trigger, and compiled trigger */
+char *trigger_spec = NULL;
+struct capture_trigger trigger;
 
-/* trigger mask */
-uint8_t trigger_mask = 0;
+/* capture mode: asynchronous bitbang or 245 synchronous fifo */
+enum {
+	CAPTURE_MODE_BITBANG = 0,
+	CAPTURE_MODE_SYNCFF,
+};
+int capture_mode = CAPTURE_MODE_BITBANG;
 
-/* sampling speed */
+/* sampling speed, in sync fifo mode only used for timestamps */
 int sampling_speed = 1e6;
+/* rate device really samples at, differs from above when baud rate divisor is coarse */
+double device_speed = 0;
 
 /* sampling time */
 double sampling_time = 1.0;
 
+/* capture queue size in kilobytes */
+int queue_size = 16384;
+
+/* outstanding usb transfers and their size, zero transfers uses blocking reads */
+int transfer_count = 8;
+int transfer_size = 65536;
+
+/* which of the above were given, sync fifo mode has its own defaults */
+int sampling_speed_set = 0;
+int queue_size_set = 0;
+int transfer_count_set = 0;
+int transfer_size_set = 0;
+
 /* ftdi device context */
 struct ftdi_context *ftdi = NULL;
 
 unsigned int ftdi_chunksize;
 
-struct sample {
-	uint8_t *data;
-	struct sample *prev;
-	struct sample *next;
-};
-struct sample *sample_first = NULL;
-struct sample *sample_last = NULL;
-pthread_t sample_thread;
-pthread_mutex_t sample_lock;
-volatile int sample_exec = 0;
+/* sample buffers from reader thread to main thread */
+struct ringbuffer sample_ring;
+struct capture_usb sample_reader;
+
+/* pre-trigger time and circular history buffer sized exactly to it */
+double pretrigger_time = 0.0;
+uint8_t *history = NULL;
+size_t history_size = 0;
+size_t history_pos = 0;
+size_t history_fill = 0;
+
+/* output file and format */
+char *output_file = NULL;
+int output_format = CAPTURE_OUTPUT_CSV;
+struct capture_output output;
+/* samples written to output so far */
+uint64_t output_n = 0;
+
+/* protocol decoders, decoded frames are written instead of samples when set */
+char *decode_specs[CAPTURE_DECODERS_MAX];
+int decode_spec_count = 0;
+struct capture_decode decode;
 
 /**
  * Free resources allocated by process, quit using libraries, terminate
@@ -66,24 +112,51 @@ volatile int sample_exec = 0;
  */
 void p_exit(int return_code)
 {
-	struct sample *sample;
-
-	if (sample_exec) {
-		sample_exec = 0;
-		pthread_join(sample_thread, NULL);
+	capture_usb_stop(&sample_reader);
+	capture_decode_stop(&decode);
+	capture_output_close(&output, output_n);
+	while (decode_spec_count > 0) {
+		free(decode_specs[--decode_spec_count]);
+	}
+	if (sample_reader.buffers > 0) {
+		struct capture_usb_stats stats;
+		capture_usb_stats(&sample_reader, device_speed, &stats);
+		fprintf(stderr, "read %llu samples in %llu buffers, %llu samples written\n",
+		        (unsigned long long)stats.samples, (unsigned long long)stats.buffers, (unsigned long long)output_n);
+		fprintf(stderr, "measured rate %.0f S/s (device %.0f S/s, requested %d S/s) over %.3f seconds\n",
+		        stats.rate, device_speed, sampling_speed, stats.elapsed);
+		if (stats.overruns > 0 || stats.lost > 0) {
+			fprintf(stderr, "WARNING: device overrun flagged in %llu usb packets, about %llu samples lost\n",
+			        (unsigned long long)stats.overruns, (unsigned long long)stats.lost);
+		}
+		if (capture_mode == CAPTURE_MODE_SYNCFF && stats.lost > 0) {
+			fprintf(stderr, "WARNING: strobes were dropped while device fifo was full, timestamps after first gap are shifted\n");
+		}
+	}
+	if (common_stats) {
+		common_stats_print(stderr, &sample_reader.usb);
+	}
+	if (output_file) {
+		free(output_file);
+	}
+	if (history) {
+		free(history);
+	}
+	if (trigger_spec) {
+		free(trigger_spec);
 	}
-	pthread_mutex_destroy(&sample_lock);
 	if (ftdi) {
 		ftdi_free(ftdi);
 	}
 
-	LL_GET(sample_first, sample_last, sample);
-	while (sample) {
-		free(sample->data);
-		free(sample);
-		LL_GET(sample_first, sample_last, sample);
+	if (sample_ring.data) {
+		fprintf(stderr, "queue: %u buffers of %zu bytes, high watermark %u, low watermark %d, full %u times\n",
+		        sample_ring.count, sample_ring.slot_size,
+		        sample_ring.high_watermark, sample_ring.low_watermark, sample_ring.full_count);
+		ringbuffer_free(&sample_ring);
 	}
 
+	common_free();
 	/* terminate program instantly */
 	exit(return_code);
 }
@@ -92,20 +165,53 @@ void p_help()
 {
 	printf(
 	    "  -p, --pins=PINS[0-7]       pins to capture, default is '0,1,2,3,4,5,6,7'\n"
-	    "  -t, --trigger=PIN[0-7]:EDGE\n"
-	    "                             trigger from pin on rising or falling edge (EDGE = r or f),\n"
-	    "                             if trigger is not set, sampling will start immediately\n"
-	    "  -s, --speed=INT            sampling speed, default 1000000 (1 MS/s)\n"
+	    "  -t, --trigger=STAGE[,STAGE...]\n"
+	    "                             trigger condition, stages must match in given order,\n"
+	    "                             if trigger is not set, sampling will start immediately,\n"
+	    "                             stage is one or more conditions joined with '+':\n"
+	    "                             PIN:r, PIN:f, PIN:e  rising, falling or either edge\n"
+	    "                             PIN:1, PIN:0         pin is high or low\n"
+	    "                             PIN:h>TIME, PIN:h<TIME, PIN:l>TIME, PIN:l<TIME\n"
+	    "                                                  high or low pulse longer or shorter than TIME\n"
+	    "                                                  (seconds, suffix ms, us and ns allowed)\n"
+	    "                             example: '3:l>50us,0:f+1:0'\n"
+	    "  -m, --mode=MODE            capture mode, default is bitbang:\n"
+	    "                             bitbang: asynchronous bitbang, sample rate set by --speed\n"
+	    "                             syncff: 245 synchronous fifo (FT2232H and FT232H only),\n"
+	    "                             one sample is taken on each 60 MHz CLKOUT rising edge while\n"
+	    "                             WR# is low, so sampling is clocked by WR#, EEPROM must\n"
+	    "                             set channel to 245 fifo mode\n"
+	    "  -s, --speed=INT            sampling speed, default 1000000 (1 MS/s),\n"
+	    "                             in syncff mode this is the WR# strobe rate used for\n"
+	    "                             timestamps, required, at most 40000000\n"
 	    "  -l, --time=FLOAT           sample for this many seconds, default 1 second\n"
+	    "  -b, --pretrigger=FLOAT     also output this many seconds before trigger, default 0\n"
+	    "  -q, --queue=INT            capture queue size in kilobytes, default 16384 (262144 in syncff),\n"
+	    "                             samples are lost if output falls this much behind\n"
+	    "  -T, --transfers=INT        number of outstanding usb transfers, default 8 (32 in syncff),\n"
+	    "                             use 0 for blocking reads (reliable only up to about 1 MS/s)\n"
+	    "  -B, --transfer-size=INT    size of one usb transfer in bytes, default 65536 (262144 in syncff)\n"
+	    "  -o, --output=FILE          write output to file instead of stdout\n"
+	    "  -f, --format=FORMAT        output format, default is csv:\n"
+	    "                             csv: 'time,value' per transition, value is 1 if any captured pin is high\n"
+	    "                             vcd: value change dump, one signal per captured pin\n"
+	    "                             bin: binary transition log (LEB128 sample delta and pin values)\n"
+	    "                             raw: raw samples, one byte per sample\n"
+	    "                             ftc: indexed capture file for seeking, compressed blocks and block index\n"
+	    "  -d, --decode=DECODER       decode protocol from captured pins and output decoded frames\n"
+	    "                             as 'time,decoder,bytes,errors' instead of samples,\n"
+	    "                             can be given multiple times, DECODER is one of:\n"
+	    "                             uart:RX[:BAUD[:CONFIG]]      default 115200 and 8N1\n"
+	    "                             spi:SCK,MOSI,MISO,CS[:MODE]  mode 0-3, default 0\n"
+	    "                             i2c:SCL,SDA\n"
 	    "\n"
 	    "Simple capture command for FTDI FTx232 chips.\n"
-	    "Uses bitbang mode so only ADBUS (pins 0-7) can be sampled.\n"
+	    "Uses bitbang or sync fifo mode so only ADBUS (pins 0-7) can be sampled.\n"
 	    "\n");
 }
 
 int p_options(int c, char *optarg)
 {
-	int i;
 	char *token;
 	switch (c) {
 	case 'p':
@@ -121,22 +227,10 @@ int p_options(int c, char *optarg)
 		}
 		return 1;
 	case 't':
-		token = strsep(&optarg, ":");
-		if (!optarg) {
-			fprintf(stderr, "invalid trigger format\n");
-			return -1;
-		}
-		i = atoi(token);
-		if (i < 0 || i > 7) {
-			fprintf(stderr, "invalid trigger pid: %d\n", i);
-			return -1;
+		if (trigger_spec) {
+			free(trigger_spec);
 		}
-		if (*optarg != 'r' && *optarg != 'f') {
-			fprintf(stderr, "invalid trigger edge type: %s\n", optarg);
-			return -1;
-		}
-		trigger_type = *optarg == 'r' ? 1 : 0;
-		trigger_mask = (1 << i);
+		trigger_spec = strdup(optarg);
 		return 1;
 	case 's':
 		sampling_speed = (int)atof(optarg);
@@ -144,9 +238,7 @@ int p_options(int c, char *optarg)
 			fprintf(stderr, "invalid sampling speed: %d\n", sampling_speed);
 			return -1;
 		}
-		if (sampling_speed > 1e6) {
-			fprintf(stderr, "NOTE: sampling speeds over 1 MS/s have been tested as unreliable\n");
-		}
+		sampling_speed_set = 1;
 		return 1;
 	case 'l':
 		sampling_time = atof(optarg);
@@ -155,6 +247,67 @@ int p_options(int c, char *optarg)
 			return -1;
 		}
 		return 1;
+	case 'b':
+		pretrigger_time = atof(optarg);
+		if (pretrigger_time < 0) {
+			fprintf(stderr, "invalid pre-trigger time: %f\n", pretrigger_time);
+			return -1;
+		}
+		return 1;
+	case 'T':
+		transfer_count = atoi(optarg);
+		if (transfer_count < 0) {
+			fprintf(stderr, "invalid transfer count: %s\n", optarg);
+			return -1;
+		}
+		transfer_count_set = 1;
+		return 1;
+	case 'B':
+		transfer_size = atoi(optarg);
+		if (transfer_size <= 0) {
+			fprintf(stderr, "invalid transfer size: %s\n", optarg);
+			return -1;
+		}
+		transfer_size_set = 1;
+		return 1;
+	case 'o':
+		if (output_file) {
+			free(output_file);
+		}
+		output_file = strdup(optarg);
+		return 1;
+	case 'f':
+		output_format = capture_output_format(optarg);
+		if (output_format < 0) {
+			fprintf(stderr, "invalid output format: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 'd':
+		if (decode_spec_count >= CAPTURE_DECODERS_MAX) {
+			fprintf(stderr, "too many decoders, maximum is %d\n", CAPTURE_DECODERS_MAX);
+			return -1;
+		}
+		decode_specs[decode_spec_count++] = strdup(optarg);
+		return 1;
+	case 'q':
+		queue_size = atoi(optarg);
+		if (queue_size <= 0) {
+			fprintf(stderr, "invalid queue size: %s\n", optarg);
+			return -1;
+		}
+		queue_size_set = 1;
+		return 1;
+	case 'm':
+		if (strcmp(optarg, "bitbang") == 0) {
+			capture_mode = CAPTURE_MODE_BITBANG;
+		} else if (strcmp(optarg, "syncff") == 0) {
+			capture_mode = CAPTURE_MODE_SYNCFF;
+		} else {
+			fprintf(stderr, "invalid capture mode: %s\n", optarg);
+			return -1;
+		}
+		return 1;
 	}
 
 	return 0;
@@ -177,51 +330,118 @@ static void os_sleep(long double t)
 	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
 }
 
-static void *sample_do(void *p)
+/* wait for next buffer from reader, exits on read errors */
+static uint8_t *sample_wait(size_t *size)
 {
-	struct sample *sample = NULL;
-	int n, c;
-
-	/* capture data continuosly until told to stop */
-	sample_exec = 1;
-	while (sample_exec) {
-		/* allocate new sample buffer */
-		if (!sample) {
-			sample = (struct sample *)malloc(sizeof(*sample));
-			sample->data = (uint8_t *)malloc(ftdi_chunksize);
-			n = 0;
-		}
-		/* read data into buffer */
-		c = ftdi_read_data(ftdi, sample->data + n, ftdi_chunksize - n);
-		if (c > 0) {
-			n += c;
-		} else if (c < 0) {
-			fprintf(stderr, "sample read failure: %s\n", ftdi_get_error_string(ftdi));
+	uint8_t *data = ringbuffer_read_slot(&sample_ring, size);
+	if (!data) {
+		if (sample_reader.error) {
 			p_exit(EXIT_FAILURE);
 		}
-		/* continue read if buffer not full */
-		if (n < ftdi_chunksize) {
-			continue;
-		}
-		/* append sample into queue */
-		pthread_mutex_lock(&sample_lock);
-		LL_APP(sample_first, sample_last, sample);
-		pthread_mutex_unlock(&sample_lock);
-		sample = NULL;
+		os_sleep(0.01);
 	}
+	/* in sync fifo mode timestamps come from sample count, after a gap all of them would be wrong */
+	if (capture_mode == CAPTURE_MODE_SYNCFF && sample_reader.overruns > 0) {
+		fprintf(stderr, "device fifo overrun, samples were dropped, stopping capture\n");
+		p_exit(EXIT_FAILURE);
+	}
+	return data;
+}
 
-	return NULL;
+/* store samples into pre-trigger history, only newest samples are kept */
+static void history_push(const uint8_t *data, size_t size)
+{
+	size_t c;
+	if (history_size < 1) {
+		return;
+	}
+	if (size > history_size) {
+		data += size - history_size;
+		size = history_size;
+	}
+	c = history_size - history_pos;
+	c = c < size ? c : size;
+	memcpy(history + history_pos, data, c);
+	memcpy(history, data + c, size - c);
+	history_pos = (history_pos + size) % history_size;
+	history_fill = history_fill + size < history_size ? history_fill + size : history_size;
 }
 
-static char *get_sampled_pins_str(uint8_t value)
+/* pass samples to decoders or output */
+static int samples_output(const uint8_t *data, size_t size)
 {
-	static char str[128];
-	if (value & pins_mask) {
-		strcpy(str, "1");
+	int err;
+	if (decode.count > 0) {
+		err = capture_decode_samples(&decode, data, size);
 	} else {
-		strcpy(str, "0");
+		err = capture_output_samples(&output, output_n, data, size);
 	}
-	return str;
+	output_n += size;
+	return err;
+}
+
+/* write pre-trigger history to output, oldest sample first */
+static int history_output(void)
+{
+	size_t start = history_fill < history_size ? 0 : history_pos;
+	size_t c = history_size - start;
+	c = c < history_fill ? c : history_fill;
+	if (c > 0 && samples_output(history + start, c)) {
+		return -1;
+	}
+	if (history_fill > c && samples_output(history, history_fill - c)) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Setup 245 synchronous fifo mode. Chip clocks data from ADBUS into its
+ * transmit fifo on CLKOUT (60 MHz) rising edge when WR# is low, so WR#
+ * works as sample strobe driven by external logic. Usb can not carry the
+ * full 60 MHz, so strobe rate must be given and be below what usb can
+ * take. Writes while the fifo is full (TXE# high) are dropped by the chip.
+ * Data rate can be tens of MB/s, so use more and larger asynchronous
+ * transfers and deeper queue by default.
+ */
+static int syncff_init(void)
+{
+	if (ftdi->type != TYPE_2232H && ftdi->type != TYPE_232H) {
+		fprintf(stderr, "sync fifo mode needs FT2232H or FT232H\n");
+		return -1;
+	}
+	if (ftdi_set_bitmode(ftdi, 0x00, BITMODE_SYNCFF)) {
+		fprintf(stderr, "unable to enable sync fifo: %s\n", ftdi_get_error_string(ftdi));
+		return -1;
+	}
+	/* usb packets are full at this rate, latency timer only matters when strobes stop */
+	ftdi_set_latency_timer(ftdi, 2);
+	ftdi_set_flowctrl(ftdi, SIO_RTS_CTS_HS);
+	ftdi_usb_purge_buffers(ftdi);
+
+	if (!sampling_speed_set) {
+		fprintf(stderr, "sync fifo mode needs WR# strobe rate set with --speed\n");
+		return -1;
+	}
+	if (sampling_speed > SYNCFF_SPEED_MAX) {
+		fprintf(stderr, "sync fifo strobe rate %d is more than usb can carry, at most %d\n", sampling_speed, SYNCFF_SPEED_MAX);
+		return -1;
+	}
+	if (!transfer_count_set) {
+		transfer_count = 32;
+	}
+	if (!transfer_size_set) {
+		transfer_size = 262144;
+	}
+	if (!queue_size_set) {
+		queue_size = 262144;
+	}
+	if (transfer_count < 1) {
+		fprintf(stderr, "sync fifo mode needs asynchronous transfers, blocking reads cannot keep up\n");
+		return -1;
+	}
+
+	return 0;
 }
 
 void sig_catch_int(int signum)
@@ -232,9 +452,12 @@ void sig_catch_int(int signum)
 
 int main(int argc, char *argv[])
 {
-	int err = 0, i;
-	double t;
-	struct sample *sample = NULL;
+	int err = 0, triggered;
+	size_t i;
+	uint64_t trigger_n = 0;
+	uint8_t *data = NULL;
+	size_t size = 0;
+	uint64_t samples_total;
 
 	signal(SIGINT, sig_catch_int);
 
@@ -254,103 +477,132 @@ int main(int argc, char *argv[])
 	// ftdi_read_data_set_chunksize(ftdi, FTDI_READ_BUFFER_SIZE);
 	ftdi_read_data_get_chunksize(ftdi, &ftdi_chunksize);
 	ftdi_set_bitmode(ftdi, 0, BITMODE_RESET);
-	if (ftdi_set_bitmode(ftdi, 0x00, BITMODE_BITBANG)) {
-		fprintf(stderr, "unable to enable bitbang: %s\n", ftdi_get_error_string(ftdi));
+	if (capture_mode == CAPTURE_MODE_SYNCFF) {
+		if (syncff_init()) {
+			p_exit(EXIT_FAILURE);
+		}
+		device_speed = sampling_speed;
+	} else {
+		if (ftdi_set_bitmode(ftdi, 0x00, BITMODE_BITBANG)) {
+			fprintf(stderr, "unable to enable bitbang: %s\n", ftdi_get_error_string(ftdi));
+			p_exit(EXIT_FAILURE);
+		}
+		if (ftdi_set_baudrate(ftdi, sampling_speed / FTDI_BITBANG_RATE_MULTIPLIER)) {
+			fprintf(stderr, "%s\n", ftdi_get_error_string(ftdi));
+			p_exit(EXIT_FAILURE);
+		}
+		device_speed = (double)FTDI_BITBANG_RATE_MULTIPLIER * (double)capture_usb_baudrate(ftdi, sampling_speed / FTDI_BITBANG_RATE_MULTIPLIER);
+	}
+
+	/* open output, decoded frames are written as text */
+	samples_total = (uint64_t)llround(sampling_time * (double)sampling_speed);
+	for (int k = 0; k < decode_spec_count; k++) {
+		if (capture_decode_add(&decode, decode_specs[k], sampling_speed)) {
+			p_exit(EXIT_FAILURE);
+		}
+	}
+	if (capture_output_open(&output, output_file, decode.count > 0 ? CAPTURE_OUTPUT_CSV : output_format, pins_mask, sampling_speed)) {
+		p_exit(EXIT_FAILURE);
+	}
+
+	/* init sampling queue and reader, one transfer fills one queue buffer */
+	if (transfer_count > 0) {
+		ftdi_chunksize = transfer_size;
+	} else if (sampling_speed > 1e6) {
+		fprintf(stderr, "NOTE: sampling speeds over 1 MS/s have been tested as unreliable with blocking reads\n");
+	}
+	if (ringbuffer_init(&sample_ring, (unsigned int)(((size_t)queue_size * 1024 + ftdi_chunksize - 1) / ftdi_chunksize), ftdi_chunksize)) {
+		fprintf(stderr, "unable to allocate capture queue\n");
+		p_exit(EXIT_FAILURE);
+	}
+	/* start decoder, one queue buffer at a time */
+	if (decode.count > 0 && capture_decode_start(&decode, &output, ftdi_chunksize)) {
+		fprintf(stderr, "unable to start decoder\n");
 		p_exit(EXIT_FAILURE);
 	}
-	if (ftdi_set_baudrate(ftdi, sampling_speed / 20)) {
-		fprintf(stderr, "%s\n", ftdi_get_error_string(ftdi));
+	if (capture_usb_start(&sample_reader, ftdi, &sample_ring, transfer_count, transfer_size)) {
+		fprintf(stderr, "unable to start sample reader\n");
 		p_exit(EXIT_FAILURE);
 	}
 
-	/* init sampling thread */
-	pthread_mutex_init(&sample_lock, NULL);
-	pthread_create(&sample_thread, NULL, sample_do, NULL);
-	while (!sample_exec) {
-		os_sleep(0.01);
+	/* compile trigger now that sampling speed is known */
+	if (trigger_spec && capture_trigger_compile(&trigger, trigger_spec, sampling_speed)) {
+		p_exit(EXIT_FAILURE);
+	}
+
+	/* allocate pre-trigger history */
+	if (trigger_spec && pretrigger_time > 0) {
+		history_size = (size_t)llround(pretrigger_time * (double)sampling_speed);
+		history = history_size > 0 ? malloc(history_size) : NULL;
+		if (history_size > 0 && !history) {
+			fprintf(stderr, "unable to allocate pre-trigger history\n");
+			p_exit(EXIT_FAILURE);
+		}
+	} else if (pretrigger_time > 0) {
+		fprintf(stderr, "NOTE: pre-trigger time has no effect without trigger\n");
 	}
 
 	/* set i to zero here, it wont be zero later if trigger was applied */
 	i = 0;
 
 	/* if trigger is set, wait for it */
-	if (trigger_type > -1) {
-		fprintf(stderr, "waiting for trigger on the %s edge with mask 0x%02x\n",
-		        trigger_type == 1 ? "rising" : "falling",
-		        trigger_mask);
+	triggered = trigger_spec ? 0 : 1;
+	if (!triggered) {
+		fprintf(stderr, "waiting for trigger %s\n", trigger_spec);
 	}
-	while (trigger_type > -1) {
+	while (!triggered) {
 		/* if sample exists and no trigger occured */
-		if (sample) {
-			free(sample->data);
-			free(sample);
+		if (data) {
+			ringbuffer_read_release(&sample_ring);
 		}
-		/* get sample from queue */
-		pthread_mutex_lock(&sample_lock);
-		LL_GET(sample_first, sample_last, sample);
-		pthread_mutex_unlock(&sample_lock);
-		/* if no sample, sleep a little and try again */
-		if (!sample) {
-			os_sleep(0.01);
+		/* get sample from queue, if no sample sleep a little and try again */
+		data = sample_wait(&size);
+		if (!data) {
 			continue;
 		}
 		/* check for trigger */
-		for (i = 0; i < ftdi_chunksize; i++) {
-			static int last_value = -1;
-			/* fill last value if this is first sample */
-			if (last_value < 0) {
-				last_value = sample->data[i];
-				continue;
-			}
-			/* check for trigger by type */
-			if (trigger_type == 0 &&
-			        (last_value & trigger_mask) &&
-			        !(sample->data[i] & trigger_mask)) {
-				fprintf(stderr, "falling edge trigger detected\n");
-				trigger_type = -1;
-				break;
-			} else if (trigger_type == 1 &&
-			           !(last_value & trigger_mask) &&
-			           (sample->data[i] & trigger_mask)) {
-				fprintf(stderr, "rising edge trigger detected\n");
-				trigger_type = -1;
-				break;
-			}
-			last_value = sample->data[i];
+		i = capture_trigger_scan(&trigger, data, size, trigger_n);
+		if (i < size) {
+			fprintf(stderr, "trigger detected after %llu samples\n", (unsigned long long)(trigger_n + i));
+			triggered = 1;
+			history_push(data, i);
+			break;
+		}
+		trigger_n += size;
+		history_push(data, size);
+	}
+
+	/* output history first, trigger will be at the sample after it */
+	if (history_fill > 0) {
+		fprintf(stderr, "%zu samples of pre-trigger history, trigger at %g seconds\n",
+		        history_fill, (double)history_fill / (double)sampling_speed);
+		if (history_output()) {
+			p_exit(EXIT_FAILURE);
 		}
+		samples_total += output_n;
 	}
 
 	/* read samples data */
 	fprintf(stderr, "reading data...\n");
-	for (t = 0.0; t <= sampling_time; ) {
-		/* get next sample from queue */
-		if (!sample) {
-			pthread_mutex_lock(&sample_lock);
-			LL_GET(sample_first, sample_last, sample);
-			pthread_mutex_unlock(&sample_lock);
+	while (output_n < samples_total) {
+		/* get next sample from queue, wait for more samples if none */
+		if (!data) {
+			data = sample_wait(&size);
 		}
-		/* wait for more samples */
-		if (!sample) {
-			os_sleep(0.01);
+		if (!data) {
 			continue;
 		}
 		/* manage sample data */
-		for ( ; i < ftdi_chunksize; i++) {
-			static int last_value = -1;
-			if (last_value < 0 ||
-			        (last_value & pins_mask) != (sample->data[i] & pins_mask)) {
-				fprintf(stdout, "%g,%s\n", t, get_sampled_pins_str(sample->data[i]));
-			}
-			last_value = sample->data[i];
-			t += 1.0 / (double)sampling_speed;
-			if (t > sampling_time) {
-				break;
+		if (i < size) {
+			size_t c = size - i;
+			c = c < (samples_total - output_n) ? c : (size_t)(samples_total - output_n);
+			if (samples_output(data + i, c)) {
+				p_exit(EXIT_FAILURE);
 			}
 		}
 		i = 0;
-		free(sample->data);
-		free(sample);
-		sample = NULL;
+		ringbuffer_read_release(&sample_ring);
+		data = NULL;
 	}
 
 	p_exit(EXIT_SUCCESS);
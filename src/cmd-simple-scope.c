@@ -16,15 +16,22 @@
 #include <SDL.h>
 #include <signal.h>
 #include "cmd-common.h"
-#include "linkedlist.h"
+#include "ringbuffer.h"
+#include "capture-usb.h"
+#include "capture-scan.h"
+#include "capture-store.h"
+#include "capture-pyramid.h"
 
-const char opts[] = COMMON_SHORT_OPTS "p:t:s:l:";
+const char opts[] = COMMON_SHORT_OPTS "p:t:s:l:m:r:i:";
 struct option longopts[] = {
 	COMMON_LONG_OPTS
 	{ "pins", required_argument, NULL, 'p' },
 	{ "trigger", required_argument, NULL, 't' },
 	{ "speed", required_argument, NULL, 's' },
 	{ "time", required_argument, NULL, 'l' },
+	{ "mode", required_argument, NULL, 'm' },
+	{ "fps", required_argument, NULL, 'r' },
+	{ "image", required_argument, NULL, 'i' },
 	{ 0, 0, 0, 0 },
 };
 
@@ -37,30 +44,104 @@ int trigger_type = -1;
 /* trigger mask */
 uint8_t trigger_mask = 0;
 
+/*
+ * trigger mode:
+ *  auto:   capture without trigger if it does not come in time
+ *  normal: capture only on trigger
+ *  single: capture once on trigger and hold
+ */
+enum {
+	SCOPE_TRIGGER_AUTO = 0,
+	SCOPE_TRIGGER_NORMAL,
+	SCOPE_TRIGGER_SINGLE,
+};
+int trigger_mode = SCOPE_TRIGGER_AUTO;
+
 /* sampling speed */
 int sampling_speed = 1e6;
 
 /* sampling time */
 double sampling_time = 1.0;
 
+/* target frame rate */
+int frame_rate = 30;
+
+/* render single capture into this image file instead of window */
+char *image_file = NULL;
+
 /* ftdi device context */
 struct ftdi_context *ftdi = NULL;
 
-unsigned int ftdi_chunksize;
+/* sample buffers from usb reader to acquisition thread */
+struct ringbuffer sample_ring;
+struct capture_usb sample_reader;
+
+/*
+ * Captures are double buffered: acquisition thread fills back capture while
+ * renderer draws front one, finished capture is swapped to front under lock.
+ */
+struct scope_capture {
+	/* captured samples, run-length compressed */
+	struct capture_store store;
+	/* min/max summary of stored samples for drawing */
+	struct capture_pyramid pyramid;
+	uint64_t samples_total;
+	int triggered;
+};
+struct scope_capture captures[2];
+/* index of front capture, -1 until first capture is done */
+int capture_front = -1;
+/* set when front capture has changed and not drawn yet */
+int capture_dirty = 0;
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* acquisition thread */
+pthread_t acquire_thread;
+volatile int acquire_exec = 0;
+volatile int acquire_error = 0;
+/* single mode capture is held until re-armed */
+volatile int acquire_rearm = 0;
+
+/*
+ * Visible part of capture as first sample and samples per window width,
+ * served from capture pyramid and store so changing view never touches
+ * raw samples. Owned by render thread.
+ */
+double view_start = 0.0;
+double view_span = 0.0;
+int view_dirty = 0;
+/* zoom in no further than this many samples per window */
+#define VIEW_SPAN_MIN       16.0
 
-struct sample {
-	uint8_t *data;
-	struct sample *prev;
-	struct sample *next;
+/*
+ * Frame is rasterized bit-parallel: each pixel column is described by bytes
+ * with one bit per pin, pins seen high and pins seen low in the column,
+ * and each pixel row by the pin (lane) it belongs to and which of those
+ * bytes it shows. Row is then a simple select over columns.
+ */
+enum {
+	ROW_BACKGROUND = 0,
+	ROW_SEPARATOR,
+	/* horizontal line when pin was high, low or both (vertical edge) */
+	ROW_HIGH,
+	ROW_LOW,
+	ROW_EDGE,
 };
-struct sample *sample_first = NULL;
-struct sample *sample_last = NULL;
-pthread_t sample_thread;
-pthread_mutex_t sample_lock;
-volatile int sample_exec = 0;
+uint8_t *column_high = NULL;
+uint8_t *column_low = NULL;
+uint8_t *column_edge = NULL;
+uint8_t *row_kind = NULL;
+uint8_t *row_bit = NULL;
+/* frame pixels as ARGB8888, uploaded into streaming texture */
+uint32_t *frame_pixels = NULL;
+
+#define COLOR_BACKGROUND    0xff002000
+#define COLOR_SEPARATOR     0xff004000
+#define COLOR_TRACE         0xff00c000
 
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
+SDL_Texture *texture = NULL;
 int window_w = 1280;
 int window_h = 720;
 
@@ -72,32 +153,50 @@ int window_h = 720;
  */
 void p_exit(int return_code)
 {
-	struct sample *sample;
+	int i;
 
-	if (sample_exec) {
-		sample_exec = 0;
-		pthread_join(sample_thread, NULL);
+	if (acquire_exec) {
+		acquire_exec = 0;
+		pthread_join(acquire_thread, NULL);
+	}
+	capture_usb_stop(&sample_reader);
+	if (common_stats) {
+		common_stats_print(stderr, &sample_reader.usb);
 	}
-	pthread_mutex_destroy(&sample_lock);
 	if (ftdi) {
 		ftdi_free(ftdi);
 	}
-
-	LL_GET(sample_first, sample_last, sample);
-	while (sample) {
-		free(sample->data);
-		free(sample);
-		LL_GET(sample_first, sample_last, sample);
+	if (sample_ring.data) {
+		ringbuffer_free(&sample_ring);
 	}
 
+	for (i = 0; i < 2; i++) {
+		capture_store_free(&captures[i].store);
+		capture_pyramid_free(&captures[i].pyramid);
+	}
+	free(column_high);
+	free(column_low);
+	free(column_edge);
+	free(row_kind);
+	free(row_bit);
+	free(frame_pixels);
+
+	if (texture) {
+		SDL_DestroyTexture(texture);
+	}
 	if (renderer) {
 		SDL_DestroyRenderer(renderer);
 	}
 	if (window) {
 		SDL_DestroyWindow(window);
 	}
-	SDL_Quit();
+	if (image_file) {
+		free(image_file);
+	} else {
+		SDL_Quit();
+	}
 
+	common_free();
 	/* terminate program instantly */
 	exit(return_code);
 }
@@ -109,8 +208,23 @@ void p_help()
 	    "  -t, --trigger=PIN[0-7]:EDGE\n"
 	    "                             trigger from pin on rising or falling edge (EDGE = r or f),\n"
 	    "                             if trigger is not set, sampling will start immediately\n"
+	    "  -m, --mode=MODE            trigger mode, default is auto:\n"
+	    "                             auto: capture also without trigger if it does not come\n"
+	    "                             within capture time (at least 100 ms)\n"
+	    "                             normal: capture only when triggered\n"
+	    "                             single: capture once when triggered and hold,\n"
+	    "                             press space to re-arm\n"
 	    "  -s, --speed=INT            sampling speed, default 1000000 (1 MS/s)\n"
 	    "  -l, --time=FLOAT           sample for this many seconds, default 1 second\n"
+	    "  -r, --fps=INT              window refresh rate, default 30\n"
+	    "  -i, --image=FILE           do not open window, render first capture into\n"
+	    "                             binary PPM image and exit\n"
+	    "\n"
+	    "Mouse wheel zooms around pointer, drag with left button to pan.\n"
+	    "Keys: +/- or up/down zoom, left/right pan, home shows whole capture,\n"
+	    "space re-arms single trigger, q or escape quits.\n"
+	    "\n"
+	    "Each captured pin is drawn in its own lane, pin 0 on top.\n"
 	    "\n"
 	    "Simple capture command for FTDI FTx232 chips.\n"
 	    "Uses bitbang mode so only ADBUS (pins 0-7) can be sampled.\n"
@@ -152,15 +266,24 @@ int p_options(int c, char *optarg)
 		trigger_type = *optarg == 'r' ? 1 : 0;
 		trigger_mask = (1 << i);
 		return 1;
+	case 'm':
+		if (strcmp(optarg, "auto") == 0) {
+			trigger_mode = SCOPE_TRIGGER_AUTO;
+		} else if (strcmp(optarg, "normal") == 0) {
+			trigger_mode = SCOPE_TRIGGER_NORMAL;
+		} else if (strcmp(optarg, "single") == 0) {
+			trigger_mode = SCOPE_TRIGGER_SINGLE;
+		} else {
+			fprintf(stderr, "invalid trigger mode: %s\n", optarg);
+			return -1;
+		}
+		return 1;
 	case 's':
 		sampling_speed = (int)atof(optarg);
 		if (sampling_speed <= 0) {
 			fprintf(stderr, "invalid sampling speed: %d\n", sampling_speed);
 			return -1;
 		}
-		if (sampling_speed > 1e6) {
-			fprintf(stderr, "NOTE: sampling speeds over 1 MS/s have been tested as unreliable\n");
-		}
 		return 1;
 	case 'l':
 		sampling_time = atof(optarg);
@@ -169,6 +292,19 @@ int p_options(int c, char *optarg)
 			return -1;
 		}
 		return 1;
+	case 'r':
+		frame_rate = atoi(optarg);
+		if (frame_rate <= 0) {
+			fprintf(stderr, "invalid frame rate: %s\n", optarg);
+			return -1;
+		}
+		return 1;
+	case 'i':
+		if (image_file) {
+			free(image_file);
+		}
+		image_file = strdup(optarg);
+		return 1;
 	}
 
 	return 0;
@@ -191,158 +327,388 @@ static void os_sleep(long double t)
 	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
 }
 
-static void *sample_do(void *p)
+/* swap finished back capture to front */
+static void capture_publish(int back)
 {
-	struct sample *sample = NULL;
-	int n, c;
-
-	/* capture data continuosly until told to stop */
-	sample_exec = 1;
-	while (sample_exec) {
-		/* allocate new sample buffer */
-		if (!sample) {
-			sample = (struct sample *)malloc(sizeof(*sample));
-			sample->data = (uint8_t *)malloc(ftdi_chunksize);
-			n = 0;
-		}
-		/* read data into buffer */
-		c = ftdi_read_data(ftdi, sample->data + n, ftdi_chunksize - n);
-		if (c > 0) {
-			n += c;
-		} else if (c < 0) {
-			fprintf(stderr, "sample read failure: %s\n", ftdi_get_error_string(ftdi));
-			p_exit(EXIT_FAILURE);
-		}
-		/* continue read if buffer not full */
-		if (n < ftdi_chunksize) {
+	pthread_mutex_lock(&capture_lock);
+	capture_front = back;
+	capture_dirty = 1;
+	pthread_mutex_unlock(&capture_lock);
+}
+
+/*
+ * Acquisition thread: look for trigger and store samples into back capture.
+ * Processes one queue buffer at a time, rest of buffer after one capture
+ * is used for finding next trigger.
+ */
+static void *acquire_do(void *p)
+{
+	struct ringbuffer *ring = p;
+	enum { ARMED, CAPTURING, HOLD } state = ARMED;
+	struct scope_capture *cap;
+	uint64_t samples_total = (uint64_t)llround(sampling_time * (double)sampling_speed);
+	/* auto mode gives up waiting for trigger after this many samples */
+	uint64_t auto_samples = samples_total > (uint64_t)(sampling_speed / 10) ? samples_total : (uint64_t)(sampling_speed / 10);
+	uint64_t waited = 0;
+	int back = 0, last_value = -1;
+
+	cap = &captures[back];
+	capture_store_clear(&cap->store);
+	capture_pyramid_clear(&cap->pyramid);
+
+	while (acquire_exec) {
+		size_t size, pos = 0;
+		uint8_t *data = ringbuffer_read_slot(ring, &size);
+		if (!data) {
+			if (sample_reader.error) {
+				acquire_error = 1;
+				break;
+			}
+			os_sleep(0.01);
 			continue;
 		}
-		/* append sample into queue */
-		pthread_mutex_lock(&sample_lock);
-		LL_APP(sample_first, sample_last, sample);
-		pthread_mutex_unlock(&sample_lock);
-		sample = NULL;
+
+		while (pos < size) {
+			if (state == HOLD) {
+				/* keep queue flowing while holding single capture */
+				if (acquire_rearm) {
+					acquire_rearm = 0;
+					state = ARMED;
+					waited = 0;
+					continue;
+				}
+				break;
+			} else if (state == ARMED) {
+				size_t i;
+				if (trigger_type < 0) {
+					cap->triggered = 0;
+					state = CAPTURING;
+					continue;
+				}
+				/* first sample ever has nothing to compare to */
+				if (last_value < 0) {
+					last_value = data[0];
+				}
+				i = capture_scan_edge(data + pos, size - pos, trigger_mask, pos > 0 ? data[pos - 1] : (uint8_t)last_value, trigger_type);
+				if (i < size - pos) {
+					pos += i;
+					cap->triggered = 1;
+					state = CAPTURING;
+					continue;
+				}
+				waited += size - pos;
+				pos = size;
+				if (trigger_mode == SCOPE_TRIGGER_AUTO && waited >= auto_samples) {
+					cap->triggered = 0;
+					state = CAPTURING;
+				}
+			} else {
+				size_t c = size - pos;
+				c = c < (samples_total - cap->store.samples) ? c : (size_t)(samples_total - cap->store.samples);
+				if (capture_store_append(&cap->store, data + pos, c) ||
+				        capture_pyramid_append(&cap->pyramid, data + pos, c)) {
+					fprintf(stderr, "out of memory while storing samples\n");
+					acquire_error = 1;
+					break;
+				}
+				pos += c;
+				if (cap->store.samples < samples_total) {
+					continue;
+				}
+				/* capture done, start filling the other one */
+				cap->samples_total = samples_total;
+				capture_publish(back);
+				back = back ? 0 : 1;
+				cap = &captures[back];
+				capture_store_clear(&cap->store);
+				capture_pyramid_clear(&cap->pyramid);
+				waited = 0;
+				state = trigger_mode == SCOPE_TRIGGER_SINGLE ? HOLD : ARMED;
+			}
+		}
+
+		/* status-only transfers come in as empty buffers */
+		if (size > 0) {
+			last_value = data[size - 1];
+		}
+		ringbuffer_read_release(ring);
+		if (acquire_error) {
+			break;
+		}
 	}
 
 	return NULL;
 }
 
-static char *get_sampled_pins_str(uint8_t value)
+/* add runs from store between start and end to pins seen */
+static void store_pins(struct scope_capture *cap, uint64_t start, uint64_t end, uint8_t *any, uint8_t *all)
 {
-	static char str[128];
-	if (value & pins_mask) {
-		strcpy(str, "1");
-	} else {
-		strcpy(str, "0");
+	while (start < end) {
+		int value = capture_store_run(&cap->store, start, &start);
+		if (value < 0) {
+			break;
+		}
+		*any |= value;
+		*all &= value;
+	}
+}
+
+/*
+ * Pins seen high in any sample and high in all samples from start to end.
+ * Whole pyramid nodes are used for wide ranges, unaligned ends and narrow
+ * ranges are few runs from store.
+ */
+static void column_pins(struct scope_capture *cap, uint64_t start, uint64_t end, uint8_t *any, uint8_t *all)
+{
+	struct capture_pyramid_node node;
+	uint64_t first, last;
+
+	*any = 0x00;
+	*all = 0xff;
+	if (capture_pyramid_get(&cap->pyramid, start, end, &node, &first, &last)) {
+		store_pins(cap, start, end, any, all);
+		return;
 	}
-	return str;
+	*any = node.any;
+	*all = node.all;
+	store_pins(cap, start, first, any, all);
+	store_pins(cap, last, end, any, all);
 }
 
-static int read_samples()
+/* split frame rows into one lane per captured pin */
+static void frame_lanes(int h)
 {
-	int err = 0, i = 0, x_last, y_last, last_value;
-	double t;
-	struct sample *sample = NULL;
-	int tt = trigger_type;
+	int lanes = 0, lane = 0, pin, y;
 
-	/* if trigger is set, wait for it */
-	if (tt > -1) {
-		fprintf(stderr, "waiting for trigger on the %s edge with mask 0x%02x\n",
-		        tt == 1 ? "rising" : "falling",
-		        trigger_mask);
+	for (pin = 0; pin < 8; pin++) {
+		lanes += (pins_mask >> pin) & 1;
 	}
-	for (last_value = -1; tt > -1; ) {
-		/* check if we should exit */
-		SDL_Event event;
-		while (SDL_PollEvent(&event)) {
-			if (event.type == SDL_QUIT) {
-				p_exit(EXIT_SUCCESS);
-			}
+	memset(row_kind, ROW_BACKGROUND, h);
+	memset(row_bit, 0, h);
+	for (pin = 0; pin < 8 && lanes > 0; pin++) {
+		int top, y_high, y_low;
+		if (!((pins_mask >> pin) & 1)) {
+			continue;
 		}
-		/* if sample exists and no trigger occured */
-		if (sample) {
-			free(sample->data);
-			free(sample);
-		}
-		/* get sample from queue */
-		pthread_mutex_lock(&sample_lock);
-		LL_GET(sample_first, sample_last, sample);
-		pthread_mutex_unlock(&sample_lock);
-		/* if no sample, sleep a little and try again */
-		if (!sample) {
-			os_sleep(0.01);
+		top = h * lane / lanes;
+		y_high = top + (h / lanes) / 5;
+		y_low = top + (h / lanes) - (h / lanes) / 5;
+		if (lane > 0) {
+			row_kind[top] = ROW_SEPARATOR;
+		}
+		for (y = y_high; y <= y_low && y < h; y++) {
+			row_kind[y] = y == y_high ? ROW_HIGH : (y == y_low ? ROW_LOW : ROW_EDGE);
+			row_bit[y] = 1 << pin;
+		}
+		lane++;
+	}
+}
+
+/*
+ * Compute column bytes for the view and rasterize frame. Level where
+ * previous column ended is included in column so that edges connect.
+ */
+static void frame_render(struct scope_capture *cap, int w, int h)
+{
+	int x, y;
+	uint8_t last = 0;
+
+	for (x = 0; x < w; x++) {
+		uint64_t start = (uint64_t)(view_start + view_span * x / w);
+		uint64_t end = (uint64_t)(view_start + view_span * (x + 1) / w);
+		uint8_t any, all;
+		if (end <= start) {
+			end = start + 1;
+		}
+		if (start >= cap->store.samples) {
+			column_high[x] = column_low[x] = column_edge[x] = 0;
 			continue;
 		}
-		/* check for trigger */
-		for (i = 0; i < ftdi_chunksize; i++) {
-			/* fill last value if this is first sample */
-			if (last_value < 0) {
-				last_value = sample->data[i];
-				continue;
+		column_pins(cap, start, end, &any, &all);
+		if (x > 0) {
+			any |= last;
+			all &= last;
+		}
+		column_high[x] = any;
+		column_low[x] = ~all;
+		column_edge[x] = any & ~all;
+		last = (uint8_t)capture_store_get(&cap->store, (end < cap->store.samples ? end : cap->store.samples) - 1);
+	}
+
+	for (y = 0; y < h; y++) {
+		uint32_t *row = frame_pixels + (size_t)y * w;
+		const uint8_t *src;
+		uint8_t bit = row_bit[y];
+		switch (row_kind[y]) {
+		case ROW_SEPARATOR:
+			for (x = 0; x < w; x++) {
+				row[x] = COLOR_SEPARATOR;
 			}
-			/* check for trigger by type */
-			if (tt == 0 &&
-			        (last_value & trigger_mask) &&
-			        !(sample->data[i] & trigger_mask)) {
-				fprintf(stderr, "falling edge trigger detected\n");
-				tt = -1;
-				break;
-			} else if (tt == 1 &&
-			           !(last_value & trigger_mask) &&
-			           (sample->data[i] & trigger_mask)) {
-				fprintf(stderr, "rising edge trigger detected\n");
-				tt = -1;
-				break;
+			continue;
+		case ROW_HIGH:
+			src = column_high;
+			break;
+		case ROW_LOW:
+			src = column_low;
+			break;
+		case ROW_EDGE:
+			src = column_edge;
+			break;
+		default:
+			for (x = 0; x < w; x++) {
+				row[x] = COLOR_BACKGROUND;
 			}
-			last_value = sample->data[i];
+			continue;
+		}
+		for (x = 0; x < w; x++) {
+			row[x] = (src[x] & bit) ? COLOR_TRACE : COLOR_BACKGROUND;
 		}
 	}
+}
+
+/* render frame from front capture if it or view has changed, returns 1 if there is something new to draw */
+static int frame_update(void)
+{
+	int changed = 0;
+	pthread_mutex_lock(&capture_lock);
+	if ((capture_dirty || view_dirty) && capture_front >= 0) {
+		frame_render(&captures[capture_front], window_w, window_h);
+		capture_dirty = 0;
+		view_dirty = 0;
+		changed = 1;
+	}
+	pthread_mutex_unlock(&capture_lock);
+	return changed;
+}
 
-	/* clear screen */
-	SDL_SetRenderDrawColor(renderer, 0, 32, 0, SDL_ALPHA_OPAQUE);
-	SDL_RenderClear(renderer);
-	SDL_SetRenderDrawColor(renderer, 0, 192, 0, SDL_ALPHA_OPAQUE);
+/* upload frame into texture once and show it */
+static void frame_draw(void)
+{
+	SDL_UpdateTexture(texture, NULL, frame_pixels, window_w * sizeof(*frame_pixels));
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
+	SDL_RenderPresent(renderer);
+}
 
-	/* read samples data */
-	fprintf(stderr, "reading data...\n");
-	for (t = 0.0, x_last = -1, y_last = -1, last_value = -1; t <= sampling_time; ) {
-		/* get next sample from queue */
-		if (!sample) {
-			pthread_mutex_lock(&sample_lock);
-			LL_GET(sample_first, sample_last, sample);
-			pthread_mutex_unlock(&sample_lock);
-		}
-		/* wait for more samples */
-		if (!sample) {
-			os_sleep(0.01);
-			continue;
+/* write frame as binary PPM image */
+static int frame_write_image(const char *filename)
+{
+	FILE *f;
+	uint8_t *row;
+	int x, y, err = 0;
+
+	f = fopen(filename, "wb");
+	if (!f) {
+		fprintf(stderr, "unable to open image file %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	row = malloc((size_t)window_w * 3);
+	if (!row) {
+		fclose(f);
+		return -1;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", window_w, window_h);
+	for (y = 0; y < window_h && !err; y++) {
+		for (x = 0; x < window_w; x++) {
+			uint32_t c = frame_pixels[(size_t)y * window_w + x];
+			row[x * 3 + 0] = (c >> 16) & 0xff;
+			row[x * 3 + 1] = (c >> 8) & 0xff;
+			row[x * 3 + 2] = c & 0xff;
 		}
-		/* manage sample data */
-		for ( ; i < ftdi_chunksize; i++) {
-			if (last_value < 0 || (last_value & pins_mask) != (sample->data[i] & pins_mask)) {
-				if (x_last < 0) {
-					x_last = 0;
-					y_last = (sample->data[i] & pins_mask) ? 10 : window_h - 20;
-				} else {
-					int x = (int)((double)window_w * t / sampling_time);
-					int y = (sample->data[i] & pins_mask) ? 10 : window_h - 20;
-					SDL_RenderDrawLine(renderer, x_last, y_last, x, y);
-					x_last = x;
-					y_last = y;
-				}
-			}
-			last_value = sample->data[i];
-			t += 1.0 / (double)sampling_speed;
-			if (t > sampling_time) {
+		err = fwrite(row, 3, window_w, f) != (size_t)window_w;
+	}
+	free(row);
+	if (fclose(f) || err) {
+		fprintf(stderr, "failed writing image file %s\n", filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* keep view inside capture */
+static void view_set(double start, double span)
+{
+	double total = (double)llround(sampling_time * (double)sampling_speed);
+	char title[128];
+
+	span = span < VIEW_SPAN_MIN ? VIEW_SPAN_MIN : span;
+	span = span > total ? total : span;
+	start = start > total - span ? total - span : start;
+	start = start < 0.0 ? 0.0 : start;
+	if (start == view_start && span == view_span) {
+		return;
+	}
+	view_start = start;
+	view_span = span;
+	view_dirty = 1;
+
+	if (window) {
+		snprintf(title, sizeof(title), "ftdi-simple-scope %.9f s + %.9f s",
+		         view_start / (double)sampling_speed, view_span / (double)sampling_speed);
+		SDL_SetWindowTitle(window, title);
+	}
+}
+
+/* zoom view keeping sample under pixel column x in place */
+static void view_zoom(double factor, int x)
+{
+	double center = view_start + view_span * x / window_w;
+	double span = view_span * factor;
+	view_set(center - span * x / window_w, span);
+}
+
+/* handle window events, exits when window is closed */
+static void window_events(void)
+{
+	SDL_Event event;
+	while (SDL_PollEvent(&event)) {
+		if (event.type == SDL_QUIT) {
+			p_exit(EXIT_SUCCESS);
+		} else if (event.type == SDL_KEYDOWN) {
+			switch (event.key.keysym.sym) {
+			case SDLK_q:
+			case SDLK_ESCAPE:
+				p_exit(EXIT_SUCCESS);
+				break;
+			case SDLK_SPACE:
+				acquire_rearm = 1;
+				break;
+			case SDLK_PLUS:
+			case SDLK_EQUALS:
+			case SDLK_UP:
+				view_zoom(0.5, window_w / 2);
+				break;
+			case SDLK_MINUS:
+			case SDLK_DOWN:
+				view_zoom(2.0, window_w / 2);
+				break;
+			case SDLK_LEFT:
+				view_set(view_start - view_span / 10, view_span);
+				break;
+			case SDLK_RIGHT:
+				view_set(view_start + view_span / 10, view_span);
+				break;
+			case SDLK_HOME:
+				view_set(0.0, HUGE_VAL);
 				break;
 			}
+		} else if (event.type == SDL_MOUSEWHEEL) {
+			/* zoom around mouse pointer */
+			int x;
+			SDL_GetMouseState(&x, NULL);
+			if (event.wheel.y != 0) {
+				view_zoom(event.wheel.y > 0 ? 0.8 : 1.25, x);
+			}
+		} else if (event.type == SDL_MOUSEMOTION && (event.motion.state & SDL_BUTTON_LMASK)) {
+			/* drag to pan */
+			view_set(view_start - view_span * event.motion.xrel / window_w, view_span);
+		} else if (event.type == SDL_WINDOWEVENT) {
+			/* redraw after expose and such */
+			pthread_mutex_lock(&capture_lock);
+			capture_dirty = 1;
+			pthread_mutex_unlock(&capture_lock);
 		}
-		i = 0;
-		free(sample->data);
-		free(sample);
-		sample = NULL;
 	}
-	SDL_RenderPresent(renderer);
 }
 
 void sig_catch_int(int signum)
@@ -353,10 +719,13 @@ void sig_catch_int(int signum)
 
 int main(int argc, char *argv[])
 {
+	unsigned int ftdi_chunksize = 65536;
+	long double next;
+
 	signal(SIGINT, sig_catch_int);
 
 	/* parse command line options */
-	if (common_options(argc, argv, opts, longopts, 0)) {
+	if (common_options(argc, argv, opts, longopts, 0, 0)) {
 		fprintf(stderr, "invalid command line option(s)\n");
 		p_exit(EXIT_FAILURE);
 	}
@@ -367,45 +736,109 @@ int main(int argc, char *argv[])
 		p_exit(EXIT_FAILURE);
 	}
 	ftdi_set_latency_timer(ftdi, 1);
-	// ftdi_write_data_set_chunksize(ftdi, FTDI_READ_BUFFER_SIZE);
-	// ftdi_read_data_set_chunksize(ftdi, FTDI_READ_BUFFER_SIZE);
-	ftdi_read_data_get_chunksize(ftdi, &ftdi_chunksize);
 	ftdi_set_bitmode(ftdi, 0, BITMODE_RESET);
 	if (ftdi_set_bitmode(ftdi, 0x00, BITMODE_BITBANG)) {
 		fprintf(stderr, "unable to enable bitbang: %s\n", ftdi_get_error_string(ftdi));
 		p_exit(EXIT_FAILURE);
 	}
-	if (ftdi_set_baudrate(ftdi, sampling_speed / 20)) {
+	if (ftdi_set_baudrate(ftdi, sampling_speed / FTDI_BITBANG_RATE_MULTIPLIER)) {
 		fprintf(stderr, "%s\n", ftdi_get_error_string(ftdi));
 		p_exit(EXIT_FAILURE);
 	}
 
+	/* init captures and frame */
+	for (int i = 0; i < 2; i++) {
+		if (capture_store_init(&captures[i].store, 0) || capture_pyramid_init(&captures[i].pyramid, pins_mask)) {
+			fprintf(stderr, "unable to allocate sample store\n");
+			p_exit(EXIT_FAILURE);
+		}
+	}
+	column_high = malloc(window_w);
+	column_low = malloc(window_w);
+	column_edge = malloc(window_w);
+	row_kind = malloc(window_h);
+	row_bit = malloc(window_h);
+	frame_pixels = malloc((size_t)window_w * window_h * sizeof(*frame_pixels));
+	if (!column_high || !column_low || !column_edge || !row_kind || !row_bit || !frame_pixels) {
+		fprintf(stderr, "unable to allocate frame\n");
+		p_exit(EXIT_FAILURE);
+	}
+	frame_lanes(window_h);
+
 	/* init graphics */
-	if (SDL_Init(SDL_INIT_VIDEO)) {
-		fprintf(stderr, "SDL initialization failed");
+	if (!image_file) {
+		if (SDL_Init(SDL_INIT_VIDEO)) {
+			fprintf(stderr, "SDL initialization failed");
+			p_exit(EXIT_FAILURE);
+		}
+		if (SDL_CreateWindowAndRenderer(window_w, window_h, 0, &window, &renderer)) {
+			fprintf(stderr, "creating scope window failed");
+			p_exit(EXIT_FAILURE);
+		}
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, window_w, window_h);
+		if (!texture) {
+			fprintf(stderr, "creating scope texture failed: %s\n", SDL_GetError());
+			p_exit(EXIT_FAILURE);
+		}
+		SDL_SetRenderDrawColor(renderer, 0, 32, 0, SDL_ALPHA_OPAQUE);
+		SDL_RenderClear(renderer);
+		SDL_RenderPresent(renderer);
+	}
+	view_set(0.0, HUGE_VAL);
+
+	/* start sampling: usb reader fills queue, acquisition thread empties it */
+	if (ringbuffer_init(&sample_ring, 256, ftdi_chunksize)) {
+		fprintf(stderr, "unable to allocate capture queue\n");
 		p_exit(EXIT_FAILURE);
 	}
-	if (SDL_CreateWindowAndRenderer(window_w, window_h, 0, &window, &renderer)) {
-		fprintf(stderr, "creating scope window failed");
+	if (capture_usb_start(&sample_reader, ftdi, &sample_ring, 8, ftdi_chunksize)) {
+		fprintf(stderr, "unable to start sample reader\n");
 		p_exit(EXIT_FAILURE);
 	}
-	SDL_SetRenderDrawColor(renderer, 0, 32, 0, SDL_ALPHA_OPAQUE);
-	SDL_RenderClear(renderer);
-	SDL_RenderPresent(renderer);
+	acquire_exec = 1;
+	if (pthread_create(&acquire_thread, NULL, acquire_do, &sample_ring)) {
+		acquire_exec = 0;
+		fprintf(stderr, "unable to start acquisition thread\n");
+		p_exit(EXIT_FAILURE);
+	}
+	if (trigger_type > -1) {
+		fprintf(stderr, "waiting for trigger on the %s edge with mask 0x%02x\n",
+		        trigger_type == 1 ? "rising" : "falling",
+		        trigger_mask);
+	}
 
-	/* init sampling thread */
-	pthread_mutex_init(&sample_lock, NULL);
-	pthread_create(&sample_thread, NULL, sample_do, NULL);
-	while (!sample_exec) {
-		os_sleep(0.01);
+	/* headless: wait for first capture and render it into image */
+	if (image_file) {
+		while (!frame_update()) {
+			if (acquire_error) {
+				p_exit(EXIT_FAILURE);
+			}
+			os_sleep(0.01);
+		}
+		fprintf(stderr, "%s capture rendered into %s\n",
+		        captures[capture_front].triggered ? "triggered" : "untriggered", image_file);
+		p_exit(frame_write_image(image_file) ? EXIT_FAILURE : EXIT_SUCCESS);
 	}
 
-	/* start sampling */
-	while (1) {
-		read_samples();
+	/* render at fixed frame rate, only when there is something new */
+	for (next = os_time(); ; ) {
+		long double now;
+		window_events();
+		if (acquire_error) {
+			p_exit(EXIT_FAILURE);
+		}
+		if (frame_update()) {
+			frame_draw();
+		}
+		next += 1.0L / (long double)frame_rate;
+		now = os_time();
+		if (next > now) {
+			os_sleep(next - now);
+		} else {
+			next = now;
+		}
 	}
 
 	p_exit(EXIT_SUCCESS);
 	return EXIT_SUCCESS;
 }
-
@@ -18,6 +18,7 @@
 const char opts[] = COMMON_SHORT_OPTS "m:c:o:i:s:ladn:CX";
 struct option longopts[] = {
 	COMMON_LONG_OPTS
+	COMMON_BITBANG_LONG_OPTS
 	{ "mode", required_argument, NULL, 'm' },
 	{ "sclk", required_argument, NULL, 'c' },
 	{ "mosi", required_argument, NULL, 'o' },
@@ -61,12 +62,21 @@ void p_exit(int return_code)
 		ftdi_spi_free(spi);
 	}
 	if (device) {
+		if (common_stats) {
+			struct ftdi_bitbang_stats stats;
+			ftdi_bitbang_stats_get(device, &stats);
+			common_stats_print(stderr, &stats);
+		}
+		if (common_trace_file && ftdi_bitbang_trace_stop(device)) {
+			fprintf(stderr, "failed to write trace file: %s\n", common_trace_file);
+		}
 		ftdi_bitbang_save_state(device);
 		ftdi_bitbang_free(device);
 	}
 	if (ftdi) {
 		ftdi_free(ftdi);
 	}
+	common_free();
 	/* terminate program instantly */
 	exit(return_code);
 }
@@ -74,6 +84,7 @@ void p_exit(int return_code)
 void p_help()
 {
 	printf(
+	    COMMON_BITBANG_HELP
 	    "  -m, --mode=STRING          set device bitmode, use 'bitbang' or 'mpsse', default is 'bitbang'\n"
 	    "                             for bitbang mode the baud rate is fixed to 1 MHz for now\n"
 	    "  -c, --sclk=PIN             SPI SCLK, default pin is 0\n"
@@ -233,6 +244,10 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "ftdi_bitbang_init() failed\n");
 		p_exit(EXIT_FAILURE);
 	}
+	if (common_trace_file && ftdi_bitbang_trace_start(device, common_trace_file)) {
+		fprintf(stderr, "unable to create trace file: %s\n", common_trace_file);
+		p_exit(EXIT_FAILURE);
+	}
 
 	/* initialize spi */
 	spi = ftdi_spi_init(device, sclk, mosi, miso, ss);
@@ -19,8 +19,192 @@
 #include <libusb-1.0/libusb.h>
 #include "ftdi-bitbang.h"
 
+/* upper estimates of rates at which written bytes are clocked out by the device */
+#define MPSSE_WRITE_RATE                40e6
+/* longer delays are slept instead of padding the output stream */
+#define DELAY_PAD_MAX                   1e-3
+/* how long MPSSE response is waited for */
+#define MPSSE_READ_TIMEOUT              1.0
 
-struct ftdi_bitbang_context *ftdi_bitbang_init(struct ftdi_context *ftdi, int mode, int load_state)
+static double _os_time()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (double)tp.tv_sec + (double)tp.tv_nsec / 1e9;
+}
+
+static void _os_sleep(double t)
+{
+	struct timespec tp;
+	double integral;
+	t += _os_time();
+	tp.tv_nsec = (long)(modf(t, &integral) * 1e9);
+	tp.tv_sec = (time_t)integral;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
+}
+
+/* libftdi transport */
+static int _ftdi_write(void *ctx, const uint8_t *data, size_t size)
+{
+	return ftdi_write_data(ctx, data, size);
+}
+
+static int _ftdi_read(void *ctx, uint8_t *data, size_t size)
+{
+	return ftdi_read_data(ctx, data, size);
+}
+
+static int _ftdi_set_bitmode(void *ctx, uint8_t io, uint8_t mode)
+{
+	return ftdi_set_bitmode(ctx, io, mode);
+}
+
+static int _ftdi_set_baudrate(void *ctx, int baudrate)
+{
+	return ftdi_set_baudrate(ctx, baudrate);
+}
+
+static int _ftdi_purge_rx(void *ctx)
+{
+	return ftdi_usb_purge_rx_buffer(ctx);
+}
+
+static int _ftdi_read_pins(void *ctx, uint8_t *pins)
+{
+	return ftdi_read_pins(ctx, pins);
+}
+
+static int _ftdi_set_latency_timer(void *ctx, int ms)
+{
+	return ftdi_set_latency_timer(ctx, ms);
+}
+
+/* count finished usb operation into statistics and trace */
+static void _usb_done(struct ftdi_bitbang_context *dev, int op, double t, size_t bytes, int error, const void *data, size_t size)
+{
+	double duration = _os_time() - t;
+	ftdi_bitbang_stats_add(&dev->stats, op, bytes, duration, error);
+	if (dev->trace && ftdi_trace_record(dev->trace, op, error, t, duration, data, size)) {
+		/* stop tracing on write errors, reported by ftdi_bitbang_trace_stop() */
+		ftdi_trace_close(dev->trace);
+		dev->trace = NULL;
+		dev->trace_error = 1;
+	}
+}
+
+/* usb operations, each one is timed and counted into statistics */
+static int _usb_write(struct ftdi_bitbang_context *dev, const uint8_t *data, size_t size)
+{
+	double t = _os_time();
+	int n = dev->transport.write(dev->transport.ctx, data, size);
+	_usb_done(dev, FTDI_BITBANG_OP_WRITE, t, n > 0 ? n : 0, n != (int)size, data, size);
+	return n;
+}
+
+static int _usb_read(struct ftdi_bitbang_context *dev, uint8_t *data, size_t size)
+{
+	double t = _os_time();
+	int n = dev->transport.read(dev->transport.ctx, data, size);
+	_usb_done(dev, FTDI_BITBANG_OP_READ, t, n > 0 ? n : 0, n < 0, data, n > 0 ? n : 0);
+	return n;
+}
+
+static int _usb_set_bitmode(struct ftdi_bitbang_context *dev, uint8_t io, uint8_t mode)
+{
+	uint8_t args[2] = { io, mode };
+	double t = _os_time();
+	int err = dev->transport.set_bitmode(dev->transport.ctx, io, mode);
+	_usb_done(dev, FTDI_BITBANG_OP_SET_BITMODE, t, 0, err, args, sizeof(args));
+	return err;
+}
+
+static int _usb_set_baudrate(struct ftdi_bitbang_context *dev, int baudrate)
+{
+	uint8_t args[4] = { baudrate, baudrate >> 8, baudrate >> 16, baudrate >> 24 };
+	double t = _os_time();
+	int err = dev->transport.set_baudrate(dev->transport.ctx, baudrate);
+	_usb_done(dev, FTDI_BITBANG_OP_BAUDRATE, t, 0, err, args, sizeof(args));
+	return err;
+}
+
+static int _usb_purge_rx(struct ftdi_bitbang_context *dev)
+{
+	double t = _os_time();
+	int err = dev->transport.purge_rx(dev->transport.ctx);
+	_usb_done(dev, FTDI_BITBANG_OP_PURGE, t, 0, err, NULL, 0);
+	return err;
+}
+
+static int _usb_read_pins(struct ftdi_bitbang_context *dev, uint8_t *pins)
+{
+	double t = _os_time();
+	int err = dev->transport.read_pins(dev->transport.ctx, pins);
+	_usb_done(dev, FTDI_BITBANG_OP_READ_PINS, t, err ? 0 : 1, err, pins, err ? 0 : 1);
+	return err;
+}
+
+static int _usb_set_latency_timer(struct ftdi_bitbang_context *dev, int ms)
+{
+	uint8_t args[1] = { ms };
+	double t = _os_time();
+	int err = dev->transport.set_latency_timer(dev->transport.ctx, ms);
+	_usb_done(dev, FTDI_BITBANG_OP_LATENCY_TIMER, t, 0, err, args, sizeof(args));
+	return err;
+}
+
+/* send everything buffered so far without ending buffering */
+static int _buffer_send(struct ftdi_bitbang_context *dev)
+{
+	if (dev->buf_len < 1) {
+		return 0;
+	}
+	int n = _usb_write(dev, dev->buf, dev->buf_len);
+	dev->buf_len = 0;
+	return n > 0 ? 0 : -1;
+}
+
+/* reserve space from end of write buffer */
+static uint8_t *_buffer_reserve(struct ftdi_bitbang_context *dev, size_t size)
+{
+	if ((dev->buf_len + size) > dev->buf_size) {
+		size_t buf_size = dev->buf_size > 0 ? dev->buf_size : 4096;
+		while (buf_size < (dev->buf_len + size)) {
+			buf_size *= 2;
+		}
+		uint8_t *buf = realloc(dev->buf, buf_size);
+		if (!buf) {
+			return NULL;
+		}
+		dev->buf = buf;
+		dev->buf_size = buf_size;
+	}
+	dev->buf_len += size;
+	return dev->buf + dev->buf_len - size;
+}
+
+/* write data to device or append it into buffer when buffering, data is repeated count times */
+static int _write(struct ftdi_bitbang_context *dev, uint8_t *data, size_t size, size_t count)
+{
+	if (dev->buf_depth < 1) {
+		double now = _os_time();
+		dev->buf_time = dev->buf_time < now ? now : dev->buf_time;
+	}
+	dev->buf_time += (double)(size * count) / dev->write_rate;
+
+	if (dev->buf_depth < 1 && count == 1) {
+		return _usb_write(dev, data, size) > 0 ? 0 : -1;
+	}
+	uint8_t *p = _buffer_reserve(dev, size * count);
+	if (!p) {
+		return -1;
+	}
+	for ( ; count > 0; count--, p += size) {
+		memcpy(p, data, size);
+	}
+	return dev->buf_depth < 1 ? _buffer_send(dev) : 0;
+}
+
+static struct ftdi_bitbang_context *_init(struct ftdi_context *ftdi, const struct ftdi_bitbang_transport *transport, int mode, int load_state)
 {
 	struct ftdi_bitbang_context *dev = malloc(sizeof(struct ftdi_bitbang_context));
 	if (!dev) {
@@ -30,6 +214,8 @@ struct ftdi_bitbang_context *ftdi_bitbang_init(struct ftdi_context *ftdi, int mo
 
 	/* save args */
 	dev->ftdi = ftdi;
+	memcpy(&dev->transport, transport, sizeof(dev->transport));
+	dev->l_io_applied = -1;
 
 	/* load state if requested */
 	if (load_state) {
@@ -49,35 +235,65 @@ struct ftdi_bitbang_context *ftdi_bitbang_init(struct ftdi_context *ftdi, int mo
 		dev->state.mode = BITMODE_BITBANG;
 		/* set baud rate */
 		/** @todo add support for changing baud rate */
-		if (ftdi_set_baudrate(dev->ftdi, 1e6)) {
+		if (_usb_set_baudrate(dev, 1e6)) {
 			free(dev);
 			return  NULL;
 		}
-	} else if (ftdi->type == TYPE_4232H) {
-		/* there is no point in supporting MPSSE within this library when using FT4232H */
-		free(dev);
-		return NULL;
+		dev->write_rate = 1e6 * FTDI_BITBANG_RATE_MULTIPLIER;
 	} else {
 		/* set bitmode to mpsse */
-		if (ftdi_set_bitmode(ftdi, 0x00, BITMODE_MPSSE)) {
+		if (_usb_set_bitmode(dev, 0x00, BITMODE_MPSSE)) {
 			free(dev);
 			return NULL;
 		}
 		dev->state.mode = BITMODE_MPSSE;
+		dev->write_rate = MPSSE_WRITE_RATE;
 	}
 
 	return dev;
 }
 
+struct ftdi_bitbang_context *ftdi_bitbang_init(struct ftdi_context *ftdi, int mode, int load_state)
+{
+	struct ftdi_bitbang_transport transport = {
+		.ctx = ftdi,
+		.type = ftdi->type,
+		.write = _ftdi_write,
+		.read = _ftdi_read,
+		.set_bitmode = _ftdi_set_bitmode,
+		.set_baudrate = _ftdi_set_baudrate,
+		.purge_rx = _ftdi_purge_rx,
+		.read_pins = _ftdi_read_pins,
+		.set_latency_timer = _ftdi_set_latency_timer,
+	};
+	return _init(ftdi, &transport, mode, load_state);
+}
+
+struct ftdi_bitbang_context *ftdi_bitbang_init_transport(const struct ftdi_bitbang_transport *transport, int mode, int load_state)
+{
+	return _init(NULL, transport, mode, load_state);
+}
+
 void ftdi_bitbang_free(struct ftdi_bitbang_context *dev)
 {
+	if (dev->buf_len > 0) {
+		_buffer_send(dev);
+	}
+	ftdi_bitbang_trace_stop(dev);
+	free(dev->buf);
+	free(dev->sched);
 	free(dev);
 }
 
+/* pins 8-15 are only available in MPSSE mode, FT4232H has no high byte pins at all */
+static inline int _has_high(struct ftdi_bitbang_context *dev)
+{
+	return dev->state.mode == BITMODE_MPSSE && dev->transport.type != TYPE_4232H;
+}
+
 int ftdi_bitbang_set_pin(struct ftdi_bitbang_context *dev, int bit, int value)
 {
-	/* if device is not in MPSSE mode, it only supports pins through 0-7 */
-	if (dev->state.mode != BITMODE_MPSSE && bit >= 8) {
+	if (bit >= 8 && !_has_high(dev)) {
 		return -1;
 	}
 	/* get which byte it is, higher or lower */
@@ -96,8 +312,7 @@ int ftdi_bitbang_set_pin(struct ftdi_bitbang_context *dev, int bit, int value)
 
 int ftdi_bitbang_set_io(struct ftdi_bitbang_context *dev, int bit, int io)
 {
-	/* if device is not in MPSSE mode, it only supports pins through 0-7 */
-	if (dev->state.mode != BITMODE_MPSSE && bit >= 8) {
+	if (bit >= 8 && !_has_high(dev)) {
 		return -1;
 	}
 	/* get which byte it is, higher or lower */
@@ -125,25 +340,31 @@ int ftdi_bitbang_write(struct ftdi_bitbang_context *dev)
 			buf[n++] = dev->state.l_io;
 			dev->state.l_changed = 0;
 		}
-		if (dev->state.h_changed) {
+		if (dev->state.h_changed && _has_high(dev)) {
 			buf[n++] = 0x82;
 			buf[n++] = dev->state.h_value;
 			buf[n++] = dev->state.h_io;
 			dev->state.h_changed = 0;
 		}
 		if (n > 0) {
-			return ftdi_write_data(dev->ftdi, buf, n) > 0 ? 0 : -1;
+			return _write(dev, buf, n, 1);
 		}
 		return 0;
 	} else if (dev->state.mode == BITMODE_BITBANG) {
 		if (!dev->state.l_changed) {
 			return 0;
 		}
-		/** @todo setting bitmode every time, should fix */
-		if (ftdi_set_bitmode(dev->ftdi, dev->state.l_io, BITMODE_BITBANG)) {
-			return -1;
+		/* directions can only be changed by setting bitmode, buffered data must be sent before it */
+		if (dev->l_io_applied != dev->state.l_io) {
+			if (_buffer_send(dev)) {
+				return -1;
+			}
+			if (_usb_set_bitmode(dev, dev->state.l_io, BITMODE_BITBANG)) {
+				return -1;
+			}
+			dev->l_io_applied = dev->state.l_io;
 		}
-		if (ftdi_write_data(dev->ftdi, &dev->state.l_value, 1) < 1) {
+		if (_write(dev, &dev->state.l_value, 1, 1)) {
 			return -1;
 		}
 		dev->state.l_changed = 0;
@@ -156,23 +377,29 @@ int ftdi_bitbang_write(struct ftdi_bitbang_context *dev)
 
 int ftdi_bitbang_read_low(struct ftdi_bitbang_context *dev)
 {
+	/* buffered writes must reach the device before reading */
+	if (_buffer_send(dev)) {
+		return -1;
+	}
 	if (dev->state.mode == BITMODE_MPSSE) {
 		uint8_t buf[1] = { 0x81 };
-		ftdi_usb_purge_rx_buffer(dev->ftdi);
-		if (ftdi_write_data(dev->ftdi, &buf[0], 1) != 1) {
+		_usb_purge_rx(dev);
+		if (_usb_write(dev, &buf[0], 1) != 1) {
 			return -1;
 		}
-		if (ftdi_read_data(dev->ftdi, &buf[0], 1) != 1) {
+		if (_usb_read(dev, &buf[0], 1) != 1) {
 			return -1;
 		}
 		return (int)buf[0];
 	} else if (dev->state.mode == BITMODE_BITBANG) {
-		/** @todo setting bitmode every time, should fix */
-		if (ftdi_set_bitmode(dev->ftdi, dev->state.l_io, BITMODE_BITBANG)) {
-			return -1;
+		if (dev->l_io_applied != dev->state.l_io) {
+			if (_usb_set_bitmode(dev, dev->state.l_io, BITMODE_BITBANG)) {
+				return -1;
+			}
+			dev->l_io_applied = dev->state.l_io;
 		}
 		uint8_t pins;
-		if (ftdi_read_pins(dev->ftdi, &pins)) {
+		if (_usb_read_pins(dev, &pins)) {
 			return -1;
 		}
 		return pins;
@@ -183,17 +410,19 @@ int ftdi_bitbang_read_low(struct ftdi_bitbang_context *dev)
 
 int ftdi_bitbang_read_high(struct ftdi_bitbang_context *dev)
 {
-	/* if device is not in MPSSE mode, it only supports pins through 0-7 */
-	if (dev->state.mode != BITMODE_MPSSE) {
+	if (!_has_high(dev)) {
 		return -1;
 	}
 
+	if (_buffer_send(dev)) {
+		return -1;
+	}
 	uint8_t buf[1] = { 0x83 };
-	ftdi_usb_purge_rx_buffer(dev->ftdi);
-	if (ftdi_write_data(dev->ftdi, &buf[0], 1) != 1) {
+	_usb_purge_rx(dev);
+	if (_usb_write(dev, &buf[0], 1) != 1) {
 		return -1;
 	}
-	if (ftdi_read_data(dev->ftdi, &buf[0], 1) != 1) {
+	if (_usb_read(dev, &buf[0], 1) != 1) {
 		return -1;
 	}
 	return (int)buf[0];
@@ -203,8 +432,7 @@ int ftdi_bitbang_read(struct ftdi_bitbang_context *dev)
 {
 	int h = 0, l = 0;
 	l = ftdi_bitbang_read_low(dev);
-	/* if device is not in MPSSE mode, it only supports pins through 0-7 */
-	if (dev->state.mode == BITMODE_MPSSE) {
+	if (_has_high(dev)) {
 		h = ftdi_bitbang_read_high(dev);
 	}
 	if (l < 0 || h < 0) {
@@ -215,24 +443,376 @@ int ftdi_bitbang_read(struct ftdi_bitbang_context *dev)
 
 int ftdi_bitbang_read_pin(struct ftdi_bitbang_context *dev, uint8_t pin)
 {
-	if (pin <= 7 && pin >= 0) {
-		return (ftdi_bitbang_read_low(dev) & (1 << pin)) ? 1 : 0;
-	} else if (pin >= 8 && pin <= 15) {
-		/* if device is not in MPSSE mode, it only supports pins through 0-7 */
-		if (dev->state.mode != BITMODE_MPSSE) {
+	int value;
+	if (pin <= 7) {
+		value = ftdi_bitbang_read_low(dev);
+	} else if (pin <= 15 && _has_high(dev)) {
+		value = ftdi_bitbang_read_high(dev);
+	} else {
+		return -1;
+	}
+	if (value < 0) {
+		return -1;
+	}
+	return (value & (1 << (pin & 7))) ? 1 : 0;
+}
+
+int ftdi_bitbang_mpsse_write(struct ftdi_bitbang_context *dev, const uint8_t *cmd, size_t size)
+{
+	if (dev->state.mode != BITMODE_MPSSE) {
+		return -1;
+	}
+	if (ftdi_bitbang_write(dev) < 0) {
+		return -1;
+	}
+	if (_write(dev, (uint8_t *)cmd, size, 1)) {
+		return -1;
+	}
+	/* clock and data pins are left in whatever state commands left them */
+	dev->state.l_changed = 0xff;
+	return 0;
+}
+
+int ftdi_bitbang_mpsse_read(struct ftdi_bitbang_context *dev, uint8_t *data, size_t size)
+{
+	uint8_t flush = 0x87;
+	size_t i = 0;
+	double timeout;
+
+	if (dev->state.mode != BITMODE_MPSSE) {
+		return -1;
+	}
+	if (_write(dev, &flush, 1, 1) || _buffer_send(dev)) {
+		return -1;
+	}
+	timeout = _os_time() + MPSSE_READ_TIMEOUT;
+	while (i < size) {
+		int n = _usb_read(dev, data + i, size - i);
+		/* drop rest of response so it is not read as response of next commands */
+		if (n < 0 || (n == 0 && _os_time() > timeout)) {
+			_usb_purge_rx(dev);
+			return -1;
+		}
+		i += n;
+	}
+
+	return 0;
+}
+
+int ftdi_bitbang_buffer_start(struct ftdi_bitbang_context *dev)
+{
+	double now = _os_time();
+	if (dev->buf_depth == 0 && dev->buf_time < now) {
+		dev->buf_time = now;
+	}
+	dev->buf_depth++;
+	return 0;
+}
+
+int ftdi_bitbang_buffer_flush(struct ftdi_bitbang_context *dev)
+{
+	if (dev->buf_depth < 1) {
+		return -1;
+	}
+	dev->buf_depth--;
+	if (dev->buf_depth > 0) {
+		return 0;
+	}
+	return _buffer_send(dev);
+}
+
+int ftdi_bitbang_delay(struct ftdi_bitbang_context *dev, double t)
+{
+	if (t <= 0) {
+		return 0;
+	}
+	if (dev->buf_depth < 1) {
+		_os_sleep(t);
+		return 0;
+	}
+	/* pending changes must be in the stream before delay */
+	if (ftdi_bitbang_write(dev)) {
+		return -1;
+	}
+	if (t > DELAY_PAD_MAX) {
+		/* send what is buffered and sleep until device should have clocked it out and delay is over */
+		if (_buffer_send(dev)) {
 			return -1;
 		}
-		return (ftdi_bitbang_read_high(dev) & (1 << (pin - 8))) ? 1 : 0;
+		_os_sleep(dev->buf_time + t - _os_time());
+		dev->buf_time = _os_time();
+		return 0;
+	}
+	size_t n = (size_t)ceil(t * dev->write_rate);
+	if (dev->state.mode == BITMODE_MPSSE) {
+		uint8_t buf[3] = { 0x80, dev->state.l_value, dev->state.l_io };
+		return _write(dev, buf, 3, (n + 2) / 3);
+	} else if (dev->state.mode == BITMODE_BITBANG) {
+		return _write(dev, &dev->state.l_value, 1, n);
 	}
 	return -1;
 }
 
+double ftdi_bitbang_time(struct ftdi_bitbang_context *dev)
+{
+	double now = _os_time();
+	if (dev->buf_depth > 0 || dev->buf_time > now) {
+		return dev->buf_time;
+	}
+	return now;
+}
+
+/* heap order: earlier time first, same time in scheduling order */
+static inline int _event_before(struct ftdi_bitbang_event *a, struct ftdi_bitbang_event *b)
+{
+	return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+/* remove first event from heap */
+static void _sched_pop(struct ftdi_bitbang_context *dev)
+{
+	struct ftdi_bitbang_event *h = dev->sched;
+	size_t i = 0;
+	if (dev->sched_len < 1) {
+		return;
+	}
+	h[0] = h[--dev->sched_len];
+	for ( ; ; ) {
+		size_t l = i * 2 + 1, r = l + 1, m = i;
+		if (l < dev->sched_len && _event_before(&h[l], &h[m])) {
+			m = l;
+		}
+		if (r < dev->sched_len && _event_before(&h[r], &h[m])) {
+			m = r;
+		}
+		if (m == i) {
+			break;
+		}
+		struct ftdi_bitbang_event e = h[i];
+		h[i] = h[m];
+		h[m] = e;
+		i = m;
+	}
+}
+
+int ftdi_bitbang_schedule(struct ftdi_bitbang_context *dev, double t, int bit, int value)
+{
+	struct ftdi_bitbang_event *h;
+	size_t i;
+
+	if (bit < 0 || bit > 15 || (bit >= 8 && !_has_high(dev))) {
+		return -1;
+	}
+	if (dev->sched_len >= dev->sched_size) {
+		size_t size = dev->sched_size > 0 ? dev->sched_size * 2 : 64;
+		h = realloc(dev->sched, size * sizeof(*h));
+		if (!h) {
+			return -1;
+		}
+		dev->sched = h;
+		dev->sched_size = size;
+	}
+
+	/* append and sift up */
+	h = dev->sched;
+	i = dev->sched_len++;
+	h[i].t = t;
+	h[i].seq = dev->sched_seq++;
+	h[i].bit = bit;
+	h[i].value = value ? 1 : 0;
+	while (i > 0 && _event_before(&h[i], &h[(i - 1) / 2])) {
+		struct ftdi_bitbang_event e = h[i];
+		h[i] = h[(i - 1) / 2];
+		h[(i - 1) / 2] = e;
+		i = (i - 1) / 2;
+	}
+
+	return 0;
+}
+
+int ftdi_bitbang_schedule_in(struct ftdi_bitbang_context *dev, double dt, int bit, int value)
+{
+	return ftdi_bitbang_schedule(dev, ftdi_bitbang_time(dev) + dt, bit, value);
+}
+
+int ftdi_bitbang_schedule_run(struct ftdi_bitbang_context *dev, double until)
+{
+	int n = 0, err = 0;
+
+	if (dev->sched_len < 1 || dev->sched[0].t > until) {
+		return 0;
+	}
+	ftdi_bitbang_buffer_start(dev);
+	while (dev->sched_len > 0 && dev->sched[0].t <= until && !err) {
+		double t = dev->sched[0].t;
+		/* pad output until change is due, every change at this time goes into same output state */
+		err = ftdi_bitbang_delay(dev, t - ftdi_bitbang_time(dev));
+		while (!err && dev->sched_len > 0 && dev->sched[0].t == t) {
+			err = ftdi_bitbang_set_pin(dev, dev->sched[0].bit, dev->sched[0].value);
+			_sched_pop(dev);
+			n++;
+		}
+		err = err ? err : ftdi_bitbang_write(dev);
+	}
+	err = ftdi_bitbang_buffer_flush(dev) ? -1 : err;
+
+	return err ? -1 : n;
+}
+
+double ftdi_bitbang_schedule_next(struct ftdi_bitbang_context *dev)
+{
+	return dev->sched_len > 0 ? dev->sched[0].t : -1.0;
+}
+
+void ftdi_bitbang_schedule_clear(struct ftdi_bitbang_context *dev)
+{
+	dev->sched_len = 0;
+}
+
+int ftdi_bitbang_trace_start(struct ftdi_bitbang_context *dev, const char *filename)
+{
+	struct ftdi_trace_header header;
+
+	ftdi_bitbang_trace_stop(dev);
+	memset(&header, 0, sizeof(header));
+	header.mode = dev->state.mode;
+	header.type = dev->transport.type;
+	header.l_value = dev->state.l_value;
+	header.l_io = dev->state.l_io;
+	header.h_value = dev->state.h_value;
+	header.h_io = dev->state.h_io;
+	dev->trace = ftdi_trace_create(filename, &header, _os_time());
+	dev->trace_error = 0;
+
+	return dev->trace ? 0 : -1;
+}
+
+int ftdi_bitbang_trace_stop(struct ftdi_bitbang_context *dev)
+{
+	int err = dev->trace_error ? -1 : 0;
+	if (dev->trace) {
+		err = ftdi_trace_close(dev->trace) ? -1 : err;
+		dev->trace = NULL;
+	}
+	dev->trace_error = 0;
+	return err;
+}
+
+int ftdi_bitbang_trace_replay(struct ftdi_bitbang_context *dev, const struct ftdi_trace_record *record, uint8_t *data)
+{
+	const uint8_t *args = record->data;
+
+	/* failed operations did not reach the device */
+	if (record->error) {
+		return 0;
+	}
+
+	switch (record->op) {
+	case FTDI_BITBANG_OP_WRITE:
+		return _usb_write(dev, args, record->size) == (int)record->size ? 0 : -1;
+	case FTDI_BITBANG_OP_READ:
+		return _usb_read(dev, data, record->size);
+	case FTDI_BITBANG_OP_SET_BITMODE:
+		return record->size == 2 && !_usb_set_bitmode(dev, args[0], args[1]) ? 0 : -1;
+	case FTDI_BITBANG_OP_BAUDRATE:
+		if (record->size != 4) {
+			return -1;
+		}
+		return _usb_set_baudrate(dev, args[0] | (args[1] << 8) | (args[2] << 16) | (args[3] << 24)) ? -1 : 0;
+	case FTDI_BITBANG_OP_PURGE:
+		return _usb_purge_rx(dev) ? -1 : 0;
+	case FTDI_BITBANG_OP_READ_PINS:
+		return record->size == 1 && !_usb_read_pins(dev, data) ? 1 : -1;
+	case FTDI_BITBANG_OP_LATENCY_TIMER:
+		if (record->size != 1 || !dev->transport.set_latency_timer) {
+			return -1;
+		}
+		return _usb_set_latency_timer(dev, args[0]) ? -1 : 0;
+	}
+
+	return 0;
+}
+
+void ftdi_bitbang_stats_get(struct ftdi_bitbang_context *dev, struct ftdi_bitbang_stats *stats)
+{
+	memcpy(stats, &dev->stats, sizeof(*stats));
+}
+
+void ftdi_bitbang_stats_reset(struct ftdi_bitbang_context *dev)
+{
+	memset(&dev->stats, 0, sizeof(dev->stats));
+}
+
+void ftdi_bitbang_stats_add(struct ftdi_bitbang_stats *stats, int op, size_t bytes, double t, int error)
+{
+	struct ftdi_bitbang_op_stats *s;
+	uint64_t ns;
+	int b;
+
+	if (op < 0 || op >= FTDI_BITBANG_OP_COUNT) {
+		return;
+	}
+	s = &stats->ops[op];
+	s->count++;
+	s->errors += error ? 1 : 0;
+	s->bytes += bytes;
+	s->time += t;
+	s->time_max = t > s->time_max ? t : s->time_max;
+	/* log2 of nanoseconds */
+	ns = t > 0 ? (uint64_t)(t * 1e9) : 0;
+	for (b = 0; ns > 1 && b < FTDI_BITBANG_HISTOGRAM_SIZE - 1; ns >>= 1, b++);
+	s->histogram[b]++;
+}
+
+double ftdi_bitbang_stats_percentile(const struct ftdi_bitbang_op_stats *op, double p)
+{
+	double target, n = 0, lo, hi, t;
+	int b;
+
+	if (op->count < 1) {
+		return 0.0;
+	}
+	target = (double)op->count * p / 100.0;
+	for (b = 0; b < FTDI_BITBANG_HISTOGRAM_SIZE - 1; b++) {
+		if (n + (double)op->histogram[b] >= target) {
+			break;
+		}
+		n += (double)op->histogram[b];
+	}
+	/* linear inside bucket, never more than measured maximum */
+	lo = b > 0 ? (double)(1ULL << b) / 1e9 : 0.0;
+	hi = (double)(2ULL << b) / 1e9;
+	t = op->histogram[b] > 0 ? lo + (hi - lo) * (target - n) / (double)op->histogram[b] : hi;
+	return t < op->time_max ? t : op->time_max;
+}
+
+const char *ftdi_bitbang_stats_op_name(int op)
+{
+	static const char *names[FTDI_BITBANG_OP_COUNT] = {
+		"write", "read", "set_bitmode", "baudrate", "purge", "read_pins", "modem_status", "eeprom", "latency_timer",
+	};
+	return op >= 0 && op < FTDI_BITBANG_OP_COUNT ? names[op] : "unknown";
+}
+
+int ftdi_bitbang_set_latency_timer(struct ftdi_bitbang_context *dev, int ms)
+{
+	if (!dev->transport.set_latency_timer || ms < 1 || ms > 255) {
+		return -1;
+	}
+	return _usb_set_latency_timer(dev, ms) ? -1 : 0;
+}
+
 static char *_generate_state_filename(struct ftdi_bitbang_context *dev)
 {
 	int i;
 	char *state_filename = NULL;
 	uint8_t bus, addr, port;
-	libusb_device *usb_dev = libusb_get_device(dev->ftdi->usb_dev);
+	libusb_device *usb_dev;
+	/* state is kept only for real devices, other transports can not be told apart */
+	if (!dev->ftdi) {
+		return NULL;
+	}
+	usb_dev = libusb_get_device(dev->ftdi->usb_dev);
 	/* create unique device filename */
 	bus = libusb_get_bus_number(usb_dev);
 	addr = libusb_get_device_address(usb_dev);
@@ -10,6 +10,10 @@
 
 #include <stdlib.h>
 #include <libftdi1/ftdi.h>
+#include "ftdi-trace.h"
+
+/* in bitbang mode pins are written and sampled at this multiple of baud rate */
+#define FTDI_BITBANG_RATE_MULTIPLIER    20
 
 struct ftdi_bitbang_state {
 	uint8_t l_value;
@@ -21,12 +25,106 @@ struct ftdi_bitbang_state {
 	/* BITMODE_BITBANG or BITMODE_MPSSE */
 	int mode;
 };
+/* usb operation types for statistics */
+enum {
+	FTDI_BITBANG_OP_WRITE = 0,
+	FTDI_BITBANG_OP_READ,
+	FTDI_BITBANG_OP_SET_BITMODE,
+	FTDI_BITBANG_OP_BAUDRATE,
+	FTDI_BITBANG_OP_PURGE,
+	FTDI_BITBANG_OP_READ_PINS,
+	FTDI_BITBANG_OP_MODEM_STATUS,
+	FTDI_BITBANG_OP_EEPROM,
+	FTDI_BITBANG_OP_LATENCY_TIMER,
+	FTDI_BITBANG_OP_COUNT,
+};
+
+/* latency histogram bucket n counts operations that took 2^n to 2^(n+1) nanoseconds, last bucket includes longer */
+#define FTDI_BITBANG_HISTOGRAM_SIZE     34
+
+struct ftdi_bitbang_op_stats {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t bytes;
+	/* total and longest time in seconds */
+	double time;
+	double time_max;
+	uint64_t histogram[FTDI_BITBANG_HISTOGRAM_SIZE];
+};
+
+struct ftdi_bitbang_stats {
+	struct ftdi_bitbang_op_stats ops[FTDI_BITBANG_OP_COUNT];
+};
+
+/* pin change scheduled with ftdi_bitbang_schedule() */
+struct ftdi_bitbang_event {
+	/* CLOCK_MONOTONIC seconds */
+	double t;
+	/* order of scheduling, events with same time are applied in this order */
+	uint64_t seq;
+	int bit;
+	int value;
+};
+
+/*
+ * Device access under bitbang context. ftdi_bitbang_init() uses libftdi,
+ * other transports (like emulated device in ftdi-emu.h) are given to
+ * ftdi_bitbang_init_transport(). Functions return like their libftdi
+ * counterparts.
+ */
+struct ftdi_bitbang_transport {
+	void *ctx;
+	/* chip type, TYPE_* from libftdi */
+	int type;
+	int (*write)(void *ctx, const uint8_t *data, size_t size);
+	int (*read)(void *ctx, uint8_t *data, size_t size);
+	int (*set_bitmode)(void *ctx, uint8_t io, uint8_t mode);
+	int (*set_baudrate)(void *ctx, int baudrate);
+	int (*purge_rx)(void *ctx);
+	int (*read_pins)(void *ctx, uint8_t *pins);
+	/* optional, NULL if transport has no latency timer */
+	int (*set_latency_timer)(void *ctx, int ms);
+};
+
 struct ftdi_bitbang_context {
+	/* libftdi context, NULL when other transport is used */
 	struct ftdi_context *ftdi;
+	struct ftdi_bitbang_transport transport;
 	struct ftdi_bitbang_state state;
+	/* io mask last set using ftdi_set_bitmode() in bitbang mode, -1 if unknown */
+	int l_io_applied;
+	/* write buffering, see ftdi_bitbang_buffer_start() */
+	int buf_depth;
+	uint8_t *buf;
+	size_t buf_len;
+	size_t buf_size;
+	/* estimated time when device has clocked out everything written so far */
+	double buf_time;
+	/* estimated maximum rate (bytes per second) at which device clocks out written data */
+	double write_rate;
+	/* scheduled pin changes as binary min-heap by time */
+	struct ftdi_bitbang_event *sched;
+	size_t sched_len;
+	size_t sched_size;
+	uint64_t sched_seq;
+	/* usb operation counters, see ftdi_bitbang_stats_get() */
+	struct ftdi_bitbang_stats stats;
+	/* usb operation trace, see ftdi_bitbang_trace_start() */
+	struct ftdi_trace *trace;
+	int trace_error;
 };
 
 struct ftdi_bitbang_context *ftdi_bitbang_init(struct ftdi_context *ftdi, int mode, int load_state);
+
+/**
+ * Initialize bitbang context using given transport instead of libftdi.
+ *
+ * @param  transport  transport, copied into context
+ * @param  mode       BITMODE_BITBANG, BITMODE_MPSSE or BITMODE_RESET to use saved mode
+ * @param  load_state load saved state, ignored since state is saved only for libftdi devices
+ * @return            context or NULL on errors
+ */
+struct ftdi_bitbang_context *ftdi_bitbang_init_transport(const struct ftdi_bitbang_transport *transport, int mode, int load_state);
 void ftdi_bitbang_free(struct ftdi_bitbang_context *dev);
 
 int ftdi_bitbang_set_pin(struct ftdi_bitbang_context *dev, int bit, int value);
@@ -38,6 +136,210 @@ int ftdi_bitbang_read_high(struct ftdi_bitbang_context *dev);
 int ftdi_bitbang_read(struct ftdi_bitbang_context *dev);
 int ftdi_bitbang_read_pin(struct ftdi_bitbang_context *dev, uint8_t pin);
 
+/**
+ * Write raw MPSSE commands into output stream, only in MPSSE mode. Pending
+ * pin changes are written before commands and commands go through the same
+ * buffering as pin changes. Low pins are written again on next
+ * ftdi_bitbang_write() since clocked commands change them.
+ *
+ * @param  dev        bitbang context
+ * @param  cmd        commands
+ * @param  size       size of commands
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_mpsse_write(struct ftdi_bitbang_context *dev, const uint8_t *cmd, size_t size);
+
+/**
+ * Read response of MPSSE commands written with ftdi_bitbang_mpsse_write().
+ * Everything buffered so far is sent first followed by send immediate, so
+ * response is not held back by latency timer. Buffering is not ended.
+ * On errors receive buffer is purged so no stale response is left.
+ *
+ * @param  dev        bitbang context
+ * @param  data       response is read here
+ * @param  size       number of bytes to read
+ * @return            0 when all bytes were read or -1 on errors and timeout
+ */
+int ftdi_bitbang_mpsse_read(struct ftdi_bitbang_context *dev, uint8_t *data, size_t size);
+
+/**
+ * Start buffering writes. Everything written after this is collected into
+ * memory and sent as one transfer when ftdi_bitbang_buffer_flush() is called.
+ * Calls can be nested, data is sent when the outermost buffering ends.
+ *
+ * @param  dev        bitbang context
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_buffer_start(struct ftdi_bitbang_context *dev);
+
+/**
+ * End buffering started with ftdi_bitbang_buffer_start() and send buffered data.
+ *
+ * @param  dev        bitbang context
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_buffer_flush(struct ftdi_bitbang_context *dev);
+
+/**
+ * Delay for given time. When buffering, delay is made by repeating current
+ * pin state in the output stream, otherwise this sleeps.
+ *
+ * @param  dev        bitbang context
+ * @param  t          time in seconds
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_delay(struct ftdi_bitbang_context *dev, double t);
+
+/**
+ * Get estimated time (CLOCK_MONOTONIC seconds) at which device will have
+ * clocked out all data written so far, including buffered data.
+ *
+ * @param  dev        bitbang context
+ * @return            time in seconds
+ */
+double ftdi_bitbang_time(struct ftdi_bitbang_context *dev);
+
+/**
+ * Schedule pin change at absolute time. Changes can be scheduled in any
+ * order and from several independent producers, they are kept in a heap
+ * and applied by ftdi_bitbang_schedule_run(). Not thread safe.
+ *
+ * @param  dev        bitbang context
+ * @param  t          time in seconds, same clock as ftdi_bitbang_time()
+ * @param  bit        pin
+ * @param  value      pin value, 0 or 1
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_schedule(struct ftdi_bitbang_context *dev, double t, int bit, int value);
+
+/**
+ * Schedule pin change relative to the time when device will have clocked
+ * out everything written so far, see ftdi_bitbang_time().
+ *
+ * @param  dev        bitbang context
+ * @param  dt         time from now in seconds
+ * @param  bit        pin
+ * @param  value      pin value, 0 or 1
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_schedule_in(struct ftdi_bitbang_context *dev, double dt, int bit, int value);
+
+/**
+ * Apply all scheduled changes due at or before given time. All changes of
+ * one call are merged into one buffered write: changes with same time
+ * become one output state and time between them is padded in the output
+ * stream (gaps longer than what ftdi_bitbang_delay() pads are slept).
+ * Changes already late are applied immediately.
+ *
+ * @param  dev        bitbang context
+ * @param  until      apply changes scheduled up to this time
+ * @return            number of changes applied or -1 on errors
+ */
+int ftdi_bitbang_schedule_run(struct ftdi_bitbang_context *dev, double until);
+
+/**
+ * Get time of next scheduled change.
+ *
+ * @param  dev        bitbang context
+ * @return            time in seconds or -1 if nothing is scheduled
+ */
+double ftdi_bitbang_schedule_next(struct ftdi_bitbang_context *dev);
+
+/**
+ * Remove all scheduled changes.
+ *
+ * @param  dev        bitbang context
+ */
+void ftdi_bitbang_schedule_clear(struct ftdi_bitbang_context *dev);
+
+/**
+ * Get usb operation statistics: count, errors, bytes and latency histogram
+ * of each operation type made through this context.
+ *
+ * @param  dev        bitbang context
+ * @param  stats      statistics are copied here
+ */
+void ftdi_bitbang_stats_get(struct ftdi_bitbang_context *dev, struct ftdi_bitbang_stats *stats);
+
+/**
+ * Clear usb operation statistics.
+ *
+ * @param  dev        bitbang context
+ */
+void ftdi_bitbang_stats_reset(struct ftdi_bitbang_context *dev);
+
+/**
+ * Add one operation into statistics. Used internally, also usable for
+ * operations made outside of bitbang context.
+ *
+ * @param  stats      statistics
+ * @param  op         operation type, FTDI_BITBANG_OP_*
+ * @param  bytes      bytes transferred
+ * @param  t          time operation took in seconds
+ * @param  error      non-zero if operation failed
+ */
+void ftdi_bitbang_stats_add(struct ftdi_bitbang_stats *stats, int op, size_t bytes, double t, int error);
+
+/**
+ * Estimate latency percentile from histogram.
+ *
+ * @param  op         operation statistics
+ * @param  p          percentile between 0 and 100
+ * @return            latency in seconds, interpolated inside histogram bucket
+ */
+double ftdi_bitbang_stats_percentile(const struct ftdi_bitbang_op_stats *op, double p);
+
+/**
+ * Get name of operation type.
+ *
+ * @param  op         operation type, FTDI_BITBANG_OP_*
+ * @return            name
+ */
+const char *ftdi_bitbang_stats_op_name(int op);
+
+/**
+ * Start recording every usb operation made through this context into
+ * a binary trace file, see ftdi-trace.h for format. Trace is stopped
+ * when context is freed.
+ *
+ * @param  dev        bitbang context
+ * @param  filename   trace file to create
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_trace_start(struct ftdi_bitbang_context *dev, const char *filename);
+
+/**
+ * Stop recording trace and close trace file.
+ *
+ * @param  dev        bitbang context
+ * @return            0 on success or -1 if writing trace failed
+ */
+int ftdi_bitbang_trace_stop(struct ftdi_bitbang_context *dev);
+
+/**
+ * Run one recorded operation on device as is. Pin state of context is not
+ * used or updated, operation is only timed into statistics like others.
+ * Operations that failed when recorded are skipped.
+ *
+ * @param  dev        bitbang context
+ * @param  record     trace record
+ * @param  data       read data and pins are written here, at least record size bytes
+ * @return            bytes read (can be less than recorded) for reads and pin reads,
+ *                    0 for other operations or -1 on errors
+ */
+int ftdi_bitbang_trace_replay(struct ftdi_bitbang_context *dev, const struct ftdi_trace_record *record, uint8_t *data);
+
+/**
+ * Set latency timer of device. Device sends data shorter than usb packet
+ * to host only after this time has passed from the last byte unless
+ * flushed, so it bounds latency of reads.
+ *
+ * @param  dev        bitbang context
+ * @param  ms         latency in milliseconds, 1-255
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_bitbang_set_latency_timer(struct ftdi_bitbang_context *dev, int ms);
+
 int ftdi_bitbang_load_state(struct ftdi_bitbang_context *dev);
 int ftdi_bitbang_save_state(struct ftdi_bitbang_context *dev);
 
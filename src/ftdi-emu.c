@@ -0,0 +1,636 @@
+/*
+ * ftdi-bitbang
+ *
+ * In-process emulated FTDI device.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <libftdi1/ftdi.h>
+#include "ftdi-emu.h"
+
+/* answer of MPSSE to unknown command, followed by the command */
+#define MPSSE_BAD_COMMAND           0xfa
+/* time MPSSE engine takes to handle one command byte */
+#define MPSSE_BYTE_TIME             (1.0 / 30e6)
+/* status bytes in start of each usb packet from device */
+#define STATUS_SIZE                 2
+
+static double _os_time()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (double)tp.tv_sec + (double)tp.tv_nsec / 1e9;
+}
+
+static void _os_sleep_until(double t)
+{
+	struct timespec tp;
+	double integral;
+	tp.tv_nsec = (long)(modf(t, &integral) * 1e9);
+	tp.tv_sec = (time_t)integral;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
+}
+
+static inline int _is_hispeed(int type)
+{
+	return type == TYPE_2232H || type == TYPE_4232H || type == TYPE_232H;
+}
+
+/* idle time passes in realtime mode */
+static void _host_begin(struct ftdi_emu *emu)
+{
+	if (emu->realtime) {
+		double now = _os_time() - emu->t_start;
+		emu->t_host = now > emu->t_host ? now : emu->t_host;
+	}
+}
+
+/* in realtime mode return only when operation would have finished */
+static void _host_end(struct ftdi_emu *emu)
+{
+	if (emu->realtime) {
+		_os_sleep_until(emu->t_start + emu->t_host);
+	}
+}
+
+/* device does not start before host operation has reached it */
+static void _device_sync(struct ftdi_emu *emu, double t)
+{
+	emu->t = t > emu->t ? t : emu->t;
+}
+
+static int _rx_push(struct ftdi_emu *emu, const uint8_t *data, size_t size)
+{
+	if (emu->rx_len + size > emu->rx_size) {
+		size_t rx_size = emu->rx_size > 0 ? emu->rx_size : 4096;
+		while (rx_size < emu->rx_len + size) {
+			rx_size *= 2;
+		}
+		uint8_t *rx = realloc(emu->rx, rx_size);
+		if (!rx) {
+			return -1;
+		}
+		emu->rx = rx;
+		emu->rx_size = rx_size;
+	}
+	if (data) {
+		memcpy(emu->rx + emu->rx_len, data, size);
+	} else {
+		memset(emu->rx + emu->rx_len, 0, size);
+	}
+	emu->rx_len += size;
+	emu->t_rx = emu->t;
+	if (emu->rx_len > emu->rx_fifo_size) {
+		emu->rx_stalls += size;
+	}
+	return 0;
+}
+
+/* resolve pin levels from device outputs, outside levels, peripherals and connections */
+static void _pins_resolve(struct ftdi_emu *emu)
+{
+	uint16_t io = emu->l_io | ((uint16_t)emu->h_io << 8);
+	uint16_t value = emu->l_value | ((uint16_t)emu->h_value << 8);
+	uint16_t level = (value | ~io) & emu->input;
+	int i;
+
+	for (i = 0; i < emu->peripheral_count; i++) {
+		level &= emu->peripherals[i].drive;
+	}
+	for (i = 0; i < emu->connection_count; i++) {
+		uint16_t m = emu->connections[i];
+		level &= (level & m) == m ? 0xffff : ~m;
+	}
+	/* internal loopback feeds data out straight to data in */
+	if (emu->loopback) {
+		level = (level & ~0x04) | ((level & 0x02) << 1);
+	}
+	emu->pins = level;
+}
+
+static void _pins_changed(struct ftdi_emu *emu)
+{
+	uint16_t was = emu->pins;
+	int n, i;
+
+	_pins_resolve(emu);
+	if (emu->pins == was) {
+		return;
+	}
+	/* let peripherals react until they settle */
+	for (n = 0; n < 4; n++) {
+		int changed = 0;
+		for (i = 0; i < emu->peripheral_count; i++) {
+			struct ftdi_emu_peripheral *p = &emu->peripherals[i];
+			uint16_t drive = p->cb(p->ctx, emu->t, emu->pins);
+			changed |= drive != p->drive;
+			p->drive = drive;
+		}
+		if (!changed) {
+			break;
+		}
+		_pins_resolve(emu);
+	}
+}
+
+static double _bit_time(struct ftdi_emu *emu)
+{
+	double base = (_is_hispeed(emu->type) && !emu->div5) ? 60e6 : 12e6;
+	double f = base / ((1.0 + emu->divisor) * 2.0);
+	return (emu->three_phase ? 1.5 : 1.0) / f;
+}
+
+/* clock bits with data out (or tms) and data in, returns bits read */
+static uint8_t _clock(struct ftdi_emu *emu, uint8_t op, uint8_t out, int bits)
+{
+	int lsb = op & 0x08, tms = op & 0x40, write = op & 0x10;
+	/* first edge is rising when clock idles low, data is read on rising edge unless bit 2 is set */
+	int read_first = !(emu->l_value & 0x01) == !(op & 0x04);
+	double half = _bit_time(emu) / 2.0;
+	uint8_t in = 0;
+	int i, bit;
+
+	for (i = 0; i < bits; i++) {
+		if (tms) {
+			/* tms bits from lsb, data out held at bit 7 */
+			emu->l_value = (emu->l_value & ~0x0a) | (((out >> i) & 1) ? 0x08 : 0) | ((out & 0x80) ? 0x02 : 0);
+			_pins_changed(emu);
+		} else if (write) {
+			bit = lsb ? (out >> i) & 1 : (out >> (7 - i)) & 1;
+			emu->l_value = (emu->l_value & ~0x02) | (bit ? 0x02 : 0);
+			_pins_changed(emu);
+		}
+		emu->l_value ^= 0x01;
+		emu->t += half;
+		_pins_changed(emu);
+		bit = (emu->pins >> 2) & 1;
+		emu->l_value ^= 0x01;
+		emu->t += half;
+		_pins_changed(emu);
+		if (!read_first) {
+			bit = (emu->pins >> 2) & 1;
+		}
+		in = lsb ? (in >> 1) | (bit << 7) : (in << 1) | bit;
+	}
+
+	return in;
+}
+
+/* clocked data commands: bit 4 write, bit 5 read, bit 6 tms, bit 1 bits instead of bytes */
+static inline int _is_data_cmd(uint8_t op)
+{
+	return op < 0x80 && (op & 0x70);
+}
+
+/* bit mode and tms commands have one byte length and at most one data byte */
+static inline int _is_bit_cmd(uint8_t op)
+{
+	return op & 0x42;
+}
+
+/* length of command without data bytes */
+static int _cmd_length(uint8_t op)
+{
+	if (_is_data_cmd(op)) {
+		return _is_bit_cmd(op) ? 2 : 3;
+	}
+	switch (op) {
+	case 0x80:
+	case 0x82:
+	case 0x86:
+	case 0x8f:
+	case 0x9c:
+	case 0x9d:
+	case 0x9e:
+		return 3;
+	case 0x8e:
+		return 2;
+	}
+	return 1;
+}
+
+/* data byte of clocked write command */
+static int _cmd_data(struct ftdi_emu *emu, uint8_t b)
+{
+	uint8_t op = emu->cmd[0];
+	int bits = _is_bit_cmd(op) ? emu->cmd[1] + 1 : 8;
+	uint8_t in = _clock(emu, op, b, bits > 8 ? 8 : bits);
+	emu->cmd_data--;
+	return (op & 0x20) ? _rx_push(emu, &in, 1) : 0;
+}
+
+static int _cmd_exec(struct ftdi_emu *emu)
+{
+	uint8_t op = emu->cmd[0], v;
+	size_t n;
+	int hs = _is_hispeed(emu->type);
+
+	if (_is_data_cmd(op)) {
+		if (op & 0x50) {
+			/* data bytes follow, clocked as they arrive */
+			emu->cmd_data = _is_bit_cmd(op) ? 1 : ((size_t)emu->cmd[1] | ((size_t)emu->cmd[2] << 8)) + 1;
+			return 0;
+		}
+		if (_is_bit_cmd(op)) {
+			v = _clock(emu, op, 0, emu->cmd[1] > 7 ? 8 : emu->cmd[1] + 1);
+			return _rx_push(emu, &v, 1);
+		}
+		n = ((size_t)emu->cmd[1] | ((size_t)emu->cmd[2] << 8)) + 1;
+		for ( ; n > 0; n--) {
+			v = _clock(emu, op, 0, 8);
+			if (_rx_push(emu, &v, 1)) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	switch (op) {
+	case 0x80:
+		emu->l_value = emu->cmd[1];
+		emu->l_io = emu->cmd[2];
+		_pins_changed(emu);
+		return 0;
+	case 0x82:
+		emu->h_value = emu->cmd[1];
+		emu->h_io = emu->cmd[2];
+		_pins_changed(emu);
+		return 0;
+	case 0x81:
+		v = emu->pins & 0xff;
+		return _rx_push(emu, &v, 1);
+	case 0x83:
+		v = emu->pins >> 8;
+		return _rx_push(emu, &v, 1);
+	case 0x84:
+	case 0x85:
+		emu->loopback = op == 0x84;
+		_pins_changed(emu);
+		return 0;
+	case 0x86:
+		emu->divisor = emu->cmd[1] | (emu->cmd[2] << 8);
+		return 0;
+	case 0x87:
+		emu->rx_flush = 1;
+		return 0;
+	case 0x8e:
+		_clock(emu, 0, 0, emu->cmd[1] + 1);
+		return 0;
+	case 0x8f:
+	case 0x9c:
+	case 0x9d:
+		/* waiting for GPIOL1 is not modeled, always full count */
+		for (n = ((size_t)emu->cmd[1] | ((size_t)emu->cmd[2] << 8)) + 1; n > 0; n--) {
+			_clock(emu, 0, 0, 8);
+		}
+		return 0;
+	/* waits for GPIOL1 are satisfied immediately, adaptive clocking and drive zero are not modeled */
+	case 0x88:
+	case 0x89:
+	case 0x94:
+	case 0x95:
+	case 0x96:
+	case 0x97:
+	case 0x9e:
+		if (hs || op == 0x88 || op == 0x89) {
+			return 0;
+		}
+		break;
+	case 0x8a:
+	case 0x8b:
+		if (hs) {
+			emu->div5 = op == 0x8b;
+			return 0;
+		}
+		break;
+	case 0x8c:
+	case 0x8d:
+		if (hs) {
+			emu->three_phase = op == 0x8c;
+			return 0;
+		}
+		break;
+	}
+
+	emu->bad_commands++;
+	uint8_t bad[2] = { MPSSE_BAD_COMMAND, op };
+	return _rx_push(emu, bad, 2);
+}
+
+static int _write_byte(struct ftdi_emu *emu, uint8_t b)
+{
+	if (emu->mode != BITMODE_MPSSE) {
+		/* synchronous bitbang samples pins before each written byte is applied */
+		if (emu->mode == BITMODE_SYNCBB) {
+			uint8_t v = emu->pins & 0xff;
+			if (_rx_push(emu, &v, 1)) {
+				return -1;
+			}
+		}
+		emu->l_value = b;
+		_pins_changed(emu);
+		emu->t += 1.0 / ((double)emu->baudrate * FTDI_BITBANG_RATE_MULTIPLIER);
+		return 0;
+	}
+
+	emu->t += MPSSE_BYTE_TIME;
+	if (emu->cmd_data > 0) {
+		return _cmd_data(emu, b);
+	}
+	emu->cmd[emu->cmd_len++] = b;
+	if (emu->cmd_len < _cmd_length(emu->cmd[0])) {
+		return 0;
+	}
+	emu->cmd_len = 0;
+	return _cmd_exec(emu);
+}
+
+struct ftdi_emu *ftdi_emu_new(int type)
+{
+	struct ftdi_emu *emu = calloc(1, sizeof(*emu));
+	if (!emu) {
+		return NULL;
+	}
+	emu->type = type;
+	emu->mode = BITMODE_RESET;
+	emu->baudrate = 9600;
+	emu->input = 0xffff;
+	emu->latency_timer = 16;
+	emu->div5 = 1;
+
+	switch (type) {
+	case TYPE_2232H:
+		emu->tx_fifo_size = 4096;
+		emu->rx_fifo_size = 4096;
+		break;
+	case TYPE_4232H:
+		emu->tx_fifo_size = 2048;
+		emu->rx_fifo_size = 2048;
+		break;
+	case TYPE_232H:
+		emu->tx_fifo_size = 1024;
+		emu->rx_fifo_size = 1024;
+		break;
+	case TYPE_230X:
+		emu->tx_fifo_size = 512;
+		emu->rx_fifo_size = 512;
+		break;
+	case TYPE_R:
+		emu->tx_fifo_size = 256;
+		emu->rx_fifo_size = 128;
+		break;
+	default:
+		emu->tx_fifo_size = 384;
+		emu->rx_fifo_size = 128;
+		break;
+	}
+	/* high speed bulk transfers in 125 us microframes, full speed in 1 ms frames */
+	if (_is_hispeed(type)) {
+		emu->packet_size = 512;
+		emu->usb_latency = 125e-6;
+		emu->usb_rate = 40e6;
+	} else {
+		emu->packet_size = 64;
+		emu->usb_latency = 1e-3;
+		emu->usb_rate = 1e6;
+	}
+
+	_pins_resolve(emu);
+	return emu;
+}
+
+void ftdi_emu_free(struct ftdi_emu *emu)
+{
+	free(emu->rx);
+	free(emu);
+}
+
+static int _transport_write(void *ctx, const uint8_t *data, size_t size)
+{
+	return ftdi_emu_write(ctx, data, size);
+}
+
+static int _transport_read(void *ctx, uint8_t *data, size_t size)
+{
+	return ftdi_emu_read(ctx, data, size);
+}
+
+static int _transport_set_bitmode(void *ctx, uint8_t io, uint8_t mode)
+{
+	return ftdi_emu_set_bitmode(ctx, io, mode);
+}
+
+static int _transport_set_baudrate(void *ctx, int baudrate)
+{
+	return ftdi_emu_set_baudrate(ctx, baudrate);
+}
+
+static int _transport_purge_rx(void *ctx)
+{
+	return ftdi_emu_purge_rx(ctx);
+}
+
+static int _transport_read_pins(void *ctx, uint8_t *pins)
+{
+	return ftdi_emu_read_pins(ctx, pins);
+}
+
+static int _transport_set_latency_timer(void *ctx, int ms)
+{
+	return ftdi_emu_set_latency_timer(ctx, ms);
+}
+
+void ftdi_emu_transport(struct ftdi_emu *emu, struct ftdi_bitbang_transport *transport)
+{
+	memset(transport, 0, sizeof(*transport));
+	transport->ctx = emu;
+	transport->type = emu->type;
+	transport->write = _transport_write;
+	transport->read = _transport_read;
+	transport->set_bitmode = _transport_set_bitmode;
+	transport->set_baudrate = _transport_set_baudrate;
+	transport->purge_rx = _transport_purge_rx;
+	transport->read_pins = _transport_read_pins;
+	transport->set_latency_timer = _transport_set_latency_timer;
+}
+
+int ftdi_emu_connect(struct ftdi_emu *emu, int pin_a, int pin_b)
+{
+	if (emu->connection_count >= FTDI_EMU_CONNECTIONS_MAX || pin_a < 0 || pin_a > 15 || pin_b < 0 || pin_b > 15) {
+		return -1;
+	}
+	emu->connections[emu->connection_count++] = (1 << pin_a) | (1 << pin_b);
+	_pins_changed(emu);
+	return 0;
+}
+
+int ftdi_emu_peripheral(struct ftdi_emu *emu, ftdi_emu_peripheral_cb cb, void *ctx)
+{
+	struct ftdi_emu_peripheral *p;
+	if (emu->peripheral_count >= FTDI_EMU_PERIPHERALS_MAX) {
+		return -1;
+	}
+	p = &emu->peripherals[emu->peripheral_count++];
+	p->cb = cb;
+	p->ctx = ctx;
+	p->drive = cb(ctx, emu->t, emu->pins);
+	_pins_changed(emu);
+	return 0;
+}
+
+void ftdi_emu_set_input(struct ftdi_emu *emu, uint16_t mask, uint16_t levels)
+{
+	emu->input = (emu->input & ~mask) | (levels & mask);
+	_pins_changed(emu);
+}
+
+int ftdi_emu_set_latency_timer(struct ftdi_emu *emu, int ms)
+{
+	if (ms < 1 || ms > 255) {
+		return -1;
+	}
+	_host_begin(emu);
+	emu->latency_timer = ms;
+	emu->t_host += emu->usb_latency;
+	_host_end(emu);
+	return 0;
+}
+
+void ftdi_emu_set_realtime(struct ftdi_emu *emu, int realtime)
+{
+	emu->realtime = realtime;
+	emu->t_start = _os_time() - emu->t_host;
+}
+
+double ftdi_emu_time(struct ftdi_emu *emu)
+{
+	return emu->t_host;
+}
+
+int ftdi_emu_set_bitmode(struct ftdi_emu *emu, uint8_t io, uint8_t mode)
+{
+	switch (mode) {
+	case BITMODE_RESET:
+	case BITMODE_BITBANG:
+	case BITMODE_SYNCBB:
+		emu->l_io = mode == BITMODE_RESET ? 0x00 : io;
+		emu->h_io = 0x00;
+		break;
+	case BITMODE_MPSSE:
+		if (!_is_hispeed(emu->type) && emu->type != TYPE_2232C) {
+			return -1;
+		}
+		/* all pins are inputs until set with 0x80 and 0x82, clock from reset */
+		emu->l_io = 0x00;
+		emu->h_io = 0x00;
+		emu->div5 = 1;
+		emu->divisor = 0;
+		emu->three_phase = 0;
+		emu->loopback = 0;
+		break;
+	default:
+		return -1;
+	}
+	_host_begin(emu);
+	emu->t_host += emu->usb_latency;
+	_device_sync(emu, emu->t_host);
+	emu->mode = mode;
+	emu->cmd_len = 0;
+	emu->cmd_data = 0;
+	_pins_changed(emu);
+	_host_end(emu);
+	return 0;
+}
+
+int ftdi_emu_set_baudrate(struct ftdi_emu *emu, int baudrate)
+{
+	if (baudrate <= 0) {
+		return -1;
+	}
+	_host_begin(emu);
+	emu->baudrate = baudrate;
+	emu->t_host += emu->usb_latency;
+	_host_end(emu);
+	return 0;
+}
+
+int ftdi_emu_write(struct ftdi_emu *emu, const uint8_t *data, size_t size)
+{
+	size_t i, accept = size > emu->tx_fifo_size ? size - emu->tx_fifo_size : 0;
+	double t_arrive, t_accept;
+
+	_host_begin(emu);
+	t_arrive = emu->t_host + emu->usb_latency;
+	_device_sync(emu, t_arrive);
+	t_accept = emu->t;
+
+	emu->bytes_in += size;
+	for (i = 0; i < size; i++) {
+		/* host write finishes when rest of data fits into transmit fifo */
+		if (i == accept) {
+			t_accept = emu->t;
+		}
+		if (_write_byte(emu, data[i])) {
+			return -1;
+		}
+	}
+
+	t_arrive += (double)size / emu->usb_rate;
+	emu->t_host = t_arrive > t_accept ? t_arrive : t_accept;
+	_host_end(emu);
+
+	return (int)size;
+}
+
+int ftdi_emu_read(struct ftdi_emu *emu, uint8_t *data, size_t size)
+{
+	double ready = emu->t_rx;
+
+	_host_begin(emu);
+	size = size < emu->rx_len ? size : emu->rx_len;
+	/* partial packet is sent when latency timer expires unless flushed */
+	if (size > 0 && !emu->rx_flush && emu->rx_len < emu->packet_size - STATUS_SIZE) {
+		ready += (double)emu->latency_timer / 1e3;
+	}
+	if (size > 0 && ready > emu->t_host) {
+		emu->t_host = ready;
+	}
+	emu->t_host += emu->usb_latency + (double)size / emu->usb_rate;
+
+	memcpy(data, emu->rx, size);
+	memmove(emu->rx, emu->rx + size, emu->rx_len - size);
+	emu->rx_len -= size;
+	emu->rx_flush = emu->rx_len > 0 ? emu->rx_flush : 0;
+	emu->bytes_out += size;
+	_host_end(emu);
+
+	return (int)size;
+}
+
+int ftdi_emu_purge_rx(struct ftdi_emu *emu)
+{
+	_host_begin(emu);
+	emu->rx_len = 0;
+	emu->rx_flush = 0;
+	emu->t_host += emu->usb_latency;
+	_host_end(emu);
+	return 0;
+}
+
+int ftdi_emu_read_pins(struct ftdi_emu *emu, uint8_t *pins)
+{
+	_host_begin(emu);
+	emu->t_host += emu->usb_latency;
+	_device_sync(emu, emu->t_host);
+	*pins = emu->pins & 0xff;
+	emu->t_host += emu->usb_latency;
+	_host_end(emu);
+	return 0;
+}
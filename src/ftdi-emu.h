@@ -0,0 +1,258 @@
+/*
+ * ftdi-bitbang
+ *
+ * In-process emulated FTDI device.
+ *
+ * Takes the same operations as libftdi calls made by bitbang context, either
+ * directly or as bitbang context transport (ftdi_emu_transport()). Supports
+ * bitbang, synchronous bitbang (one pin sample returned for each written
+ * byte) and MPSSE with pin commands 0x80-0x83, clocked data and TMS
+ * commands, internal loopback, clock divisors and three-phase clocking.
+ * Unknown MPSSE commands are answered with 0xfa like a real device does.
+ *
+ * Pins are open drain towards the outside: level of a pin is low if device
+ * drives it low, any peripheral pulls it low, it is set low from outside
+ * with ftdi_emu_set_input() or it is connected to a pin that is low.
+ * Otherwise it is pulled up. MPSSE data pins are the usual ADBUS0 clock,
+ * ADBUS1 data out, ADBUS2 data in and ADBUS3 TMS.
+ *
+ * Timing is modeled in emulated time: usb transfers take bus latency and
+ * transfer time, device processes written bytes at baud rate times
+ * FTDI_BITBANG_RATE_MULTIPLIER (bitbang) or clock rate (MPSSE), transmit FIFO limits how far host can write ahead
+ * and short reads wait for send immediate (0x87) or latency timer. By
+ * default emulated time is only accounted, in realtime mode every operation
+ * also waits until the emulated time it takes has passed.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __FTDI_EMU_H__
+#define __FTDI_EMU_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ftdi-bitbang.h"
+
+/* longest MPSSE command header, opcode and arguments without data */
+#define FTDI_EMU_CMD_MAX            3
+#define FTDI_EMU_PERIPHERALS_MAX    8
+#define FTDI_EMU_CONNECTIONS_MAX    16
+
+/**
+ * Peripheral attached to emulated device. Called every time pin levels
+ * change, including each clock edge of MPSSE data commands.
+ *
+ * @param  ctx        peripheral context
+ * @param  t          emulated device time in seconds
+ * @param  pins       current pin levels, bit n is pin n
+ * @return            pins released by peripheral as ones, pulled low as zeros
+ */
+typedef uint16_t (*ftdi_emu_peripheral_cb)(void *ctx, double t, uint16_t pins);
+
+struct ftdi_emu_peripheral {
+	ftdi_emu_peripheral_cb cb;
+	void *ctx;
+	uint16_t drive;
+};
+
+struct ftdi_emu {
+	/* chip type, TYPE_* from libftdi */
+	int type;
+	/* BITMODE_RESET, BITMODE_BITBANG, BITMODE_SYNCBB or BITMODE_MPSSE */
+	int mode;
+	int baudrate;
+	/* output latches and directions (1 is output) */
+	uint8_t l_value;
+	uint8_t l_io;
+	uint8_t h_value;
+	uint8_t h_io;
+	/* levels set from outside, resolved levels of all pins */
+	uint16_t input;
+	uint16_t pins;
+	/* masks of pins connected together */
+	uint16_t connections[FTDI_EMU_CONNECTIONS_MAX];
+	int connection_count;
+	struct ftdi_emu_peripheral peripherals[FTDI_EMU_PERIPHERALS_MAX];
+	int peripheral_count;
+
+	/* MPSSE clock: divide by 5, divisor, three-phase and internal loopback */
+	int div5;
+	int divisor;
+	int three_phase;
+	int loopback;
+	/* MPSSE command being parsed and data bytes of it still to come */
+	uint8_t cmd[FTDI_EMU_CMD_MAX];
+	int cmd_len;
+	size_t cmd_data;
+
+	/* bytes waiting to be read by host */
+	uint8_t *rx;
+	size_t rx_len;
+	size_t rx_size;
+	/* set by send immediate, short read does not wait for latency timer */
+	int rx_flush;
+
+	/* chip properties */
+	size_t tx_fifo_size;
+	size_t rx_fifo_size;
+	size_t packet_size;
+	double usb_latency;
+	double usb_rate;
+	int latency_timer;
+
+	/* emulated device time and time host sees last operation finish */
+	double t;
+	double t_host;
+	/* emulated time when latest byte for host was produced */
+	double t_rx;
+	/* realtime mode and CLOCK_MONOTONIC time matching emulated zero */
+	int realtime;
+	double t_start;
+
+	/* counters */
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t bad_commands;
+	/* bytes produced while receive FIFO was full, real device would stall */
+	uint64_t rx_stalls;
+};
+
+/**
+ * Create emulated device. All pins are inputs and pulled up.
+ *
+ * @param  type       chip type to emulate, TYPE_* from libftdi
+ * @return            device or NULL on errors
+ */
+struct ftdi_emu *ftdi_emu_new(int type);
+
+/**
+ * Free emulated device.
+ *
+ * @param  emu        device
+ */
+void ftdi_emu_free(struct ftdi_emu *emu);
+
+/**
+ * Fill transport for using emulated device under bitbang context,
+ * see ftdi_bitbang_init_transport().
+ *
+ * @param  emu        device
+ * @param  transport  transport to fill
+ */
+void ftdi_emu_transport(struct ftdi_emu *emu, struct ftdi_bitbang_transport *transport);
+
+/**
+ * Connect two pins together, for example output back to input.
+ *
+ * @param  emu        device
+ * @param  pin_a      first pin, 0-15
+ * @param  pin_b      second pin, 0-15
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_emu_connect(struct ftdi_emu *emu, int pin_a, int pin_b);
+
+/**
+ * Attach peripheral.
+ *
+ * @param  emu        device
+ * @param  cb         peripheral callback
+ * @param  ctx        context passed to callback
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_emu_peripheral(struct ftdi_emu *emu, ftdi_emu_peripheral_cb cb, void *ctx);
+
+/**
+ * Set pin levels from outside.
+ *
+ * @param  emu        device
+ * @param  mask       pins to set
+ * @param  levels     zero bits pull pins low, ones release them
+ */
+void ftdi_emu_set_input(struct ftdi_emu *emu, uint16_t mask, uint16_t levels);
+
+/**
+ * Set latency timer like ftdi_set_latency_timer().
+ *
+ * @param  emu        device
+ * @param  ms         latency in milliseconds, 1-255
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_emu_set_latency_timer(struct ftdi_emu *emu, int ms);
+
+/**
+ * Enable or disable realtime mode. In realtime mode operations do not
+ * return before the emulated time they take has passed.
+ *
+ * @param  emu        device
+ * @param  realtime   non-zero to enable
+ */
+void ftdi_emu_set_realtime(struct ftdi_emu *emu, int realtime);
+
+/**
+ * Get emulated time when latest operation finished as seen by host.
+ *
+ * @param  emu        device
+ * @return            seconds from creation of device
+ */
+double ftdi_emu_time(struct ftdi_emu *emu);
+
+/**
+ * Set bitmode like ftdi_set_bitmode().
+ *
+ * @param  emu        device
+ * @param  io         pin directions for bitbang modes, 1 is output
+ * @param  mode       BITMODE_*
+ * @return            0 on success or -1 if mode is not supported
+ */
+int ftdi_emu_set_bitmode(struct ftdi_emu *emu, uint8_t io, uint8_t mode);
+
+/**
+ * Set baud rate like ftdi_set_baudrate().
+ *
+ * @param  emu        device
+ * @param  baudrate   baud rate
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_emu_set_baudrate(struct ftdi_emu *emu, int baudrate);
+
+/**
+ * Write data to device like ftdi_write_data().
+ *
+ * @param  emu        device
+ * @param  data       data
+ * @param  size       size of data
+ * @return            bytes written or -1 on errors
+ */
+int ftdi_emu_write(struct ftdi_emu *emu, const uint8_t *data, size_t size);
+
+/**
+ * Read data from device like ftdi_read_data(), never waits for more data
+ * than device has produced.
+ *
+ * @param  emu        device
+ * @param  data       buffer
+ * @param  size       size of buffer
+ * @return            bytes read or -1 on errors
+ */
+int ftdi_emu_read(struct ftdi_emu *emu, uint8_t *data, size_t size);
+
+/**
+ * Discard data waiting to be read like ftdi_usb_purge_rx_buffer().
+ *
+ * @param  emu        device
+ * @return            0 on success
+ */
+int ftdi_emu_purge_rx(struct ftdi_emu *emu);
+
+/**
+ * Read current levels of low pins like ftdi_read_pins().
+ *
+ * @param  emu        device
+ * @param  pins       pin levels are written here
+ * @return            0 on success
+ */
+int ftdi_emu_read_pins(struct ftdi_emu *emu, uint8_t *pins);
+
+
+#endif /* __FTDI_EMU_H__ */
@@ -9,50 +9,80 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <math.h>
-#include <time.h>
 #include "ftdi-hd44780.h"
 
-static long double _os_time()
-{
-	struct timespec tp;
-	clock_gettime(CLOCK_MONOTONIC, &tp);
-	return (long double)((long double)tp.tv_sec + (long double)tp.tv_nsec / 1e9);
-}
+/* hd44780 execution times */
+#define HD44780_EXEC_TIME               37e-6
+#define HD44780_EXEC_TIME_CLEAR_HOME    2e-3
+#define HD44780_EXEC_TIME_RESET         5e-3
+/* bus timing: address setup, enable pulse width and enable cycle remainder */
+#define HD44780_T_AS                    100e-9
+#define HD44780_T_PWEH                  500e-9
+#define HD44780_T_EL                    500e-9
 
-static void _os_sleep(long double t)
+/* wait until display has finished previous command */
+static int _wait_ready(struct ftdi_hd44780_context *dev)
 {
-	struct timespec tp;
-	long double integral;
-	t += _os_time();
-	tp.tv_nsec = (long)(modfl(t, &integral) * 1e9);
-	tp.tv_sec = (time_t)integral;
-	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
+	return ftdi_bitbang_delay(dev->bb, dev->busy_until - ftdi_bitbang_time(dev->bb));
 }
 
-static int _write_nibble(struct ftdi_hd44780_context *dev, int rs, uint8_t data)
+/* write data to bus and clock it in using en, uses only d4-d7 in 4-bit mode */
+static int _write_bus(struct ftdi_hd44780_context *dev, int rs, uint8_t data)
 {
-	ftdi_bitbang_set_io(dev->bb, dev->d4, 1);
-	ftdi_bitbang_set_io(dev->bb, dev->d5, 1);
-	ftdi_bitbang_set_io(dev->bb, dev->d6, 1);
-	ftdi_bitbang_set_io(dev->bb, dev->d7, 1);
+	int i, err = 0;
+	int pins[8] = { dev->d0, dev->d1, dev->d2, dev->d3, dev->d4, dev->d5, dev->d6, dev->d7 };
 
-	ftdi_bitbang_set_pin(dev->bb, dev->d4, data & 0x1);
-	ftdi_bitbang_set_pin(dev->bb, dev->d5, data & 0x2);
-	ftdi_bitbang_set_pin(dev->bb, dev->d6, data & 0x4);
-	ftdi_bitbang_set_pin(dev->bb, dev->d7, data & 0x8);
-	ftdi_bitbang_set_pin(dev->bb, dev->en, 1);
+	/* whole bus cycle is sent as one write */
+	ftdi_bitbang_buffer_start(dev->bb);
+	if (dev->bits == 4) {
+		data <<= 4;
+	}
+	for (i = 8 - dev->bits; i < 8; i++) {
+		ftdi_bitbang_set_io(dev->bb, pins[i], 1);
+		ftdi_bitbang_set_pin(dev->bb, pins[i], data & (1 << i));
+	}
 	ftdi_bitbang_set_pin(dev->bb, dev->rw, 0);
 	ftdi_bitbang_set_pin(dev->bb, dev->rs, rs);
-	ftdi_bitbang_write(dev->bb);
+	err += ftdi_bitbang_delay(dev->bb, HD44780_T_AS);
+
+	ftdi_bitbang_set_pin(dev->bb, dev->en, 1);
+	err += ftdi_bitbang_delay(dev->bb, HD44780_T_PWEH);
 
 	ftdi_bitbang_set_pin(dev->bb, dev->en, 0);
-	ftdi_bitbang_write(dev->bb);
+	err += ftdi_bitbang_delay(dev->bb, HD44780_T_EL);
+	err += ftdi_bitbang_buffer_flush(dev->bb);
 
-	return 0;
+	return err ? -1 : 0;
 }
 
-struct ftdi_hd44780_context *ftdi_hd44780_init(struct ftdi_bitbang_context *bb, int reset, int d4, int d5, int d6, int d7, int en, int rw, int rs)
+/* write full byte, as two nibbles in 4-bit mode */
+static int _write_byte(struct ftdi_hd44780_context *dev, int rs, uint8_t data, double exec_time)
+{
+	int err = 0;
+	err += _wait_ready(dev);
+	ftdi_bitbang_buffer_start(dev->bb);
+	if (dev->bits == 4) {
+		err += _write_bus(dev, rs, data >> 4);
+		err += _write_bus(dev, rs, data & 0xf);
+	} else {
+		err += _write_bus(dev, rs, data);
+	}
+	dev->busy_until = ftdi_bitbang_time(dev->bb) + exec_time;
+	err += ftdi_bitbang_buffer_flush(dev->bb);
+	return err ? -1 : 0;
+}
+
+/* send function set with wait used in reset sequence */
+static int _write_reset(struct ftdi_hd44780_context *dev, uint8_t data)
+{
+	int err = 0;
+	err += _wait_ready(dev);
+	err += _write_bus(dev, 0, dev->bits == 4 ? data >> 4 : data);
+	dev->busy_until = ftdi_bitbang_time(dev->bb) + HD44780_EXEC_TIME_RESET;
+	return err ? -1 : 0;
+}
+
+static struct ftdi_hd44780_context *_init(struct ftdi_bitbang_context *bb, int reset, int bits, int d0, int d1, int d2, int d3, int d4, int d5, int d6, int d7, int en, int rw, int rs)
 {
 	struct ftdi_hd44780_context *dev = malloc(sizeof(struct ftdi_hd44780_context));
 	if (!dev) {
@@ -62,6 +92,11 @@ struct ftdi_hd44780_context *ftdi_hd44780_init(struct ftdi_bitbang_context *bb,
 
 	/* save args */
 	dev->bb = bb;
+	dev->bits = bits;
+	dev->d0 = d0;
+	dev->d1 = d1;
+	dev->d2 = d2;
+	dev->d3 = d3;
 	dev->d4 = d4;
 	dev->d5 = d5;
 	dev->d6 = d6;
@@ -69,9 +104,18 @@ struct ftdi_hd44780_context *ftdi_hd44780_init(struct ftdi_bitbang_context *bb,
 	dev->en = en;
 	dev->rw = rw;
 	dev->rs = rs;
+	dev->addr = -1;
+	/* what reset sequence below sets */
+	dev->two_lines = bits == 8;
 
 	/* setup io pins as outputs */
 	int err = 0;
+	if (bits == 8) {
+		err += ftdi_bitbang_set_io(dev->bb, dev->d0, 1);
+		err += ftdi_bitbang_set_io(dev->bb, dev->d1, 1);
+		err += ftdi_bitbang_set_io(dev->bb, dev->d2, 1);
+		err += ftdi_bitbang_set_io(dev->bb, dev->d3, 1);
+	}
 	err += ftdi_bitbang_set_io(dev->bb, dev->d4, 1);
 	err += ftdi_bitbang_set_io(dev->bb, dev->d5, 1);
 	err += ftdi_bitbang_set_io(dev->bb, dev->d6, 1);
@@ -80,19 +124,24 @@ struct ftdi_hd44780_context *ftdi_hd44780_init(struct ftdi_bitbang_context *bb,
 	err += ftdi_bitbang_set_io(dev->bb, dev->rw, 1);
 	err += ftdi_bitbang_set_io(dev->bb, dev->rs, 1);
 	if (err != 0) {
+		free(dev);
 		return NULL;
 	}
-	
-	/* reset hd44780 so that it will be in 4 bit state for sure */
+	/* en low, might be shared bus with other displays */
+	ftdi_bitbang_set_pin(dev->bb, dev->en, 0);
+	ftdi_bitbang_write(dev->bb);
+
+	/* reset hd44780 so that it will be in wanted bus mode for sure */
 	if (reset) {
-		_write_nibble(dev, 0, 0x3);
-		_os_sleep(5e-3);
-		_write_nibble(dev, 0, 0x3);
-		_os_sleep(5e-3);
-		_write_nibble(dev, 0, 0x3);
-		_os_sleep(5e-3);
-		_write_nibble(dev, 0, 0x2);
-		_os_sleep(5e-3);
+		_write_reset(dev, 0x30);
+		_write_reset(dev, 0x30);
+		_write_reset(dev, 0x30);
+		if (bits == 4) {
+			_write_reset(dev, 0x20);
+		} else {
+			/* function set: 8-bit, two lines */
+			ftdi_hd44780_cmd(dev, 0x38);
+		}
 		/* entry mode: move cursor right */
 		ftdi_hd44780_cmd(dev, 0x06);
 		/* display on */
@@ -106,6 +155,16 @@ struct ftdi_hd44780_context *ftdi_hd44780_init(struct ftdi_bitbang_context *bb,
 	return dev;
 }
 
+struct ftdi_hd44780_context *ftdi_hd44780_init(struct ftdi_bitbang_context *bb, int reset, int d4, int d5, int d6, int d7, int en, int rw, int rs)
+{
+	return _init(bb, reset, 4, -1, -1, -1, -1, d4, d5, d6, d7, en, rw, rs);
+}
+
+struct ftdi_hd44780_context *ftdi_hd44780_init_8bit(struct ftdi_bitbang_context *bb, int reset, int d0, int d1, int d2, int d3, int d4, int d5, int d6, int d7, int en, int rw, int rs)
+{
+	return _init(bb, reset, 8, d0, d1, d2, d3, d4, d5, d6, d7, en, rw, rs);
+}
+
 struct ftdi_hd44780_context *ftdi_hd44780_init_simple(struct ftdi_bitbang_context *bb)
 {
 	return ftdi_hd44780_init(bb, 1, 0, 1, 2, 3, 4, 5, 6);
@@ -116,20 +175,58 @@ void ftdi_hd44780_free(struct ftdi_hd44780_context *dev)
 	free(dev);
 }
 
+/* step ddram address like address counter does, in two line mode end of first line continues from second */
+static void _addr_step(struct ftdi_hd44780_context *dev, int decrement)
+{
+	int a = dev->addr;
+	if (dev->addr_cgram || a < 0) {
+		return;
+	}
+	if (dev->two_lines && !decrement) {
+		a = a == 0x27 ? 0x40 : (a >= 0x67 ? 0x00 : a + 1);
+	} else if (dev->two_lines) {
+		a = a == 0x40 ? 0x27 : (a == 0x00 ? 0x67 : a - 1);
+	} else if (!decrement) {
+		a = a >= 0x4f ? 0x00 : a + 1;
+	} else {
+		a = a == 0x00 ? 0x4f : a - 1;
+	}
+	dev->addr = a;
+}
+
 int ftdi_hd44780_cmd(struct ftdi_hd44780_context *dev, uint8_t command)
 {
-	_write_nibble(dev, 0, command >> 4);
-	_write_nibble(dev, 0, command);
-	_os_sleep(2e-3);
-	return 0;
+	/* follow where address counter points to */
+	if (command & 0x80) {
+		dev->addr = command & 0x7f;
+		dev->addr_cgram = 0;
+	} else if (command & 0x40) {
+		dev->addr_cgram = 1;
+	} else if (command & 0x20) {
+		dev->two_lines = command & 0x08 ? 1 : 0;
+	} else if ((command & 0x18) == 0x10) {
+		/* cursor move without display shift */
+		_addr_step(dev, !(command & 0x04));
+	} else if (command & 0x10) {
+		/* display shift does not move address */
+	} else if (command & 0x08) {
+		/* display control does not move address */
+	} else if ((command & 0xfc) == 0x04) {
+		dev->addr_decrement = command & 0x02 ? 0 : 1;
+	} else if (command == 0x01 || command == 0x02 || command == 0x03) {
+		dev->addr = 0;
+		dev->addr_cgram = 0;
+		/* clear also sets entry mode to increment */
+		dev->addr_decrement = command == 0x01 ? 0 : dev->addr_decrement;
+	}
+	/* only clear and home are slow */
+	return _write_byte(dev, 0, command, command < 0x04 ? HD44780_EXEC_TIME_CLEAR_HOME : HD44780_EXEC_TIME);
 }
 
 int ftdi_hd44780_write_data(struct ftdi_hd44780_context *dev, uint8_t data)
 {
-	_write_nibble(dev, 1, data >> 4);
-	_write_nibble(dev, 1, data);
-	_os_sleep(37e-6);
-	return 0;
+	_addr_step(dev, dev->addr_decrement);
+	return _write_byte(dev, 1, data, HD44780_EXEC_TIME);
 }
 
 int ftdi_hd44780_write_char(struct ftdi_hd44780_context *dev, char ch)
@@ -155,11 +252,21 @@ int ftdi_hd44780_write_str(struct ftdi_hd44780_context *dev, char *str)
 
 int ftdi_hd44780_goto_xy(struct ftdi_hd44780_context *dev, int x, int y)
 {
-	if (x < 0 || x > 39 || y < 0 || y > 3) {
+	if (y < 0 || y > 3) {
 		return -1;
 	}
-	ftdi_hd44780_cmd(dev, 0x80 | (y * 40 + x));
-	return 0;
+	if (dev->two_lines) {
+		/* lines start at 0x00 and 0x40, four line displays continue both from the middle */
+		int offset = (y & 1 ? 0x40 : 0x00) + (y & 2 ? 0x14 : 0x00);
+		if (x < 0 || x >= 0x28 - (offset & 0x3f)) {
+			return -1;
+		}
+		return ftdi_hd44780_cmd(dev, 0x80 | (offset + x));
+	}
+	if (x < 0 || x > 39) {
+		return -1;
+	}
+	return ftdi_hd44780_cmd(dev, 0x80 | (y * 40 + x));
 }
 
 int ftdi_hd44780_set_line_width(struct ftdi_hd44780_context *dev, int line_width)
@@ -167,3 +274,86 @@ int ftdi_hd44780_set_line_width(struct ftdi_hd44780_context *dev, int line_width
 	dev->line_width = line_width;
 	return 0;
 }
+
+int ftdi_hd44780_glyph(struct ftdi_hd44780_context *dev, const uint8_t bitmap[8])
+{
+	int i, slot, err = 0;
+	uint8_t rows[8];
+
+	for (i = 0; i < 8; i++) {
+		rows[i] = bitmap[i] & 0x1f;
+	}
+	/* lookup from cache, select least recently used (or free) slot as victim if not found */
+	for (i = 0, slot = 0; i < 8; i++) {
+		if (dev->glyph_used[i] && !memcmp(dev->glyphs[i], rows, 8)) {
+			dev->glyph_used[i] = ++dev->glyph_clock;
+			return i;
+		}
+		if (dev->glyph_used[i] < dev->glyph_used[slot]) {
+			slot = i;
+		}
+	}
+
+	/* upload needs to restore ddram address afterwards */
+	if (dev->addr < 0 || dev->addr_cgram) {
+		return -1;
+	}
+	int addr = dev->addr;
+	ftdi_bitbang_buffer_start(dev->bb);
+	err += ftdi_hd44780_cmd(dev, 0x40 | (slot << 3));
+	for (i = 0; i < 8; i++) {
+		err += ftdi_hd44780_write_data(dev, rows[i]);
+	}
+	err += ftdi_hd44780_cmd(dev, 0x80 | addr);
+	err += ftdi_bitbang_buffer_flush(dev->bb);
+	if (err) {
+		dev->glyph_used[slot] = 0;
+		return -1;
+	}
+
+	memcpy(dev->glyphs[slot], rows, 8);
+	dev->glyph_used[slot] = ++dev->glyph_clock;
+	return slot;
+}
+
+int ftdi_hd44780_write_glyph(struct ftdi_hd44780_context *dev, const uint8_t bitmap[8])
+{
+	int ch, err = 0;
+	ftdi_bitbang_buffer_start(dev->bb);
+	ch = ftdi_hd44780_glyph(dev, bitmap);
+	if (ch >= 0) {
+		err = ftdi_hd44780_write_data(dev, (uint8_t)ch);
+	}
+	err += ftdi_bitbang_buffer_flush(dev->bb);
+	return (ch < 0 || err) ? -1 : 0;
+}
+
+int ftdi_hd44780_write_str_multi(struct ftdi_hd44780_context **devs, char **strs, int count)
+{
+	int i, left, err = 0;
+	size_t j, *lens;
+	if (count < 1) {
+		return 0;
+	}
+	lens = malloc(sizeof(*lens) * count);
+	if (!lens) {
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		lens[i] = strs[i] ? strlen(strs[i]) : 0;
+	}
+	/* one character to each display at a time */
+	ftdi_bitbang_buffer_start(devs[0]->bb);
+	for (j = 0, left = 1; left; j++) {
+		for (i = 0, left = 0; i < count; i++) {
+			if (j >= lens[i]) {
+				continue;
+			}
+			err += ftdi_hd44780_write_char(devs[i], strs[i][j]);
+			left = 1;
+		}
+	}
+	err += ftdi_bitbang_buffer_flush(devs[0]->bb);
+	free(lens);
+	return err ? -1 : 0;
+}
@@ -14,6 +14,11 @@
 
 struct ftdi_hd44780_context {
 	struct ftdi_bitbang_context *bb;
+	/* d0-d3 are only used in 8-bit mode */
+	int d0;
+	int d1;
+	int d2;
+	int d3;
 	int d4;
 	int d5;
 	int d6;
@@ -23,9 +28,24 @@ struct ftdi_hd44780_context {
 	int rs;
 	int line_width;
 	int line_chars_written;
+	/* bus width, 4 or 8 */
+	int bits;
+	/* estimated time (see ftdi_bitbang_time()) when display is ready for next write */
+	double busy_until;
+	/* current ddram address, -1 if unknown, and if address counter points to cgram instead */
+	int addr;
+	int addr_cgram;
+	/* address counter direction from entry mode and line mode from function set */
+	int addr_decrement;
+	int two_lines;
+	/* custom glyphs in cgram, slot with zero use stamp is free */
+	uint8_t glyphs[8][8];
+	unsigned int glyph_used[8];
+	unsigned int glyph_clock;
 };
 
 struct ftdi_hd44780_context *ftdi_hd44780_init(struct ftdi_bitbang_context *bb, int reset, int d4, int d5, int d6, int d7, int en, int rw, int rs);
+struct ftdi_hd44780_context *ftdi_hd44780_init_8bit(struct ftdi_bitbang_context *bb, int reset, int d0, int d1, int d2, int d3, int d4, int d5, int d6, int d7, int en, int rw, int rs);
 struct ftdi_hd44780_context * ftdi_hd44780_init_simple(struct ftdi_bitbang_context *bb);
 void ftdi_hd44780_free(struct ftdi_hd44780_context *dev);
 
@@ -37,5 +57,44 @@ int ftdi_hd44780_write_str(struct ftdi_hd44780_context *dev, char *str);
 int ftdi_hd44780_goto_xy(struct ftdi_hd44780_context *dev, int x, int y);
 int ftdi_hd44780_set_line_width(struct ftdi_hd44780_context *dev, int line_width);
 
+/**
+ * Get character code for custom 5x8 glyph. Glyphs are cached in the eight
+ * CGRAM slots using bitmap content as key. Glyph is uploaded only when it is
+ * not already in CGRAM, replacing least recently used one if all slots are in use.
+ * Note that replacing a glyph changes it everywhere it is shown on the display.
+ * Cursor position must be known (set using goto or clear/home) for upload
+ * since it needs to be restored afterwards.
+ *
+ * Upload is made using normal writes so when called while buffering
+ * (ftdi_bitbang_buffer_start()) it is sent along with the text.
+ *
+ * @param  dev        hd44780 context
+ * @param  bitmap     eight rows, five lowest bits of each row are used
+ * @return            character code 0-7 or -1 on errors
+ */
+int ftdi_hd44780_glyph(struct ftdi_hd44780_context *dev, const uint8_t bitmap[8]);
+
+/**
+ * Write custom glyph at cursor, see ftdi_hd44780_glyph().
+ *
+ * @param  dev        hd44780 context
+ * @param  bitmap     eight rows, five lowest bits of each row are used
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_hd44780_write_glyph(struct ftdi_hd44780_context *dev, const uint8_t bitmap[8]);
+
+/**
+ * Write strings to several displays that share data, rw and rs pins
+ * and have separate en pins. Characters are interleaved between displays
+ * into one buffered write so that while one display is busy others are
+ * being written to.
+ *
+ * @param  devs       display contexts, all must use same bitbang context
+ * @param  strs       string for each display, NULL to skip display
+ * @param  count      number of displays
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_hd44780_write_str_multi(struct ftdi_hd44780_context **devs, char **strs, int count);
+
 
 #endif /* __FTDI_HD44780_H__ */
@@ -0,0 +1,295 @@
+/*
+ * ftdi-i2c
+ *
+ * Bus conditions (start, stop) are made with pin state commands padded to
+ * half a clock period, bytes and acknowledge bits with clocked MPSSE
+ * commands. Three-phase clocking keeps data valid on both clock edges as
+ * I2C requires.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ftdi-i2c.h"
+
+#define I2C_SCL             0
+#define I2C_SDA_OUT         1
+#define I2C_SDA_IN          2
+/* three-phase clock is 60 MHz / ((1 + divisor) * 3) */
+#define I2C_CLOCK_BASE      20e6
+
+static int _scl(struct ftdi_i2c_context *i2c, int value)
+{
+	ftdi_bitbang_set_pin(i2c->bb, I2C_SCL, value);
+	return ftdi_bitbang_write(i2c->bb);
+}
+
+/* drive SDA low or release it */
+static int _sda(struct ftdi_i2c_context *i2c, int value)
+{
+	ftdi_bitbang_set_pin(i2c->bb, I2C_SDA_OUT, 0);
+	ftdi_bitbang_set_io(i2c->bb, I2C_SDA_OUT, value ? 0 : 1);
+	return ftdi_bitbang_write(i2c->bb);
+}
+
+static int _delay(struct ftdi_i2c_context *i2c)
+{
+	return ftdi_bitbang_delay(i2c->bb, i2c->t_half);
+}
+
+/* read responses of everything written so far */
+static int _collect(struct ftdi_i2c_context *i2c)
+{
+	size_t i;
+
+	if (i2c->pending_len < 1) {
+		return 0;
+	}
+	if (ftdi_bitbang_mpsse_read(i2c->bb, i2c->response, i2c->pending_len)) {
+		i2c->pending_len = 0;
+		return -1;
+	}
+	for (i = 0; i < i2c->pending_len; i++) {
+		struct ftdi_i2c_pending *p = &i2c->pending[i];
+		if (p->data) {
+			*p->data = i2c->response[i];
+		} else if (i2c->response[i] & 0x01) {
+			*p->result = -1;
+		}
+	}
+	i2c->pending_len = 0;
+
+	return 0;
+}
+
+static int _pending(struct ftdi_i2c_context *i2c, uint8_t *data, int *result)
+{
+	i2c->pending[i2c->pending_len].data = data;
+	i2c->pending[i2c->pending_len].result = result;
+	i2c->pending_len++;
+	return i2c->pending_len < FTDI_I2C_PENDING_MAX ? 0 : _collect(i2c);
+}
+
+/* start or repeated start, leaves SCL low */
+static int _start(struct ftdi_i2c_context *i2c)
+{
+	int err = 0;
+	/* on repeated start SDA rises through pull-up, give it data setup time before clock rises */
+	err += _sda(i2c, 1);
+	err += _delay(i2c);
+	err += _scl(i2c, 1);
+	err += _delay(i2c);
+	err += _sda(i2c, 0);
+	err += _delay(i2c);
+	err += _scl(i2c, 0);
+	return err ? -1 : 0;
+}
+
+static int _stop(struct ftdi_i2c_context *i2c)
+{
+	int err = 0;
+	err += _sda(i2c, 0);
+	err += _delay(i2c);
+	err += _scl(i2c, 1);
+	err += _delay(i2c);
+	err += _sda(i2c, 1);
+	err += _delay(i2c);
+	return err ? -1 : 0;
+}
+
+static int _write_byte(struct ftdi_i2c_context *i2c, uint8_t byte, int *result)
+{
+	/* byte out on falling edge msb first, release SDA and read acknowledge bit on rising edge */
+	uint8_t out[4] = { 0x11, 0x00, 0x00, byte };
+	uint8_t ack[2] = { 0x22, 0x00 };
+	ftdi_bitbang_set_io(i2c->bb, I2C_SDA_OUT, 1);
+	if (ftdi_bitbang_mpsse_write(i2c->bb, out, sizeof(out))) {
+		return -1;
+	}
+	if (_sda(i2c, 1) || ftdi_bitbang_mpsse_write(i2c->bb, ack, sizeof(ack))) {
+		return -1;
+	}
+	return _pending(i2c, NULL, result);
+}
+
+static int _read_byte(struct ftdi_i2c_context *i2c, uint8_t *byte, int last)
+{
+	/* byte in on rising edge msb first, acknowledge out on falling edge, last byte is not acknowledged */
+	uint8_t in[3] = { 0x20, 0x00, 0x00 };
+	uint8_t ack[3] = { 0x13, 0x00, last ? 0xff : 0x00 };
+	if (_sda(i2c, 1) || ftdi_bitbang_mpsse_write(i2c->bb, in, sizeof(in))) {
+		return -1;
+	}
+	ftdi_bitbang_set_io(i2c->bb, I2C_SDA_OUT, 1);
+	if (ftdi_bitbang_mpsse_write(i2c->bb, ack, sizeof(ack))) {
+		return -1;
+	}
+	return _pending(i2c, byte, NULL);
+}
+
+static int _msg(struct ftdi_i2c_context *i2c, struct ftdi_i2c_msg *msg)
+{
+	int err = 0;
+	size_t i;
+
+	msg->result = 0;
+	err += _start(i2c);
+	err += _write_byte(i2c, (msg->addr << 1) | (msg->read && msg->reg_size < 1 ? 1 : 0), &msg->result);
+	if (msg->reg_size > 1) {
+		err += _write_byte(i2c, msg->reg >> 8, &msg->result);
+	}
+	if (msg->reg_size > 0) {
+		err += _write_byte(i2c, msg->reg & 0xff, &msg->result);
+	}
+	if (msg->read) {
+		if (msg->reg_size > 0) {
+			err += _start(i2c);
+			err += _write_byte(i2c, (msg->addr << 1) | 1, &msg->result);
+		}
+		for (i = 0; i < msg->size; i++) {
+			err += _read_byte(i2c, &msg->data[i], i == (msg->size - 1));
+		}
+	} else {
+		for (i = 0; i < msg->size; i++) {
+			err += _write_byte(i2c, msg->data[i], &msg->result);
+		}
+	}
+	err += _stop(i2c);
+
+	return err ? -1 : 0;
+}
+
+struct ftdi_i2c_context *ftdi_i2c_init(struct ftdi_bitbang_context *bb)
+{
+	/* 60 MHz clock, no adaptive clocking, three-phase clocking, no loopback */
+	uint8_t setup[4] = { 0x8a, 0x97, 0x8c, 0x85 };
+	/* FT232H can drive only zeros so lines are really open drain */
+	uint8_t drive_zero[3] = { 0x9e, (1 << I2C_SCL) | (1 << I2C_SDA_OUT), 0x00 };
+	int type = bb->transport.type;
+
+	/* three-phase clocking is only available in H series chips */
+	if (bb->state.mode != BITMODE_MPSSE || (type != TYPE_2232H && type != TYPE_4232H && type != TYPE_232H)) {
+		return NULL;
+	}
+	struct ftdi_i2c_context *i2c = malloc(sizeof(struct ftdi_i2c_context));
+	if (!i2c) {
+		return NULL;
+	}
+	memset(i2c, 0, sizeof(*i2c));
+	i2c->bb = bb;
+
+	if (ftdi_bitbang_mpsse_write(bb, setup, sizeof(setup)) ||
+	        (type == TYPE_232H && ftdi_bitbang_mpsse_write(bb, drive_zero, sizeof(drive_zero))) ||
+	        ftdi_i2c_set_frequency(i2c, 100000)) {
+		free(i2c);
+		return NULL;
+	}
+
+	/* bus idle: SCL high, SDA released */
+	ftdi_bitbang_set_io(bb, I2C_SCL, 1);
+	ftdi_bitbang_set_io(bb, I2C_SDA_IN, 0);
+	ftdi_bitbang_set_pin(bb, I2C_SCL, 1);
+	if (_sda(i2c, 1)) {
+		free(i2c);
+		return NULL;
+	}
+
+	return i2c;
+}
+
+void ftdi_i2c_free(struct ftdi_i2c_context *i2c)
+{
+	free(i2c);
+}
+
+int ftdi_i2c_set_frequency(struct ftdi_i2c_context *i2c, int frequency)
+{
+	int divisor;
+	uint8_t cmd[3];
+
+	if (frequency < 1) {
+		return -1;
+	}
+	divisor = (int)(I2C_CLOCK_BASE / (double)frequency + 0.5) - 1;
+	if (divisor < 0 || divisor > 0xffff) {
+		return -1;
+	}
+	cmd[0] = 0x86;
+	cmd[1] = divisor & 0xff;
+	cmd[2] = divisor >> 8;
+	if (ftdi_bitbang_mpsse_write(i2c->bb, cmd, sizeof(cmd))) {
+		return -1;
+	}
+	i2c->frequency = (int)(I2C_CLOCK_BASE / (1.0 + divisor));
+	i2c->t_half = 0.5 / (double)i2c->frequency;
+
+	return 0;
+}
+
+int ftdi_i2c_batch(struct ftdi_i2c_context *i2c, struct ftdi_i2c_msg *msgs, int count)
+{
+	int i, err = 0, nacks = 0;
+
+	for (i = 0; i < count; i++) {
+		if (msgs[i].reg_size < 0 || msgs[i].reg_size > 2 || (msgs[i].read && msgs[i].size < 1)) {
+			return -1;
+		}
+	}
+
+	ftdi_bitbang_buffer_start(i2c->bb);
+	for (i = 0; i < count && !err; i++) {
+		err += _msg(i2c, &msgs[i]);
+	}
+	if (err) {
+		/* release bus, responses of commands written so far are still read so none are left waiting */
+		_stop(i2c);
+		_collect(i2c);
+	} else {
+		err += _collect(i2c);
+	}
+	err += ftdi_bitbang_buffer_flush(i2c->bb);
+	if (err) {
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		nacks += msgs[i].result ? 1 : 0;
+	}
+	return nacks;
+}
+
+static int _single(struct ftdi_i2c_context *i2c, uint8_t addr, int reg_size, uint8_t reg, int read, uint8_t *data, size_t size)
+{
+	struct ftdi_i2c_msg msg = {
+		.addr = addr,
+		.reg = reg,
+		.reg_size = reg_size,
+		.read = read,
+		.data = data,
+		.size = size,
+	};
+	return ftdi_i2c_batch(i2c, &msg, 1) == 0 ? 0 : -1;
+}
+
+int ftdi_i2c_write(struct ftdi_i2c_context *i2c, uint8_t addr, const uint8_t *data, size_t size)
+{
+	return _single(i2c, addr, 0, 0, 0, (uint8_t *)data, size);
+}
+
+int ftdi_i2c_read(struct ftdi_i2c_context *i2c, uint8_t addr, uint8_t *data, size_t size)
+{
+	return _single(i2c, addr, 0, 0, 1, data, size);
+}
+
+int ftdi_i2c_write_reg(struct ftdi_i2c_context *i2c, uint8_t addr, uint8_t reg, const uint8_t *data, size_t size)
+{
+	return _single(i2c, addr, 1, reg, 0, (uint8_t *)data, size);
+}
+
+int ftdi_i2c_read_reg(struct ftdi_i2c_context *i2c, uint8_t addr, uint8_t reg, uint8_t *data, size_t size)
+{
+	return _single(i2c, addr, 1, reg, 1, data, size);
+}
@@ -0,0 +1,148 @@
+/*
+ * ftdi-i2c
+ *
+ * I2C master using MPSSE, needs FT2232H, FT4232H or FT232H. SCL is ADBUS0,
+ * SDA is ADBUS1 which must be connected to ADBUS2 for reading. Both lines
+ * need pull-up resistors. Clock stretching by slaves is not supported.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __FTDI_I2C_H__
+#define __FTDI_I2C_H__
+
+#include <stdlib.h>
+#include <libftdi1/ftdi.h>
+#include "ftdi-bitbang.h"
+
+/* most response bytes waited for in one usb transaction, below receive FIFO size of FT232H */
+#define FTDI_I2C_PENDING_MAX    512
+
+/* one I2C transaction from start to stop, see ftdi_i2c_batch() */
+struct ftdi_i2c_msg {
+	/* 7-bit slave address */
+	uint8_t addr;
+	/* register address written before data, big endian */
+	uint16_t reg;
+	/* register address size in bytes, 0 (no register), 1 or 2 */
+	int reg_size;
+	/* non-zero to read data, otherwise data is written */
+	int read;
+	uint8_t *data;
+	size_t size;
+	/* 0 on success or -1 if slave did not acknowledge */
+	int result;
+};
+
+/* response byte waited for: acknowledge bit or read data byte */
+struct ftdi_i2c_pending {
+	/* where data byte goes, NULL for acknowledge */
+	uint8_t *data;
+	/* set to -1 on missing acknowledge */
+	int *result;
+};
+
+struct ftdi_i2c_context {
+	struct ftdi_bitbang_context *bb;
+	/* actual SCL frequency in Hz */
+	int frequency;
+	/* half SCL period in seconds, used for bus condition timing */
+	double t_half;
+	/* response bytes of commands written so far */
+	struct ftdi_i2c_pending pending[FTDI_I2C_PENDING_MAX];
+	uint8_t response[FTDI_I2C_PENDING_MAX];
+	size_t pending_len;
+};
+
+/**
+ * Initialize I2C master. Bitbang context must be in MPSSE mode. Sets
+ * three-phase clocking and 100 kHz clock.
+ *
+ * @param  bb         bitbang context
+ * @return            i2c context or NULL on errors
+ */
+struct ftdi_i2c_context *ftdi_i2c_init(struct ftdi_bitbang_context *bb);
+
+/**
+ * Free I2C context. Bitbang context is not freed.
+ *
+ * @param  i2c        i2c context
+ */
+void ftdi_i2c_free(struct ftdi_i2c_context *i2c);
+
+/**
+ * Set SCL frequency. Actual frequency is the closest one device can
+ * generate, see frequency in context.
+ *
+ * @param  i2c        i2c context
+ * @param  frequency  frequency in Hz, for example 100000 or 400000
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_i2c_set_frequency(struct ftdi_i2c_context *i2c, int frequency);
+
+/**
+ * Run several independent transactions. Commands of all transactions are
+ * written as one usb transfer and all responses (acknowledge bits and read
+ * data) are read back at once, except when there are more responses than
+ * FTDI_I2C_PENDING_MAX, then they are read in parts. Acknowledge of each
+ * byte is checked after reading responses, so a transaction is clocked to
+ * the end even if slave did not acknowledge it.
+ *
+ * @param  i2c        i2c context
+ * @param  msgs       transactions, result of each is set
+ * @param  count      number of transactions
+ * @return            number of transactions not acknowledged or -1 on errors
+ */
+int ftdi_i2c_batch(struct ftdi_i2c_context *i2c, struct ftdi_i2c_msg *msgs, int count);
+
+/**
+ * Write data to slave. Writing zero bytes checks if slave acknowledges
+ * its address.
+ *
+ * @param  i2c        i2c context
+ * @param  addr       7-bit slave address
+ * @param  data       data to write
+ * @param  size       size of data
+ * @return            0 on success or -1 on errors and missing acknowledge
+ */
+int ftdi_i2c_write(struct ftdi_i2c_context *i2c, uint8_t addr, const uint8_t *data, size_t size);
+
+/**
+ * Read data from slave.
+ *
+ * @param  i2c        i2c context
+ * @param  addr       7-bit slave address
+ * @param  data       data is read here
+ * @param  size       bytes to read, at least one
+ * @return            0 on success or -1 on errors and missing acknowledge
+ */
+int ftdi_i2c_read(struct ftdi_i2c_context *i2c, uint8_t addr, uint8_t *data, size_t size);
+
+/**
+ * Write consecutive registers starting from given register in one transaction.
+ *
+ * @param  i2c        i2c context
+ * @param  addr       7-bit slave address
+ * @param  reg        first register
+ * @param  data       register values
+ * @param  size       number of registers
+ * @return            0 on success or -1 on errors and missing acknowledge
+ */
+int ftdi_i2c_write_reg(struct ftdi_i2c_context *i2c, uint8_t addr, uint8_t reg, const uint8_t *data, size_t size);
+
+/**
+ * Read consecutive registers starting from given register in one
+ * transaction using repeated start.
+ *
+ * @param  i2c        i2c context
+ * @param  addr       7-bit slave address
+ * @param  reg        first register
+ * @param  data       register values are read here
+ * @param  size       number of registers, at least one
+ * @return            0 on success or -1 on errors and missing acknowledge
+ */
+int ftdi_i2c_read_reg(struct ftdi_i2c_context *i2c, uint8_t addr, uint8_t reg, uint8_t *data, size_t size);
+
+
+#endif /* __FTDI_I2C_H__ */
@@ -0,0 +1,186 @@
+/*
+ * ftdi-bitbang
+ *
+ * Compact binary trace of usb operations made through bitbang context.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ftdi-trace.h"
+
+#define TRACE_MAGIC         "FTBT"
+#define TRACE_HEADER_SIZE   11
+/* large stdio buffer so tracing does not add a syscall per operation */
+#define TRACE_BUFFER_SIZE   (1 << 20)
+
+static uint8_t *_leb128_put(uint8_t *p, uint64_t v)
+{
+	do {
+		*p++ = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+		v >>= 7;
+	} while (v > 0);
+	return p;
+}
+
+static int _leb128_get(FILE *f, uint64_t *v)
+{
+	int c, shift = 0;
+	*v = 0;
+	do {
+		c = fgetc(f);
+		if (c == EOF || shift > 63) {
+			return -1;
+		}
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 0;
+}
+
+static uint64_t _ns(double t)
+{
+	return t > 0 ? (uint64_t)(t * 1e9 + 0.5) : 0;
+}
+
+struct ftdi_trace *ftdi_trace_create(const char *filename, const struct ftdi_trace_header *header, double t_start)
+{
+	uint8_t h[TRACE_HEADER_SIZE];
+	struct ftdi_trace *trace = calloc(1, sizeof(*trace));
+	if (!trace) {
+		return NULL;
+	}
+	trace->f = fopen(filename, "wb");
+	if (!trace->f) {
+		free(trace);
+		return NULL;
+	}
+	setvbuf(trace->f, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+	trace->writing = 1;
+	trace->t_prev = t_start;
+
+	memcpy(h, TRACE_MAGIC, 4);
+	h[4] = FTDI_TRACE_VERSION;
+	h[5] = (uint8_t)header->mode;
+	h[6] = (uint8_t)header->type;
+	h[7] = header->l_value;
+	h[8] = header->l_io;
+	h[9] = header->h_value;
+	h[10] = header->h_io;
+	if (fwrite(h, sizeof(h), 1, trace->f) != 1) {
+		ftdi_trace_close(trace);
+		return NULL;
+	}
+
+	return trace;
+}
+
+int ftdi_trace_record(struct ftdi_trace *trace, int op, int error, double t, double duration, const void *data, size_t size)
+{
+	uint8_t buf[32], *p = buf;
+
+	*p++ = (uint8_t)op | (error ? FTDI_TRACE_OP_ERROR : 0);
+	p = _leb128_put(p, _ns(t - trace->t_prev));
+	p = _leb128_put(p, _ns(duration));
+	p = _leb128_put(p, size);
+	trace->t_prev = t > trace->t_prev ? t : trace->t_prev;
+	trace->records++;
+
+	if (fwrite(buf, p - buf, 1, trace->f) != 1) {
+		return -1;
+	}
+	if (size > 0 && fwrite(data, size, 1, trace->f) != 1) {
+		return -1;
+	}
+
+	return 0;
+}
+
+struct ftdi_trace *ftdi_trace_open(const char *filename, struct ftdi_trace_header *header)
+{
+	uint8_t h[TRACE_HEADER_SIZE];
+	struct ftdi_trace *trace = calloc(1, sizeof(*trace));
+	if (!trace) {
+		return NULL;
+	}
+	trace->f = fopen(filename, "rb");
+	if (!trace->f) {
+		free(trace);
+		return NULL;
+	}
+	setvbuf(trace->f, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+	if (fread(h, sizeof(h), 1, trace->f) != 1 || memcmp(h, TRACE_MAGIC, 4) || h[4] != FTDI_TRACE_VERSION) {
+		ftdi_trace_close(trace);
+		return NULL;
+	}
+	header->version = h[4];
+	header->mode = h[5];
+	header->type = h[6];
+	header->l_value = h[7];
+	header->l_io = h[8];
+	header->h_value = h[9];
+	header->h_io = h[10];
+	trace->data_start = ftell(trace->f);
+
+	return trace;
+}
+
+int ftdi_trace_next(struct ftdi_trace *trace, struct ftdi_trace_record *record)
+{
+	uint64_t dt, duration, size;
+	int c;
+
+	c = fgetc(trace->f);
+	if (c == EOF) {
+		return ferror(trace->f) ? -1 : 0;
+	}
+	if (_leb128_get(trace->f, &dt) || _leb128_get(trace->f, &duration) || _leb128_get(trace->f, &size)) {
+		return -1;
+	}
+	if (size > trace->data_size) {
+		uint8_t *data = realloc(trace->data, size);
+		if (!data) {
+			return -1;
+		}
+		trace->data = data;
+		trace->data_size = size;
+	}
+	if (size > 0 && fread(trace->data, size, 1, trace->f) != 1) {
+		return -1;
+	}
+
+	trace->t_ns += dt;
+	trace->records++;
+	record->op = c & ~FTDI_TRACE_OP_ERROR;
+	record->error = c & FTDI_TRACE_OP_ERROR ? 1 : 0;
+	record->t = (double)trace->t_ns / 1e9;
+	record->duration = (double)duration / 1e9;
+	record->size = size;
+	record->data = trace->data;
+
+	return 1;
+}
+
+int ftdi_trace_rewind(struct ftdi_trace *trace)
+{
+	trace->t_ns = 0;
+	trace->records = 0;
+	return fseek(trace->f, trace->data_start, SEEK_SET) ? -1 : 0;
+}
+
+int ftdi_trace_close(struct ftdi_trace *trace)
+{
+	int err = 0;
+	if (trace->writing && ferror(trace->f)) {
+		err = -1;
+	}
+	if (fclose(trace->f) && trace->writing) {
+		err = -1;
+	}
+	free(trace->data);
+	free(trace);
+	return err;
+}
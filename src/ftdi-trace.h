@@ -0,0 +1,128 @@
+/*
+ * ftdi-bitbang
+ *
+ * Compact binary trace of usb operations made through bitbang context.
+ *
+ * File starts with a header:
+ *  "FTBT", version, bitmode, chip type, l_value, l_io, h_value, h_io
+ * where pin values are the state when tracing started. Each record after
+ * header is:
+ *  operation byte: FTDI_BITBANG_OP_*, bit 7 set if operation failed
+ *  time from start of previous record in nanoseconds, unsigned LEB128
+ *  duration of operation in nanoseconds, unsigned LEB128
+ *  size of data, unsigned LEB128, followed by data
+ * Data is bytes written for writes and bytes received for reads. Control
+ * operations store their arguments: io mask and bitmode for set_bitmode,
+ * baud rate as 32-bit little endian for baudrate, pin values for
+ * read_pins and milliseconds for latency_timer.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __FTDI_TRACE_H__
+#define __FTDI_TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define FTDI_TRACE_VERSION      1
+#define FTDI_TRACE_OP_ERROR     0x80
+
+struct ftdi_trace_header {
+	int version;
+	/* BITMODE_BITBANG or BITMODE_MPSSE */
+	int mode;
+	/* chip type, TYPE_* from libftdi */
+	int type;
+	uint8_t l_value;
+	uint8_t l_io;
+	uint8_t h_value;
+	uint8_t h_io;
+};
+
+struct ftdi_trace_record {
+	int op;
+	int error;
+	/* seconds from start of trace and duration of operation */
+	double t;
+	double duration;
+	size_t size;
+	/* valid until next record is read */
+	uint8_t *data;
+};
+
+struct ftdi_trace {
+	FILE *f;
+	int writing;
+	/* writing: time of previous record, CLOCK_MONOTONIC seconds */
+	double t_prev;
+	/* reading: nanoseconds from start of trace */
+	uint64_t t_ns;
+	uint8_t *data;
+	size_t data_size;
+	uint64_t records;
+	long data_start;
+};
+
+/**
+ * Create new trace file for writing.
+ *
+ * @param  filename   file to create, existing file is truncated
+ * @param  header     header to write, version is ignored
+ * @param  t_start    CLOCK_MONOTONIC seconds that first record time is relative to
+ * @return            trace context or NULL on errors
+ */
+struct ftdi_trace *ftdi_trace_create(const char *filename, const struct ftdi_trace_header *header, double t_start);
+
+/**
+ * Append record.
+ *
+ * @param  trace      trace context
+ * @param  op         operation type, FTDI_BITBANG_OP_*
+ * @param  error      non-zero if operation failed
+ * @param  t          CLOCK_MONOTONIC seconds when operation started
+ * @param  duration   time operation took in seconds
+ * @param  data       operation data, see above
+ * @param  size       size of data
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_trace_record(struct ftdi_trace *trace, int op, int error, double t, double duration, const void *data, size_t size);
+
+/**
+ * Open trace file for reading.
+ *
+ * @param  filename   trace file
+ * @param  header     header is read here
+ * @return            trace context or NULL on errors
+ */
+struct ftdi_trace *ftdi_trace_open(const char *filename, struct ftdi_trace_header *header);
+
+/**
+ * Read next record.
+ *
+ * @param  trace      trace context
+ * @param  record     record is read here
+ * @return            1 if record was read, 0 at end of trace or -1 on errors
+ */
+int ftdi_trace_next(struct ftdi_trace *trace, struct ftdi_trace_record *record);
+
+/**
+ * Start reading again from first record.
+ *
+ * @param  trace      trace context
+ * @return            0 on success or -1 on errors
+ */
+int ftdi_trace_rewind(struct ftdi_trace *trace);
+
+/**
+ * Close trace and free resources.
+ *
+ * @param  trace      trace context
+ * @return            0 on success or -1 if writing failed
+ */
+int ftdi_trace_close(struct ftdi_trace *trace);
+
+
+#endif /* __FTDI_TRACE_H__ */
@@ -0,0 +1,93 @@
+/*
+ * ftdi-bitbang
+ *
+ * Lock-free single producer, single consumer ring of fixed size buffers.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include "ringbuffer.h"
+
+
+int ringbuffer_init(struct ringbuffer *rb, unsigned int count, size_t slot_size)
+{
+	memset(rb, 0, sizeof(*rb));
+	if (count < 1 || slot_size < 1) {
+		return -1;
+	}
+	/* power of two so that free running indexes stay valid when they wrap */
+	for (rb->count = 1; rb->count < count; rb->count <<= 1);
+	rb->slot_size = (slot_size + RINGBUFFER_CACHE_LINE - 1) & ~(size_t)(RINGBUFFER_CACHE_LINE - 1);
+	rb->low_watermark = -1;
+	if (posix_memalign((void **)&rb->data, RINGBUFFER_CACHE_LINE, rb->slot_size * rb->count)) {
+		rb->data = NULL;
+		return -1;
+	}
+	rb->sizes = calloc(rb->count, sizeof(*rb->sizes));
+	if (!rb->sizes) {
+		free(rb->data);
+		rb->data = NULL;
+		return -1;
+	}
+	atomic_init(&rb->head, 0);
+	atomic_init(&rb->tail, 0);
+	return 0;
+}
+
+void ringbuffer_free(struct ringbuffer *rb)
+{
+	free(rb->data);
+	free(rb->sizes);
+	rb->data = NULL;
+	rb->sizes = NULL;
+}
+
+uint8_t *ringbuffer_write_slot(struct ringbuffer *rb, unsigned int ahead)
+{
+	unsigned int head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+	/* indexes run freely and wrap, difference is the fill */
+	if ((head + ahead - tail) >= rb->count) {
+		rb->full_count++;
+		return NULL;
+	}
+	return rb->data + ((head + ahead) & (rb->count - 1)) * rb->slot_size;
+}
+
+void ringbuffer_write_commit(struct ringbuffer *rb, size_t size)
+{
+	unsigned int head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+	rb->sizes[head & (rb->count - 1)] = size;
+	atomic_store_explicit(&rb->head, head + 1, memory_order_release);
+	if ((head + 1 - tail) > rb->high_watermark) {
+		rb->high_watermark = head + 1 - tail;
+	}
+}
+
+uint8_t *ringbuffer_read_slot(struct ringbuffer *rb, size_t *size)
+{
+	unsigned int tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&rb->head, memory_order_acquire);
+	if (head == tail) {
+		return NULL;
+	}
+	if (rb->low_watermark < 0 || (head - tail) < (unsigned int)rb->low_watermark) {
+		rb->low_watermark = head - tail;
+	}
+	*size = rb->sizes[tail & (rb->count - 1)];
+	return rb->data + (tail & (rb->count - 1)) * rb->slot_size;
+}
+
+void ringbuffer_read_release(struct ringbuffer *rb)
+{
+	unsigned int tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+	atomic_store_explicit(&rb->tail, tail + 1, memory_order_release);
+}
+
+unsigned int ringbuffer_fill(struct ringbuffer *rb)
+{
+	return atomic_load_explicit(&rb->head, memory_order_acquire) - atomic_load_explicit(&rb->tail, memory_order_acquire);
+}
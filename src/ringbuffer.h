@@ -0,0 +1,92 @@
+/*
+ * ftdi-bitbang
+ *
+ * Lock-free single producer, single consumer ring of fixed size buffers.
+ * All memory is allocated at init, producer fills slots in place.
+ *
+ * License: MIT
+ * Authors: Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#define RINGBUFFER_CACHE_LINE   64
+
+struct ringbuffer {
+	/* next slot to be written, modified only by producer */
+	_Alignas(RINGBUFFER_CACHE_LINE) atomic_uint head;
+	/* slots filled at most at once and times producer found ring full */
+	unsigned int high_watermark;
+	unsigned int full_count;
+
+	/* next slot to be read, modified only by consumer */
+	_Alignas(RINGBUFFER_CACHE_LINE) atomic_uint tail;
+	/* slots filled at least when consumer read, -1 until first read */
+	int low_watermark;
+
+	/* read only after init */
+	_Alignas(RINGBUFFER_CACHE_LINE) unsigned int count;
+	size_t slot_size;
+	uint8_t *data;
+	size_t *sizes;
+};
+
+/**
+ * Initialize ring.
+ *
+ * @param  rb         ring
+ * @param  count      number of slots, rounded up to power of two
+ * @param  slot_size  size of one slot in bytes, rounded up to cache line size
+ * @return            0 on success or -1 on errors
+ */
+int ringbuffer_init(struct ringbuffer *rb, unsigned int count, size_t slot_size);
+
+/**
+ * Free ring resources.
+ */
+void ringbuffer_free(struct ringbuffer *rb);
+
+/**
+ * Get free slot for producer to fill.
+ *
+ * @param  rb         ring
+ * @param  ahead      how many slots ahead of next one to write,
+ *                    allows filling several slots at once (in order)
+ * @return            pointer to slot or NULL if ring does not have enough free slots
+ */
+uint8_t *ringbuffer_write_slot(struct ringbuffer *rb, unsigned int ahead);
+
+/**
+ * Publish next slot to consumer.
+ *
+ * @param  rb         ring
+ * @param  size       bytes filled into slot
+ */
+void ringbuffer_write_commit(struct ringbuffer *rb, size_t size);
+
+/**
+ * Get oldest filled slot.
+ *
+ * @param  rb         ring
+ * @param  size       set to size of data in slot
+ * @return            pointer to slot or NULL if ring is empty
+ */
+uint8_t *ringbuffer_read_slot(struct ringbuffer *rb, size_t *size);
+
+/**
+ * Release slot got using ringbuffer_read_slot() back to producer.
+ */
+void ringbuffer_read_release(struct ringbuffer *rb);
+
+/**
+ * Get number of filled slots.
+ */
+unsigned int ringbuffer_fill(struct ringbuffer *rb);
+
+
+#endif /* __RINGBUFFER_H__ */